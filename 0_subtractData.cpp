@@ -3,8 +3,6 @@
 #include<algorithm>
 #include<set>
 
-#include<ShellExecVec.hpp>
-#include<ShellExec.hpp>
 #include<EvenSampledSignal.hpp>
 #include<SACSignals.hpp>
 #include<GMTPlotSignal.hpp>
@@ -12,6 +10,8 @@
 #include<Float2String.hpp>
 #include<GetHomeDir.hpp>
 
+#include "FileSystem.hpp"
+
 /**********************************************************************************
  *
  * Run this code on t041.DATA -- Use subtraction instead of deconvolution.
@@ -204,7 +204,7 @@ int main(int argc, char **argv){
         ******************/
 
         // Output Stripped waveforms.
-        ShellExec("mkdir -p "+ outputDir +"/"+eqName);
+        MakeDirs(outputDir +"/"+eqName);
 
         for (size_t i = 0; i< dataInfo.NRow(); ++i) {
             sqlData[3].push_back(eqName + "/" + dataInfo.GetString("stnm")[i]+".SStripped");
@@ -14,14 +14,13 @@
 
 #include<iostream>
 #include<vector>
-#include<queue>
 #include<thread>
-#include<atomic>
+#include<future>
 #include<algorithm>
 #include<mutex>
-#include<condition_variable>
+#include<memory>
+#include<atomic>
 
-#include<ShellExecVec.hpp>
 #include<ShellExec.hpp>
 #include<EvenSampledSignal.hpp>
 #include<SACSignals.hpp>
@@ -30,139 +29,226 @@
 #include<Float2String.hpp>
 #include<GetHomeDir.hpp>
 
+#include "ThreadPool.hpp"
+#include "ESWCache.hpp"
+#include "Prefetcher.hpp"
+#include "XCorrEngine.hpp"
+#include "StretchBank.hpp"
+#include "WaveformPack.hpp"
+#include "ResultsWriter.hpp"
+#include "StageTimer.hpp"
+#include "FileSystem.hpp"
+#include "HashKey.hpp"
+#include "WorkQueue.hpp"
+
 using namespace std;
 
-mutex mtx;
-condition_variable cv;
-queue<size_t> emptySlot;
+mutex mtx;   // console output.
+mutex dbMtx; // MariaDB calls only (the results writers).
 
 // Inputs. ------------------------------------
 
 const string homeDir = GetHomeDir();
 const string synDataDir = homeDir + "/PROJ/t039.UHVZ";
 const string premDataDir = homeDir + "/PROJ/t039.PREM/201500000000";
+const string eswCacheDir = homeDir + "/PROJ/t041.ESWCache";
+const bool useStretchBank = false; // fit sESW to half-widths from a bank of pre-stretched copies (quantized, see StretchBank.hpp).
 
 const size_t beginIndex = 600, endIndex = 600, TraceCnt = 451; // [beginIndex, endIndex] inclusive.
-const size_t nThread = 5;
+const size_t nThread = thread::hardware_concurrency();
+const size_t nPrefetch = 8, nReader = 2; // models read ahead of the workers, reader threads.
+const bool sharded = false;              // run as one of several worker processes (same inputs) sharing the models; see WorkQueue.hpp.
+const double claimTimeout = 600;         // sharded: seconds without a heartbeat before a worker's models are taken over.
 
 const bool reCreateTable = false, makePlots = true;
+const bool dumpAsciiWaveforms = false; // also write one text file per trace (the pack is always written).
 const double plotIndex = 600;
 
-const double filterCornerLow = 0.033, filterCornerHigh = 0.3, dt = 0.025;
+const double dt = 0.025;
 const double cutSourceT1 = -100, cutSourceT2 = 100;
 const double cutBeforeStripT1 = -100, cutBeforeStripT2 = 100;
-const double cutResultT1 = -50, cutResultT2 = 50;
+
+// Configurations: each writes its own result set, to dirPrefix + tag and table outputTable + tag ("": the base ones).
+// Each model is read once. Configurations with the same filter share the ESW, the preprocessing and the
+// stripping; only the result cut and the output run once per configuration.
+struct Config {
+    string tag;
+    double filterCornerLow, filterCornerHigh;
+    double cutResultT1, cutResultT2;
+};
+const vector<Config> configs {
+    {"", 0.033, 0.3, -50, 50},
+//  {"_f0.05", 0.05, 0.3, -50, 50},
+//  {"_cut40", 0.033, 0.3, -40, 40},
+};
 
 
 // Outputs. ------------------------------------
 
 const string dirPrefix=homeDir+"/PROJ/t041.REFL_UHVZ/Subtract";
 const string outputDB="REFL_UHVZ", outputTable="Subtract";
+const string resultsStore=homeDir+"/PROJ/ResultsStore"; // file-backed copy of every output table.
+const bool writeDatabase=true;                          // false: results go to resultsStore only.
+const string queueRoot=dirPrefix+"/.queue";             // sharded: one queue per sweep, on a filesystem all workers see.
 
 
 // --------------------------------------------
 
-void processThis(const size_t Index, int mySlot, const EvenSampledSignal &sESW);
-
-int main(){
-
-    // Update table.
-    if (reCreateTable) {
-
-        MariaDB::Query("drop table if exists "+outputDB+"."+outputTable);
-        MariaDB::Query("create table "+outputDB+"."+outputTable+" (PairName varchar(30) not null unique primary key, EQ varchar(20), Gcarc double, ScSStripped varchar(200), dirPrefix varchar(200))");
-    }
+ThreadPool pool(nThread);
+XCorrEngine xcorr; // FFTW plans shared by all models.
+const vector<string> outputColumns{"eq", "pairname", "gcarc", "ScSStripped", "dirPrefix"};
+unique_ptr<WorkQueue> workQueue; // sharded runs only.
+vector<unique_ptr<ResultsWriter>> writers; // one per configuration (sharded: the merge loads the database).
 
+// Configurations sharing one filter: its sESW, and its half-width fit (optionally a bank of pre-stretched sESWs).
+struct FilterGroup {
+    double filterCornerLow, filterCornerHigh;
+    EvenSampledSignal sESW;
+    StretchBank sESWBank;
+    vector<size_t> member; // positions in configs.
+};
 
-    // Make ESW one time.
+void processThis(const size_t Index, SACSignals Data, const FilterGroup &group, const shared_ptr<atomic<size_t>> &pending);
 
-    /***********************************
-    * 1. Read in PREM S waveform.      *
-    ***********************************/
-
-    SACSignals sESWData;
-
-    sESWData=SACSignals (ShellExecVec("ls "+premDataDir+"/*.THT.sac"));
+int main(){
 
-    if(sESWData.Size()!=TraceCnt) throw runtime_error("Reading error: PREM.");
+    // Library calls on the pool may plan FFTs too (the engines' own planning is locked in FFTWPlanner.hpp).
+    fftw_make_planner_thread_safe();
 
+    // Update tables (sharded: once, by the first worker).
+    auto recreateTable = [](){
 
-    sESWData.SortByGcarc();
-    sESWData.Interpolate(dt);
-    sESWData.RemoveTrend();
-    sESWData.HannTaper(20);
-    sESWData.Butterworth(filterCornerLow,filterCornerHigh);
+        for (const auto &config: configs) {
+            const string table=outputTable+config.tag;
+            DropResultsTable(resultsStore, outputDB+"."+table);
+            if (writeDatabase) {
+                MariaDB::Query("drop table if exists "+outputDB+"."+table);
+                MariaDB::Query("create table "+outputDB+"."+table+" (PairName varchar(30) not null unique primary key, EQ varchar(20), Gcarc double, ScSStripped varchar(200), dirPrefix varchar(200))");
+            }
+        }
+    };
 
+    // Sharded: workers claim models from a queue named after the sweep (models and parameters),
+    // and write their own store segments; merged at the end.
+    vector<string> modelNames;
+    for (size_t Index=0; Index<endIndex-beginIndex+1; ++Index) {
+        modelNames.push_back(to_string(201500000000+beginIndex+Index));
+    }
+    if (sharded) {
+        string sweepKey=synDataDir+"|"+premDataDir+"|"+to_string(TraceCnt)+"|"+KeyValue(dt);
+        sweepKey+="|"+KeyValue(cutSourceT1)+"|"+KeyValue(cutSourceT2)+"|"+KeyValue(cutBeforeStripT1)+"|"+KeyValue(cutBeforeStripT2);
+        for (const auto &config: configs) {
+            sweepKey+="|"+config.tag+"|"+KeyValue(config.filterCornerLow)+"|"+KeyValue(config.filterCornerHigh)+"|"+KeyValue(config.cutResultT1)+"|"+KeyValue(config.cutResultT2);
+        }
+        for (const auto &modelName: modelNames) {
+            sweepKey+="|"+modelName;
+        }
+        workQueue.reset(new WorkQueue(queueRoot+"/"+HashKey(sweepKey), modelNames, claimTimeout));
+        if (reCreateTable) {
+            workQueue->RunOnce("setup", recreateTable);
+        }
+    }
+    else if (reCreateTable) {
+        recreateTable();
+    }
 
-    // find S peak and shift time reference to the peak.
-    sESWData.FindPeakAround(sESWData.GetTravelTimes("S"),10);
-    sESWData.ShiftTimeReferenceToPeak();
-    sESWData.FlipPeakUp();
-    sESWData.NormalizeToPeak();
 
-    /********************************************
-    *
-    * 2. Make S ESW.
-    *
-    *******************************************/
+    for (const auto &config: configs) {
+        writers.emplace_back(new ResultsWriter(outputDB, outputTable+config.tag, outputColumns, &dbMtx, resultsStore, writeDatabase && !sharded));
+    }
 
-    sESWData.CheckAndCutToWindow(cutSourceT1-10,cutSourceT2+10);
 
-    auto sESW=sESWData.XCorrStack(0,-15,15,2).second.first;
-    sESW.FindPeakAround(0,10);
-    sESW.ShiftTimeReferenceToPeak();
-    sESW.CheckAndCutToWindow(cutSourceT1, cutSourceT2);
-    sESW.FlipPeakUp();
-    sESW.NormalizeToPeak();
-    sESW.HannTaper(20);
+    // Make ESW one time per filter (or load it from the cache, if PREM and the parameters are unchanged).
 
+    StageTimer eswTimer("ESW build");
+    vector<FilterGroup> groups;
+    for (size_t c=0; c<configs.size(); ++c) {
+        size_t g=0;
+        while (g<groups.size() && (groups[g].filterCornerLow!=configs[c].filterCornerLow || groups[g].filterCornerHigh!=configs[c].filterCornerHigh)) {
+            ++g;
+        }
+        if (g==groups.size()) {
+            const auto sESW = CachedSESW(eswCacheDir, premDataDir, TraceCnt, dt, configs[c].filterCornerLow, configs[c].filterCornerHigh, cutSourceT1, cutSourceT2);
+            groups.push_back(FilterGroup{configs[c].filterCornerLow, configs[c].filterCornerHigh, sESW, StretchBank(sESW, useStretchBank), {}});
+        }
+        groups[g].member.push_back(c);
+    }
+    eswTimer.Stop();
 
-    // stretch/shrink each S waveform to match the stack.
 
-    sESWData.StretchToFit(sESW,-13,13,-0.3,0.3,0.25,true); // stretch, then compare waveform Amp_WinDiff.
+    // Sharded: slot k runs the k-th model this worker claims. A pass ends when nothing is left to claim;
+    // the worker then waits for the others, and takes over the models of any that stop heartbeating.
+    do {
 
+        // Reader stage: keep the next few models loading in the background.
 
-    // make S ESW again.
+        Prefetcher<pair<size_t, SACSignals>> reader(modelNames.size(), [&modelNames](const size_t &slot){
+            const size_t Index=(workQueue ? workQueue->Claim() : slot);
+            if (Index==string::npos) {
+                return make_pair(Index, SACSignals());
+            }
+            const string modelFolder=synDataDir+"/"+modelNames[Index];
+            StageTimer timer("read", modelNames[Index]);
+            return make_pair(Index, SACSignals (Glob(modelFolder+"/*.THT.sac")));
+        }, nPrefetch, nReader);
+
+
+        // Run the tasks (for each model ...)
+
+        vector<future<void>> allTasks;
+        for (size_t slot=0; slot<modelNames.size(); ++slot) {
+            allTasks.push_back(pool.Submit([&groups, &reader](){
+                auto item=reader.Next().second;
+                if (item.first==string::npos) {
+                    return;
+                }
+                auto pending=make_shared<atomic<size_t>>(configs.size());
+                for (size_t g=0; g+1<groups.size(); ++g) {
+                    processThis(item.first, item.second, groups[g], pending);
+                }
+                processThis(item.first, move(item.second), groups.back(), pending);
+            }));
+        }
 
-    sESW=sESWData.XCorrStack(0,-15,15,2).second.first;
-    sESW.FindPeakAround(0,10);
-    sESW.ShiftTimeReferenceToPeak();
-    sESW.CheckAndCutToWindow(cutSourceT1, cutSourceT2);
-    sESW.FlipPeakUp();
-    sESW.NormalizeToPeak();
-    sESW.HannTaper(20);
+        for (auto &item: allTasks) {
+            item.get();
+        }
+        for (auto &writer: writers) {
+            writer->Flush();
+        }
 
+    } while (workQueue && workQueue->Wait());
 
 
-    // Run the threads (for each model ...)
+    // Merge, by the first worker to get here, per configuration: the results into one key-sorted segment,
+    // then the database from the merged results.
+    if (sharded) {
+        workQueue->RunOnce("merge", [&modelNames](){
 
-    vector<thread> allThreads(nThread);
-    for (size_t i=0; i<nThread; ++i) {
-        emptySlot.push(i);
-    }
+            for (const auto &config: configs) {
 
-    for (size_t Index=0; Index<endIndex-beginIndex+1; ++Index) {
-        unique_lock<mutex> lck(mtx);
-        while (emptySlot.empty()) {
-            cv.wait(lck);
-        }
-        if (allThreads[emptySlot.front()].joinable()) {
-            allThreads[emptySlot.front()].join();
-        }
-        allThreads[emptySlot.front()] = thread(processThis, Index, emptySlot.front(), cref(sESW));
-        emptySlot.pop();
-    }
+                const string table=outputTable+config.tag;
+                StageTimer timer("merge", table);
+                CompactResultsTable(resultsStore, outputDB+"."+table);
 
-    for (auto &item: allThreads) {
-        if (item.joinable()){
-            item.join();
-        }
+                if (writeDatabase) {
+                    const ResultsStore results(resultsStore, outputDB+"."+table);
+                    ResultsWriter loader(outputDB, table, outputColumns, &dbMtx);
+                    for (const auto &modelName: modelNames) {
+                        loader.Push(results.Cells(outputColumns, results.Rows("eq", modelName)), nullptr,
+                                    "delete from "+outputDB+"."+table+" where eq='"+modelName+"'");
+                    }
+                    loader.Flush();
+                }
+            }
+        }, false);
     }
+    WriteStageTrace(); // (if ASU_TRACE is set.)
 
     return 0;
 }
 
-void processThis(const size_t Index, int mySlot, const EvenSampledSignal &sESW){
+void processThis(const size_t Index, SACSignals Data, const FilterGroup &group, const shared_ptr<atomic<size_t>> &pending){
 
 
     /***************************************************
@@ -174,36 +260,34 @@ void processThis(const size_t Index, int mySlot, const EvenSampledSignal &sESW){
      *  4. Output waveforms.
      *  5. UpdateTables. (Optional)
      *
+     *  (steps 1 ~ 3 once for this filter, steps 4 ~ 5 for each configuration using it.)
+     *
      **************************************************/
 
-    unique_lock<mutex> lck(mtx);
     const string modelName=to_string(201500000000+beginIndex+Index);
+    const EvenSampledSignal &sESW=group.sESW;
+    const StretchBank &sESWBank=group.sESWBank;
 
-    // Properly modify the S ESW to look like ScS ESW: make the decon source.
+    unique_lock<mutex> lck(mtx);
     cout << "Processing synthetics: " << modelName << " ... " << endl;
+    lck.unlock();
 
 
     /************************************************
      *
-     * 1. Read in synthetic waveform.
+     * 1. Synthetic waveform (read in by the reader stage).
      *
     ************************************************/
 
-    const string modelFolder=synDataDir+"/"+modelName;
-
-    SACSignals Data;
-
-    Data=SACSignals (ShellExecVec("ls "+modelFolder+"/*.THT.sac"));
-    lck.unlock();
-
     if(Data.Size()!=TraceCnt) throw runtime_error("Reading error: " + modelName);
 
 
+    StageTimer timer("preprocess", modelName);
     Data.SortByGcarc();
     Data.Interpolate(dt);
     Data.RemoveTrend();
     Data.HannTaper(20);
-    Data.Butterworth(filterCornerLow,filterCornerHigh);
+    Data.Butterworth(group.filterCornerLow, group.filterCornerHigh);
 
 
     // find S peak and shift time reference to the peak.
@@ -221,17 +305,20 @@ void processThis(const size_t Index, int mySlot, const EvenSampledSignal &sESW){
     const SACSignals &beforeSStrip=Data;
 
     // Properly modify the S ESW to look like S (the method for the modification is optional).
+    timer.Next("stretch fit");
     vector<EvenSampledSignal> modifiedToFitS;
 
     for (size_t i=0; i<beforeSStrip.Size(); ++i) {
 
         //modifiedToFitS.push_back(sESW.StretchToFit(beforeSStrip.GetData()[i],-13,13,-0.3,0.3,0.25,true)); // stretch, then compare waveform Amp_WinDiff.
         //modifiedToFitScS.push_back(sESW.StretchToFit(beforeSStrip.GetData()[i],-13,13,-0.3,0.3,0.25,true,1)); // stretch, then compare waveform Amp_WinDiff.
-        modifiedToFitS.push_back(sESW.StretchToFitHalfWidth(beforeSStrip.GetData()[i])); // stretch to fit the half-width.
+        modifiedToFitS.push_back(sESWBank.FitHalfWidth(beforeSStrip.GetData()[i])); // stretch to fit the half-width.
     }
 
     // find the best-fit time shift and subtract modified S_ESW from S waveform.
-    auto SXCTimeShift=beforeSStrip.CrossCorrelation(-10,10,modifiedToFitS,-10,10).first;
+    timer.Next("cross-correlation");
+    auto SXCTimeShift=xcorr.CrossCorrelation(beforeSStrip.GetData(),-10,10,modifiedToFitS,-10,10).first;
+    timer.Next("strip");
     auto afterSStrip=beforeSStrip;
     afterSStrip.StripSignal(sESW,SXCTimeShift);
 
@@ -255,13 +342,14 @@ void processThis(const size_t Index, int mySlot, const EvenSampledSignal &sESW){
 
 
     // Properly modify the S ESW to look like ScS (the method for the modification is optional)..
+    timer.Next("stretch fit");
     vector<EvenSampledSignal> modifiedToFitScS;
 
     for (size_t i=0; i<beforeScSStrip.Size(); ++i) {
 
         //modifiedToFitScS.push_back(sESW.StretchToFit(beforeScSStrip.GetData()[i],-13,13,-0.3,0.3,0.25,true)); // stretch, then compare waveform Amp_WinDiff.
         //modifiedToFitScS.push_back(sESW.StretchToFit(beforeScSStrip.GetData()[i],-13,13,-0.3,0.3,0.25,true,1)); // stretch, then compare waveform Amp_WinDiff.
-        modifiedToFitScS.push_back(sESW.StretchToFitHalfWidth(beforeScSStrip.GetData()[i])); // stretch to fit the half-width.
+        modifiedToFitScS.push_back(sESWBank.FitHalfWidth(beforeScSStrip.GetData()[i])); // stretch to fit the half-width.
     }
 
 
@@ -274,6 +362,7 @@ void processThis(const size_t Index, int mySlot, const EvenSampledSignal &sESW){
 
 
 
+    timer.Next("strip");
     auto afterScSStrip=beforeScSStrip;
     afterScSStrip.StripSignal(modifiedToFitScS,ScSXCTimeShift);
 
@@ -284,21 +373,54 @@ void processThis(const size_t Index, int mySlot, const EvenSampledSignal &sESW){
     }
 
     beforeScSStrip.CheckAndCutToWindow(cutBeforeStripT1, cutBeforeStripT2);
-    afterScSStrip.CheckAndCutToWindow(cutResultT1,cutResultT2);
 
     /******************
      *
-     * 5. Output.
+     * 5. Output (for each configuration using this filter).
      *
     ******************/
 
-    // Output ScS waveforms (with proper S ESW stripped).
-    ShellExec("mkdir -p "+dirPrefix+"/"+modelName);
-    afterScSStrip.DumpWaveforms(dirPrefix+"/"+modelName,"StationName","","","ScSStripped");
+    timer.Next("output");
+    auto stationNames=Data.GetStationNames();
+    auto gcarcs=Data.GetDistances();
+
+    for (const auto &c: group.member) {
 
+        const Config &config=configs[c];
+        const string outDir=dirPrefix+config.tag;
+        auto result=afterScSStrip;
+        result.CheckAndCutToWindow(config.cutResultT1,config.cutResultT2);
 
-    // Plot
-    if (makePlots && beginIndex+Index==plotIndex) {
+        // Output ScS waveforms (with proper S ESW stripped), packed in one file per model.
+        MakeDirs(outDir+"/"+modelName);
+        WriteWaveformPack(outDir+"/"+modelName+"/ScSStripped.pack", result.GetData(), result.GetStationNames(), result.GetDistances());
+        if (dumpAsciiWaveforms) {
+            result.DumpWaveforms(outDir+"/"+modelName,"StationName","","","ScSStripped");
+        }
+
+        // Will always update database (queued; the writer thread batches the loads).
+        // (the model is done once its results for every configuration are stored.)
+        vector<vector<ResultsCell>> sqlData(5,vector<ResultsCell> ());
+        for (size_t i=0; i<Data.Size(); ++i) {
+            sqlData[0].push_back(modelName);
+            sqlData[1].push_back(modelName+"_"+stationNames[i]);
+            sqlData[2].push_back(Float2String(gcarcs[i],2));
+            sqlData[3].push_back(modelName+"/ScSStripped.pack");
+            sqlData[4].push_back(outDir);
+        }
+        writers[c]->Push(move(sqlData), [Index, pending](){
+            if (--*pending==0 && workQueue) {
+                workQueue->Done(Index);
+            }
+        });
+    }
+
+
+    // Plot (the first configuration).
+    timer.Next("plot");
+    if (makePlots && group.member.front()==0 && beginIndex+Index==plotIndex) {
+
+        afterScSStrip.CheckAndCutToWindow(configs[0].cutResultT1,configs[0].cutResultT2);
 
         vector<string> outfiles;
         string outfile;
@@ -333,33 +455,16 @@ void processThis(const size_t Index, int mySlot, const EvenSampledSignal &sESW){
 
         for (auto file: outfiles) {
             GMT::SealPlot(file);
-            ShellExec("cat "+file+" >> tmp.ps");
+        }
+        Concatenate(outfiles, "tmp.ps");
+        for (auto file: outfiles) {
             remove(file.c_str());
         }
         string pdffile=__FILE__;
         ShellExec("ps2pdf tmp.ps "+pdffile.substr(0,pdffile.find_last_of("."))+".pdf");
         remove("tmp.ps");
     }
-
-
-    // Will always update database (thread-safe needed).
-    lck.lock();
-
-    auto stationNames=Data.GetStationNames();
-    auto gcarcs=Data.GetDistances();
-    vector<vector<string>> sqlData(5,vector<string> ());
-    for (size_t i=0; i<Data.Size(); ++i) {
-        sqlData[0].push_back(modelName);
-        sqlData[1].push_back(modelName+"_"+stationNames[i]);
-        sqlData[2].push_back(Float2String(gcarcs[i],2));
-        sqlData[3].push_back(modelName+"/"+stationNames[i]+".ScSStripped");
-        sqlData[4].push_back(dirPrefix);
-    }
-    MariaDB::LoadData(outputDB,outputTable,vector<string> {"eq", "pairname", "gcarc", "ScSStripped", "dirPrefix"},sqlData);
-
-
-    emptySlot.push(mySlot);
-    cv.notify_one();
+    timer.Stop();
 
     return;
 }
@@ -6,6 +6,13 @@
 #include<MeshGrid.hpp>
 #include<GMT.hpp>
 #include<WayPoint.hpp>
+#include<GetHomeDir.hpp>
+
+#include "SphereIndex.hpp"
+#include "BinMembership.hpp"
+#include "TableSnapshot.hpp"
+#include "StageTimer.hpp"
+#include "FileSystem.hpp"
 
 using namespace std;
 
@@ -23,40 +30,44 @@ const double lonMin = -99, lonMax = -64, latMin = -5, latMax = 27;
 const double binRadius = 4, binInc = binRadius;
 const size_t recordCntThreshold = 100;
 const bool makePlot = true, recreateTable = false;
+const string snapshotDir = GetHomeDir() + "/PROJ/Snapshots"; // columnar copies of the tables read here, re-read every run (the tables change).
 
 // Outputs. --------------------------------
 
 const string outputDB="gen2CA_D";
-const string outputTable1="Bins",outputTable2="CenterDists";
+const string outputTable1="Bins",outputTable2="BinMembers"; // BinMembers: (bin, pairname, centerDist), members only.
+const string membershipFile=GetHomeDir()+"/PROJ/t013.ScS_NextGen/BinMembership.bin"; // same, in CSR binary form.
 
 // -----------------------------------------
 
 int main(){
     
-    auto dataInfo=MariaDB::Select("pairname, hitlo, hitla, shift_gcarc from " + inputTable);
+    StageTimer timer("read");
+    auto dataInfo=SnapshotSelect(snapshotDir, "pairname, hitlo, hitla, shift_gcarc from " + inputTable, "sddd", true);
 
     // Make bins.
+    timer.Next("binning");
     vector<vector<double>> p{{latMax,latMin,binInc},{lonMin,lonMax+1e-5,binInc}};
-    vector<vector<string>> allData{dataInfo.GetString("pairname")};
+    const auto pairname=dataInfo.GetString("pairname");
     auto grid=MeshGrid(p,1);
-    vector<string> nRecord,lon_before,lat_before,lon,lat,bin,radius,averagedDist, columnNames{"pairname"};
+    vector<string> nRecord,lon_before,lat_before,lon,lat,bin,radius,averagedDist;
+    vector<string> memberBin, memberPairname, memberDist;
+    BinMembership membership;
     size_t binN=1;
-    string newColumns="";
+
+    // Index the bounce points once; each bin is then a radius query.
+    const auto hitlo=dataInfo.GetDouble("hitlo"), hitla=dataInfo.GetDouble("hitla"), shiftGcarc=dataInfo.GetDouble("shift_gcarc");
+    const SphereIndex bouncePoints(hitlo, hitla, binRadius);
 
     for (auto item:grid) {
 
-        size_t recordCnt = 0;
         double newLon = 0, newLat = 0, dist = 0;
-        vector<double> curData(dataInfo.NRow(),0);
-        for (size_t i=0; i<dataInfo.NRow(); ++i) {
-            curData[i]=GcpDistance(dataInfo.GetDouble("hitlo")[i], dataInfo.GetDouble("hitla")[i], item[1], item[0]);
-            if (curData[i]<=binRadius) {
-                ++recordCnt;
-                dist += dataInfo.GetDouble("shift_gcarc")[i];
-                newLon += dataInfo.GetDouble("hitlo")[i];
-                newLat += dataInfo.GetDouble("hitla")[i];
-            }
-            else curData[i]=-1;
+        auto inBin=bouncePoints.Query(item[1], item[0], binRadius);
+        size_t recordCnt = inBin.size();
+        for (auto i: inBin) {
+            dist += shiftGcarc[i];
+            newLon += hitlo[i];
+            newLat += hitla[i];
         }
 
         if (recordCnt>=recordCntThreshold) {
@@ -73,17 +84,19 @@ int main(){
             nRecord.push_back(to_string(recordCnt));
             averagedDist.push_back(to_string(dist));
 
-            columnNames.push_back("dist_"+bin.back());
-            newColumns+=", "+columnNames.back()+" double ";
-            allData.push_back({});
-            for (size_t i=0; i<dataInfo.NRow(); ++i) {
-                if (curData[i]<0) allData.back().push_back("-1");
-                else allData.back().push_back(to_string(GcpDistance(dataInfo.GetDouble("hitlo")[i], dataInfo.GetDouble("hitla")[i], newLon, newLat)));
+            membership.AddBin(binN-1, binRadius);
+            for (auto i: inBin) {
+                double centerDist=GcpDistance(hitlo[i], hitla[i], newLon, newLat);
+                membership.AddMember(pairname[i], centerDist);
+                memberBin.push_back(bin.back());
+                memberPairname.push_back(pairname[i]);
+                memberDist.push_back(to_string(centerDist));
             }
         }
     }
 
     // Output.
+    timer.Next("DB write");
 
     if (recreateTable) {
 
@@ -92,17 +105,23 @@ int main(){
         MariaDB::Query("drop table if exists "+outputDB+"."+outputTable2);
 
         MariaDB::Query("create table "+outputDB+"."+outputTable1+" (bin integer, nRecord integer, radius double, lon_before double, lat_before double, lon double, lat double, averagedDist double)");
-        MariaDB::Query("create table "+outputDB+"."+outputTable2+" (pairname varchar(30) not null unique primary key"+newColumns+")");
+        MariaDB::Query("create table "+outputDB+"."+outputTable2+" (bin integer, pairname varchar(30), centerDist double, primary key (bin, pairname))");
 
         MariaDB::LoadData(outputDB,outputTable1,vector<string> {"bin","nRecord","radius","lon_before","lat_before","lon","lat", "averagedDist"},vector<vector<string>> {bin,nRecord,radius,lon_before,lat_before,lon,lat, averagedDist});
-        MariaDB::LoadData(outputDB,outputTable2,columnNames,allData);
+        MariaDB::LoadData(outputDB,outputTable2,vector<string> {"bin","pairname","centerDist"},vector<vector<string>> {memberBin,memberPairname,memberDist});
+
+        WriteBinMembership(membershipFile, membership);
+    }
+    else {
+        LoadBinMembership(membershipFile, outputDB+"."+outputTable1, outputDB+"."+outputTable2); // (the tables are kept: if the file is missing, make it from them.)
     }
 
 
     // plot.
+    timer.Next("plot");
     if (makePlot) {
 
-        string outfile=GMT::BeginEasyPlot(15,15,ShellExec("pwd",true)+"/"+string(__FILE__));
+        string outfile=GMT::BeginEasyPlot(15,15,CurrentDir()+"/"+string(__FILE__));
         double scale=13.0/37;
         GMT::MoveReferencePoint(outfile,"-Xf1i -Yf1i");
         GMT::psbasemap(outfile,"-Jx"+to_string(scale)+"id/"+to_string(scale)+"id -R-101/-64/-5/27 -Bxa10f5 -Bya10f5 -Bx+lLongitude -By+lLatitude -BWSne -O -K");
@@ -135,5 +154,8 @@ int main(){
     }
 
 
+    timer.Stop();
+    WriteStageTrace(); // (if ASU_TRACE is set.)
+
     return 0;
 }
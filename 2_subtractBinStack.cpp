@@ -1,25 +1,38 @@
 #include<iostream>
 #include<map>
-#include<queue>
+#include<memory>
 #include<thread>
-#include<atomic>
+#include<future>
 #include<mutex>
-#include<condition_variable>
+#include<atomic>
+#include<tuple>
 
 #include<MariaDB.hpp>
 #include<EvenSampledSignal.hpp>
-#include<ShellExec.hpp>
 #include<PNormErr.hpp>
 #include<RampFunction.hpp>
 #include<GetHomeDir.hpp>
 
 #include "CalculateCQ.hpp"
+#include "ThreadPool.hpp"
+#include "Prefetcher.hpp"
+#include "BinMembership.hpp"
+#include "WaveformPack.hpp"
+#include "HashKey.hpp"
+#include "CheckpointJournal.hpp"
+#include "MatrixStack.hpp"
+#include "SignalMatrix.hpp"
+#include "StageTimer.hpp"
+#include "ResultsWriter.hpp"
+#include "TopKTracker.hpp"
+#include "TableSnapshot.hpp"
+#include "FileSystem.hpp"
+#include "WorkQueue.hpp"
 
 using namespace std;
 
-mutex mtx;
-condition_variable cv;
-queue<size_t> emptySlot;
+mutex mtx;   // console output.
+mutex dbMtx; // MariaDB calls only (the results writers).
 
 /*
 
@@ -46,52 +59,137 @@ For each bin,
 const string targetModelType = "Lamella";         // "PREM" or "ULVZ" or "UHVZ" or "Lamella" or "All"(ignore beginIndex/endIndex)
 const size_t beginIndex = 1, endIndex = 1584;
 const bool reCreateTable = false;
+const bool incremental = true; // skip models whose results in the journal match the current inputs and parameters.
+const bool sharded = false;       // run as one of several worker processes (same inputs) sharing the models; see WorkQueue.hpp.
+const double claimTimeout = 600;  // sharded: seconds without a heartbeat before a worker's models are taken over.
 
-const size_t nThread = 5;
+const size_t nThread = thread::hardware_concurrency();
+const size_t nPrefetch = 8, nReader = 2; // models read ahead of the workers, reader threads.
 
-const double distanceCutOff = 70; // To eiliminating Scd possiblility, do a hard distance cut-off.
 const size_t cntThreshold = 20;
-const double binEdgeWeight = 0.3, snrQuantile = 0.1, compareLen = 10;
-const double weightSigma = sqrt(-1.0 / 2 / log(binEdgeWeight));
+
+// Configurations: each writes its own result set, to table outputTable + tag ("": the table itself).
+// Data and models are read once. The data side is shared by configurations with the same cutoff,
+// edge weight and SNR quantile; the model side and the comparison run once per configuration.
+struct Config {
+    string tag;
+    double distanceCutOff;  // To eiliminating Scd possiblility, do a hard distance cut-off.
+    double binEdgeWeight, snrQuantile, compareLen;
+    double WeightSigma() const {return sqrt(-1.0 / 2 / log(binEdgeWeight));}
+};
+const vector<Config> configs {
+    {"", 70, 0.3, 0.1, 10},
+//  {"_cutoff75", 75, 0.3, 0.1, 10},
+//  {"_compareLen15", 70, 0.3, 0.1, 15},
+};
+const size_t topKCount = 50;                                  // best models kept per bin per family, in the summary.
+const double topKdRhoMin = -10, topKdRhoMax = 20, topKMaxThickness = 50; // models outside these don't enter the summary.
 
 const string homeDir = GetHomeDir();
 const string infoTable = "gen2CA_D.Master_a14";
 const string dataTable = "gen2CA_D.Subtract";
-const string binTable = "gen2CA_D.Bins";
-const string binCenterDistTable = "gen2CA_D.CenterDists";
+const string binMembershipFile = homeDir + "/PROJ/t013.ScS_NextGen/BinMembership.bin"; // written by 1_Binning,
+const string binTable = "gen2CA_D.Bins", binMemberTable = "gen2CA_D.BinMembers";         // or made from these if it's missing.
 const string propertyTable = "gen2CA_D.Properties";
 const string premTable = "REFL_PREM.Subtract";
 const string ulvzTable = "REFL_ULVZ.Subtract";
 const string uhvzTable = "REFL_UHVZ.Subtract";
 const string lamellaTable = "REFL_Lamella.Subtract";
+const string snapshotDir = homeDir + "/PROJ/Snapshots"; // columnar copies of the tables above, re-read every run:
+                                                        // they are rewritten by other steps (Properties.criticalDist by
+                                                        // updateCriticalDistance, the model tables by the modeling runs).
 
 // Outputs. ------------------------
 
 const string outputDB = "gen2CA_D";
 const string outputTable = "ModelingResult_Subtract";
 const string dirPrefix = homeDir + "/PROJ/t013.ScS_NextGen/Subtract";
+const string resultsStore = homeDir + "/PROJ/ResultsStore"; // file-backed copy of every output table.
+const bool writeDatabase = true;                             // false: results go to resultsStore only.
+// (per configuration: the summary dirPrefix/<table>.topk, per-bin best models and PREM cq (TopKTracker.hpp),
+//  and the journal dirPrefix/<table>.journal; sharded, each worker also keeps <table>.journal.<host>-<pid>.)
+const string queueRoot = dirPrefix + "/" + outputTable + ".queue";    // sharded: one queue per sweep, on a filesystem all workers see.
 
 
 // --------------------------------
 
-
-void modelThese(size_t num, size_t mySlot,
-
-                const string &modelName, const map<string, double> &criticalDistance,
-                const vector<EvenSampledSignal> &dataWaveform, const map<string,size_t> &dataPairNameToIndex,
+ThreadPool pool(nThread);
+const vector<string> outputColumns {"pairname", "bin", "modelName", "CQ", "CQ2", "dataScSStack", "modelScSStack","stackTraceCnt", "weightSum", "dataScSStackStd", "modelScSStackStd", "dirPrefix"};
+unique_ptr<WorkQueue> workQueue; // sharded runs only.
+
+// Outputs of one configuration.
+struct ConfigRun {
+    string table, topKFile, journalFile;
+    string paramKey;                        // parameters + data behind its results.
+    unique_ptr<CheckpointJournal> journal;
+    unique_ptr<TopKTracker> topK;
+    unique_ptr<ResultsWriter> writer;       // (sharded: the merge loads the database.) Declared last: flushed before the rest goes.
+};
+vector<ConfigRun> runs; // one per configuration.
+
+struct ModelWaveforms {
+    vector<EvenSampledSignal> waveform;
+    map<string,size_t> pairNameToIndex;
+    vector<string> inputKey;     // per configuration: inputs + parameters behind this model's results.
+    vector<bool> upToDate;       // per configuration: results are current (all current: waveforms are not read).
+    size_t index = string::npos; // position in modelNames (npos: nothing left to claim).
+};
+
+ModelWaveforms readModel(const string &modelName, const map<string, TableSnapshot> &modelTables, const double &criticalDist);
+
+// Data-side work of one bin for one cutoff distance (and weighting); the same for every model sharing the cutoff.
+struct DataBinStack {
+    vector<size_t> member;     // positions (in the bin) of the data used: gcarc < cutoff.
+    vector<double> weight;     // stack weight of each member.
+    vector<pair<string,double>> stationWeight; // member weights summed onto the synthetic station each member uses.
+    double critSNR = -1, weightSum = 0;
+    bool stacked = false;      // false: too few traces or too little weight.
+    pair<EvenSampledSignal, EvenSampledSignal> stack; // data stack and its std, cut to -29 ~ 29 sec.
+    string stackFilename, stackStdFilename;
+};
+
+shared_ptr<const DataBinStack> getDataBinStack(size_t i, double critDist, const Config &config,
+                                               const SignalMatrix &dataWaveform, const map<string,size_t> &dataPairNameToIndex,
+                                               const map<double,string> &gcarcSTNM,
+                                               const vector<vector<string>> &binPairnames,
+                                               const vector<vector<double>> &dataBinCenterDists, const vector<vector<double>> &dataBinGcarc,
+                                               const vector<vector<double>> &dataBinSNR,
+                                               const vector<double> &binRadius);
+
+shared_ptr<const DataBinStack> makeDataBinStack(size_t i, double critDist, const Config &config,
+                                                const SignalMatrix &dataWaveform, const map<string,size_t> &dataPairNameToIndex,
+                                                const map<double,string> &gcarcSTNM,
+                                                const vector<vector<string>> &binPairnames,
+                                                const vector<vector<double>> &dataBinCenterDists, const vector<vector<double>> &dataBinGcarc,
+                                                const vector<vector<double>> &dataBinSNR,
+                                                const vector<double> &binRadius);
+
+void modelThese(size_t num, size_t c,
+
+                const string &modelName, const ModelWaveforms &model, const map<string, double> &criticalDistance,
+                const SignalMatrix &dataWaveform, const map<string,size_t> &dataPairNameToIndex,
                 const map<double,string> &gcarcSTNM,
                 const vector<vector<string>> &binPairnames,
                 const vector<vector<double>> &dataBinCenterDists, const vector<vector<double>> &dataBinGcarc,
                 const vector<vector<double>> &dataBinSNR,
-                const vector<double> &binRadius);
+                const vector<double> &binRadius,
+                const shared_ptr<atomic<size_t>> &pending);
 
 int main(){
 
-    // Update table.
-    if (reCreateTable) {
+    // Update tables (sharded: by the first worker, once the queue is up).
+    auto recreateTable = [](const string &table){
 
-        MariaDB::Query("drop table if exists " + outputDB + "." + outputTable);
-        MariaDB::Query("create table " + outputDB + "." + outputTable + " (pairname varchar(40) not null unique primary key, bin integer, modelName varchar(30), CQ double, CQ2 double comment \"Should be this?\", dataScSStack varchar(200), modelScSStack varchar(200), stackTraceCnt integer, weightSum double, dataScSStackStd varchar(200), modelScSStackStd varchar(200), dirPrefix varchar(200), index (bin), index(cq))");
+        DropResultsTable(resultsStore, outputDB + "." + table);
+        if (writeDatabase) {
+            MariaDB::Query("drop table if exists " + outputDB + "." + table);
+            MariaDB::Query("create table " + outputDB + "." + table + " (pairname varchar(40) not null unique primary key, bin integer, modelName varchar(30), CQ double, CQ2 double comment \"Should be this?\", dataScSStack varchar(200), modelScSStack varchar(200), stackTraceCnt integer, weightSum double, dataScSStackStd varchar(200), modelScSStackStd varchar(200), dirPrefix varchar(200), index (bin), index(cq))");
+        }
+    };
+    if (reCreateTable && !sharded) {
+        for (const auto &config: configs) {
+            recreateTable(outputTable + config.tag);
+        }
     }
 
 
@@ -106,7 +204,7 @@ int main(){
     }
 
     //
-    auto critInfo = MariaDB::Select("modelName, criticalDist from " + propertyTable);
+    auto critInfo = SnapshotSelect(snapshotDir, "modelName, criticalDist, thickness, drho from " + propertyTable, "sddd", true);
     map<string, double> criticalDistance;
     for (size_t i = 0; i < critInfo.NRow(); ++i) {
         criticalDistance[critInfo.GetString("modelName")[i]]=critInfo.GetDouble("criticalDist")[i];
@@ -118,23 +216,31 @@ int main(){
 
     // Get data info, make a map between pairname and the index.
     // Read in data waveform, cut to -30 ~ 30 sec.
-    auto dataInfo = MariaDB::Select("A.pairname as pn, concat(A.dirPrefix,'/',A.SStripped) as SFile, concat(A.dirPrefix,'/',A.ScSStripped) as ScSFile, B.eq as eq, B.stnm as stnm, B.shift_gcarc as shift_gcarc, B.SNR2_ScS as snr from " + dataTable + " as A join " + infoTable + " as B on A.pairname=B.pairname");
+    auto dataInfo = SnapshotSelect(snapshotDir, "A.pairname as pn, concat(A.dirPrefix,'/',A.SStripped) as SFile, concat(A.dirPrefix,'/',A.ScSStripped) as ScSFile, B.eq as eq, B.stnm as stnm, B.shift_gcarc as shift_gcarc, B.SNR2_ScS as snr from " + dataTable + " as A join " + infoTable + " as B on A.pairname=B.pairname", "sssssdd", true);
 
-    vector<EvenSampledSignal> dataWaveform;
+    // (kept as one float32 matrix, row i is record i; see SignalMatrix.hpp.)
+    StageTimer dataTimer("read data");
+    SignalMatrix dataWaveform;
     map<string,size_t> dataPairNameToIndex;
 
     for (size_t i = 0; i < dataInfo.NRow(); ++i) {
-        dataWaveform.push_back(EvenSampledSignal(dataInfo.GetString("ScSFile")[i]) - EvenSampledSignal(dataInfo.GetString("SFile")[i]));
+        auto trace = EvenSampledSignal(dataInfo.GetString("ScSFile")[i]) - EvenSampledSignal(dataInfo.GetString("SFile")[i]);
 
-        dataWaveform.back().CheckAndCutToWindow(-30, 30);
-        dataWaveform.back().Mask(0, 30);
-        dataWaveform.back().FlipReverseSum(0);
+        trace.CheckAndCutToWindow(-30, 30);
+        trace.Mask(0, 30);
+        trace.FlipReverseSum(0);
+        dataWaveform.Append(trace);
         dataPairNameToIndex[dataInfo.GetString("pn")[i]] = i;
     }
+    dataTimer.Stop();
+    if (dataWaveform.Regridded() != 0) {
+        cout << "Warning: " << dataWaveform.Regridded() << " data traces are not on the first trace's grid; "
+             << "they are linearly interpolated onto it (SignalMatrix.hpp)." << endl;
+    }
 
 
     // Make a map between gcarc and stnm (for synthetics selection)
-    auto premInfo = MariaDB::Select("pairname, gcarc from " + premTable);
+    auto premInfo = SnapshotSelect(snapshotDir, "pairname, gcarc from " + premTable, "sd", true);
     map<double,string> gcarcSTNM;
 
     for (size_t i = 0; i < premInfo.NRow(); ++i) {
@@ -146,19 +252,17 @@ int main(){
     // Get data distance to bin center for each bin.
     // Get bin radius for each bin.
     // Get the gcarc distances in each bin.
-    auto binInfo = MariaDB::Select("bin, radius from " + binTable);
+    // (all from the membership file written by 1_Binning, in one read; made from the tables if it's missing.)
+    const auto membership = LoadBinMembership(binMembershipFile, binTable, binMemberTable);
 
     vector<vector<string>> binPairnames;
     vector<vector<double>> dataBinCenterDists, dataBinGcarc, dataBinSNR;
-    vector<double> binRadius;
+    const vector<double> &binRadius = membership.radius;
 
-    for (size_t i = 0; i < binInfo.NRow(); ++i) {
-        const string binN = to_string(binInfo.GetInt("bin")[i]);
-        auto binDataInfo = MariaDB::Select("pairname, dist_" + binN + " as centerDist from " + binCenterDistTable + " where dist_" + binN + " >= 0");
+    for (size_t i = 0; i < membership.NBin(); ++i) {
 
-        binPairnames.push_back(binDataInfo.GetString("pairname"));
-        dataBinCenterDists.push_back(binDataInfo.GetDouble("centerDist"));
-        binRadius.push_back(binInfo.GetDouble("radius")[i]);
+        binPairnames.push_back(membership.Pairnames(i));
+        dataBinCenterDists.push_back(membership.CenterDists(i));
 
         dataBinGcarc.push_back(vector<double> ());
         dataBinSNR.push_back(vector<double> ());
@@ -169,205 +273,552 @@ int main(){
     }
 
 
-    // Start modeling.
-    // For each model, for each bin, do modeling.
-    vector<thread> allThreads(nThread);
-    for (size_t i = 0; i < nThread; ++i) {
-        emptySlot.push(i);
+    // Checkpoint: one journal per configuration, one line per finished model, keyed by what produced it.
+    // Everything shared by all models goes into each configuration's paramKey; readModel adds the model's own inputs.
+    // (bump the version in the paramKey whenever the computation changes, so older results are recomputed.)
+    MakeDirs(dirPrefix);
+
+    string dataKey = "|" + Fingerprint(binMembershipFile);
+    for (size_t i = 0; i < dataInfo.NRow(); ++i) {
+        dataKey += "|" + dataInfo.GetString("pn")[i] + "|" + Fingerprint(dataInfo.GetString("SFile")[i]) + "|" + Fingerprint(dataInfo.GetString("ScSFile")[i]);
+        dataKey += "|" + KeyValue(dataInfo.GetDouble("shift_gcarc")[i]) + "|" + KeyValue(dataInfo.GetDouble("snr")[i]);
     }
 
-    for (size_t runThisModel = 0; runThisModel < modelNames.size(); ++runThisModel){
+    for (const auto &config: configs) {
+        ConfigRun run;
+        run.table = outputTable + config.tag;
+        run.topKFile = dirPrefix + "/" + run.table + ".topk";
+        run.journalFile = dirPrefix + "/" + run.table + ".journal";
+        run.paramKey = "subtractBinStack v2|" + KeyValue(config.distanceCutOff) + "|" + to_string(cntThreshold) + "|" + KeyValue(config.binEdgeWeight);
+        run.paramKey += "|" + KeyValue(config.snrQuantile) + "|" + KeyValue(config.compareLen) + dataKey;
+        run.paramKey = HashKey(run.paramKey);
+        runs.push_back(move(run));
+    }
 
-        unique_lock<mutex> lck(mtx);
-        while (emptySlot.empty()) {
-            cv.wait(lck);
+    // Sharded: workers claim models from a queue named after the sweep (models, inputs, parameters),
+    // each with its own journals (on top of the shared ones) and its own store segments; merged at the end.
+    if (sharded) {
+        string sweepKey;
+        for (const auto &run: runs) {
+            sweepKey += "|" + run.paramKey;
+        }
+        for (const auto &modelName: modelNames) {
+            sweepKey += "|" + modelName;
+        }
+        workQueue.reset(new WorkQueue(queueRoot + "/" + HashKey(sweepKey), modelNames, claimTimeout));
+        if (reCreateTable) {
+            workQueue->RunOnce("setup", [&](){
+                for (const auto &run: runs) {
+                    recreateTable(run.table);
+                    remove(run.journalFile.c_str());
+                    RemoveFiles(run.journalFile + ".*");
+                }
+            });
         }
-        if (allThreads[emptySlot.front()].joinable()) {
-            allThreads[emptySlot.front()].join();
+    }
+
+    // Per-bin best models: continue the saved summary, or rebuild it from the results so far.
+    // (sharded: rebuilt by the merge.)
+    auto rebuildTopK = [](ConfigRun &run){
+        const ResultsStore done(resultsStore, outputDB + "." + run.table);
+        if (done.NRow() > 0) {
+            const auto &doneModelName = done.GetString("modelName");
+            const auto doneBin = done.GetInt("bin");
+            const auto &doneCQ = done.GetDouble("cq");
+            for (size_t r = 0; r < done.NRow(); ++r) {
+                run.topK->Update(doneModelName[r], doneBin[r], doneCQ[r]);
+            }
         }
-        allThreads[emptySlot.front()] = thread(modelThese, runThisModel, emptySlot.front(),
+    };
 
-                                               cref(modelNames[runThisModel]), cref(criticalDistance),
-                                               cref(dataWaveform), cref(dataPairNameToIndex),
-                                               cref(gcarcSTNM),
-                                               cref(binPairnames),
-                                               cref(dataBinCenterDists), cref(dataBinGcarc), cref(dataBinSNR),
-                                               cref(binRadius));
+    for (auto &run: runs) {
 
+        run.journal.reset(new CheckpointJournal(sharded ? run.journalFile + "." + WorkQueue::WorkerId() : run.journalFile, reCreateTable && !sharded));
+        if (sharded) {
+            run.journal->Read(run.journalFile);
+        }
 
-        emptySlot.pop();
+        run.topK.reset(new TopKTracker(topKCount, topKdRhoMin, topKdRhoMax, topKMaxThickness));
+        for (size_t i = 0; i < critInfo.NRow(); ++i) {
+            run.topK->SetModel(critInfo.GetString("modelName")[i], critInfo.GetDouble("thickness")[i], critInfo.GetDouble("drho")[i]);
+        }
+        if (!sharded && !reCreateTable && !run.topK->Load(run.topKFile)) {
+            rebuildTopK(run);
+        }
+
+        run.writer.reset(new ResultsWriter(outputDB, run.table, outputColumns, &dbMtx, resultsStore, writeDatabase && !sharded));
     }
 
-    for (auto &item: allThreads) {
-        if (item.joinable()){
-            item.join();
+
+    // Trace lists of the model tables in use (one query per table, re-run every time: the tables change
+    // when models are re-made; readModel picks its model's rows).
+    map<string, TableSnapshot> modelTables;
+    for (const auto &modelName: modelNames) {
+        const string modelType = modelName.substr(0, modelName.find("_"));
+        const string modelTable = ( modelType == "PREM" ? premTable : ( modelType == "ULVZ" ? ulvzTable : ( modelType == "UHVZ" ? uhvzTable : lamellaTable)));
+        if (modelTables.find(modelType) == modelTables.end()) {
+            modelTables.emplace(modelType, SnapshotSelect(snapshotDir, "eq, pairname, concat(dirPrefix,'/',ScSStripped) as fn from " + modelTable + " order by pairname", "sss", true));
         }
     }
 
+
+    // Sharded: slot k runs the k-th model this worker claims. A pass ends when nothing is left to claim;
+    // the worker then waits for the others, and takes over the models of any that stop heartbeating.
+    do {
+
+        // Reader stage: keep the next few models loading in the background.
+        Prefetcher<ModelWaveforms> reader(modelNames.size(), [&](const size_t &slot){
+            const size_t runThisModel = (workQueue ? workQueue->Claim() : slot);
+            if (runThisModel == string::npos) {
+                return ModelWaveforms();
+            }
+            const string &modelName = modelNames[runThisModel];
+            auto ans = readModel(modelName, modelTables, criticalDistance.at(modelName));
+            ans.index = runThisModel;
+            return ans;
+        }, nPrefetch, nReader);
+
+
+        // Start modeling.
+        // For each model, for each bin, do modeling.
+        vector<future<void>> allTasks;
+
+        for (size_t slot = 0; slot < modelNames.size(); ++slot){
+
+            allTasks.push_back(pool.Submit([&](){
+
+                const auto model = reader.Next().second;
+                if (model.index == string::npos) {
+                    return;
+                }
+                auto pending = make_shared<atomic<size_t>>(configs.size());
+                for (size_t c = 0; c < configs.size(); ++c) {
+                    modelThese(model.index, c,
+                               modelNames[model.index], model, criticalDistance,
+                               dataWaveform, dataPairNameToIndex,
+                               gcarcSTNM,
+                               binPairnames,
+                               dataBinCenterDists, dataBinGcarc, dataBinSNR,
+                               binRadius,
+                               pending);
+                }
+            }));
+        }
+
+        for (auto &item: allTasks) {
+            item.get();
+        }
+
+        // (the journals are committed by the writer threads: wait for them before the journals go away.)
+        for (auto &run: runs) {
+            run.writer->Flush();
+        }
+
+    } while (workQueue && workQueue->Wait());
+
+
+    if (!sharded) {
+        for (auto &run: runs) {
+            run.topK->Save(run.topKFile);
+        }
+    }
+    else {
+        // Merge, by the first worker to get here, per configuration: the results into one key-sorted segment,
+        // the worker journals into the shared one, then the summary and the database from the merged results.
+        workQueue->RunOnce("merge", [&](){
+
+            for (auto &run: runs) {
+
+                StageTimer timer("merge", run.table);
+                CompactResultsTable(resultsStore, outputDB + "." + run.table);
+
+                CheckpointJournal merged(run.journalFile);
+                for (const auto &item: Glob(run.journalFile + ".*")) {
+                    merged.Absorb(item);
+                    remove(item.c_str());
+                }
+
+                rebuildTopK(run);
+                run.topK->Save(run.topKFile);
+
+                if (writeDatabase) {
+                    const ResultsStore results(resultsStore, outputDB + "." + run.table);
+                    ResultsWriter loader(outputDB, run.table, outputColumns, &dbMtx);
+                    for (const auto &modelName: modelNames) {
+                        loader.Push(results.Cells(outputColumns, results.Rows("modelName", modelName)), nullptr,
+                                    "delete from " + outputDB + "." + run.table + " where modelName='" + modelName + "'");
+                    }
+                    loader.Flush();
+                }
+            }
+        }, false);
+    }
+    WriteStageTrace(); // (if ASU_TRACE is set.)
+
     return 0;
 }
 
-void modelThese(size_t num, size_t mySlot,
+ModelWaveforms readModel(const string &modelName, const map<string, TableSnapshot> &modelTables, const double &criticalDist){
+
+    const string modelEQ=modelName.substr(modelName.find("_")+1);
+    const string modelType=modelName.substr(0,modelName.find("_"));
+
+    // This model's traces, from the snapshot of its table.
+    StageTimer timer("read", modelName);
+    unique_lock<mutex> lck(mtx, defer_lock);
+    const auto &modelInfo=modelTables.at(modelType);
+    const auto rows=modelInfo.Rows("eq", modelEQ);
+    const auto &modelPairname=modelInfo.GetString("pairname"), &modelFile=modelInfo.GetString("fn");
+
+    ModelWaveforms ans;
+
+    // Skip reading if this model's results are current (for every configuration).
+    string key = "|" + KeyValue(criticalDist);
+    for (size_t i = 0; i < rows.size(); ++i) {
+        const string &fn = modelFile[rows[i]];
+        if (i == 0 || fn != modelFile[rows[i - 1]]) {
+            key += "|" + Fingerprint(fn);
+        }
+        key += "|" + modelPairname[rows[i]];
+    }
+    bool allUpToDate = true;
+    for (const auto &run: runs) {
+        ans.inputKey.push_back(HashKey(run.paramKey + key));
+        ans.upToDate.push_back(incremental && run.journal->IsCurrent(modelName, ans.inputKey.back()));
+        allUpToDate = allUpToDate && ans.upToDate.back();
+    }
+    if (allUpToDate) {
+        return ans;
+    }
+
+    // Read in model waveforms, cut to -30 ~ 30 sec.
+    // Newer runs store one pack per model (*.pack); older runs store one text file per trace.
+    map<string, unique_ptr<WaveformPack>> packs;
+
+    for (size_t i = 0; i < rows.size(); ++i) {
+
+        const string &fn = modelFile[rows[i]];
+
+        if (fn.size() > 5 && fn.substr(fn.size() - 5) == ".pack") {
+
+            auto &pack = packs[fn];
+            if (!pack) {
+                pack.reset(new WaveformPack(fn));
+            }
+            const string stnm = modelPairname[rows[i]].substr(modelEQ.size() + 1);
+            size_t j = pack->Find(stnm);
+            if (j == pack->Size()) {
+                throw runtime_error("Missing trace in pack: " + fn + " " + stnm);
+            }
+            ans.waveform.push_back(pack->Signal(j));
+        }
+        else {
+            ans.waveform.push_back(EvenSampledSignal(fn));
+        }
+
+        if (!ans.waveform.back().CheckAndCutToWindow(-30,30)) {
+            lck.lock();
+            cout << "Data corrupted: " << modelType << " " << modelEQ <<  " " << fn << endl ;
+            lck.unlock();
+        }
+        ans.waveform.back().Mask(0,30);
+        ans.waveform.back().FlipReverseSum(0);
+        ans.pairNameToIndex[modelPairname[rows[i]]]=i;
+    }
+
+    return ans;
+}
+
+void modelThese(size_t num, size_t c,
 
-                const string &modelName, const map<string, double> &criticalDistance,
-                const vector<EvenSampledSignal> &dataWaveform, const map<string,size_t> &dataPairNameToIndex,
+                const string &modelName, const ModelWaveforms &model, const map<string, double> &criticalDistance,
+                const SignalMatrix &dataWaveform, const map<string,size_t> &dataPairNameToIndex,
                 const map<double,string> &gcarcSTNM,
                 const vector<vector<string>> &binPairnames,
                 const vector<vector<double>> &dataBinCenterDists, const vector<vector<double>> &dataBinGcarc,
                 const vector<vector<double>> &dataBinSNR,
-                const vector<double> &binRadius){
+                const vector<double> &binRadius,
+                const shared_ptr<atomic<size_t>> &pending){
 
 
+    // this configuration.
+    const Config &config = configs[c];
+    ConfigRun &run = runs[c];
+
+    // (the model is done once its results for every configuration are stored.)
+    auto configDone = [num, pending](){
+        if (--*pending == 0 && workQueue) {
+            workQueue->Done(num);
+        }
+    };
+
     // total reflection distance for this model.
 
     const string modelEQ=modelName.substr(modelName.find("_")+1);
-    const string modelType=modelName.substr(0,modelName.find("_"));
-    const string modelTable=( modelType == "PREM" ? premTable : ( modelType == "ULVZ" ? ulvzTable : ( modelType == "UHVZ" ? uhvzTable : lamellaTable)));
-
 
     // distance selection.
     double critDist=criticalDistance.at(modelName);
-    critDist = min(critDist, distanceCutOff);
+    critDist = min(critDist, config.distanceCutOff);
 
     unique_lock<mutex> lck(mtx);
-    cout << "Modeling against " << modelName << ", Num: " << num << " ... " << endl;
-    auto modelInfo=MariaDB::Select("pairname, concat(dirPrefix,'/',ScSStripped) as fn from "+modelTable+" where eq="+modelEQ);
-
-    // Read in model waveforms, cut to -30 ~ 30 sec.
-    vector<EvenSampledSignal> modelWaveform;
-    map<string,size_t> modelPairNameToIndex;
-
-    for (size_t i = 0; i < modelInfo.NRow(); ++i) {
-        modelWaveform.push_back(EvenSampledSignal(modelInfo.GetString("fn")[i]));
-        if (!modelWaveform.back().CheckAndCutToWindow(-30,30)) {
-cout << "Data corrupted: " << modelType << " " << modelEQ <<  " " << modelInfo.GetString("fn")[i] << endl ;
-        }
-        modelWaveform.back().Mask(0,30);
-        modelWaveform.back().FlipReverseSum(0);
-        modelPairNameToIndex[modelInfo.GetString("pairname")[i]]=i;
+    if (model.upToDate[c]) {
+        cout << "Skipping " << modelName << config.tag << ", Num: " << num << " (results are current)." << endl;
+        configDone();
+        return;
     }
-
+    cout << "Modeling against " << modelName << config.tag << ", Num: " << num << " ... " << endl;
     lck.unlock();
 
-    // Model each bin.
+    // Model waveforms (read in by the reader stage).
+    const vector<EvenSampledSignal> &modelWaveform = model.waveform;
+    const map<string,size_t> &modelPairNameToIndex = model.pairNameToIndex;
 
     vector<double> weightSum(binRadius.size(),0), stackTraceCnt = weightSum, cqResult(binRadius.size(), 0.0/0.0), cqResult2 = cqResult;
     vector<string> dataScSStackFilename(binRadius.size()), modelScSStackFilename(binRadius.size()), dataScSStackStdFilename(binRadius.size()), modelScSStackStdFilename(binRadius.size());
 
-    for (size_t i=0; i<binRadius.size(); ++i) {
+    // 1. Data side: shared by every model with the same cutoff.
+    vector<shared_ptr<const DataBinStack>> dataSide(binRadius.size());
 
-        const string binN=to_string(i+1);
+    pool.ParallelFor(0, binRadius.size(), [&](size_t i){
+        StageTimer timer("data stack", modelName, i+1);
+        dataSide[i] = getDataBinStack(i, critDist, config,
+                                      dataWaveform, dataPairNameToIndex, gcarcSTNM,
+                                      binPairnames, dataBinCenterDists, dataBinGcarc, dataBinSNR, binRadius);
+    });
 
-        // Get the SNR threshold using the quantile.
-        vector<double> tmpArray;
-        for (size_t j=0; j<binPairnames[i].size(); ++j) {
-            if (dataBinGcarc[i][j]>=critDist) continue;
-            tmpArray.push_back(dataBinSNR[i][j]);
-        }
-        sort(tmpArray.begin(),tmpArray.end());
-        double critSNR=(tmpArray.empty()? -1 : tmpArray[(size_t)(tmpArray.size()*snrQuantile)]);
 
-        // select the data waveform.
-        // get the stack weight.
-        vector<EvenSampledSignal> binDataWaveform, binModelWaveform;
-        vector<double> binStackWeight;
+    // 2. Model side: all bin stacks as one (bins x stations) * (stations x samples) product.
+    //    Each data record uses the synthetics at the closest distance, so its weight is
+    //    folded onto that station; stations no bin uses are left out.
+    StageTimer timer("model stack", modelName);
+    vector<size_t> stackedBins;
+    map<string,size_t> stationRow;
+    vector<const EvenSampledSignal *> rowTrace;
 
-        for (size_t j=0; j<binPairnames[i].size(); ++j) {
+    for (size_t i=0; i<binRadius.size(); ++i) {
 
-            binDataWaveform.push_back(dataWaveform[dataPairNameToIndex.at(binPairnames[i][j])]);
+        weightSum[i] = dataSide[i]->weightSum;
+        if (!dataSide[i]->stacked) {
+            continue;
+        }
+        stackTraceCnt[i] = dataSide[i]->member.size();
+        stackedBins.push_back(i);
 
-            if (dataBinGcarc[i][j]>=critDist) {
-                binDataWaveform.pop_back();
-                continue;
+        for (const auto &item: dataSide[i]->stationWeight) {
+            if (stationRow.find(item.first) == stationRow.end()) {
+                stationRow[item.first] = rowTrace.size();
+                rowTrace.push_back(&modelWaveform[modelPairNameToIndex.at(modelEQ+"_"+item.first)]);
             }
+        }
+    }
 
-            // find the correct distance synthetics data.
+    vector<vector<double>> stationWeight(stackedBins.size(), vector<double> (rowTrace.size(), 0));
+    for (size_t b=0; b<stackedBins.size(); ++b) {
+        for (const auto &item: dataSide[stackedBins[b]]->stationWeight) {
+            stationWeight[b][stationRow[item.first]] += item.second;
+        }
+    }
 
-            auto it=gcarcSTNM.lower_bound(dataBinGcarc[i][j]);
-            if (it==gcarcSTNM.end()) {
-                it=prev(it);
+    vector<pair<EvenSampledSignal,EvenSampledSignal>> modelStacks;
+    if (!rowTrace.empty() && SameGrid(rowTrace)) {
+        modelStacks = MatrixStack(stationWeight, rowTrace);
+    }
+    else {
+        // (traces not on one grid: stack bin by bin, over the bin's own stations only.)
+        for (size_t b=0; b<stackedBins.size(); ++b) {
+            vector<EvenSampledSignal> binModelWaveform;
+            vector<double> binWeight;
+            for (size_t r=0; r<rowTrace.size(); ++r) {
+                if (stationWeight[b][r]!=0) {
+                    binModelWaveform.push_back(*rowTrace[r]);
+                    binWeight.push_back(stationWeight[b][r]);
+                }
             }
-            string stnm=it->second;
-            binModelWaveform.push_back(modelWaveform[modelPairNameToIndex[modelEQ+"_"+stnm]]);
-
-            // Get weights.
-
-            // 1. gaussian cap.
-            binStackWeight.push_back(GaussianFunction(dataBinCenterDists[i][j]/binRadius[i], weightSigma, 0)*sqrt(2*M_PI)*weightSigma);
-
-            // 2. SNR? or just a cut-off at the threshold.
-            //if (dataBinSNR[i]<=critSNR) binStackWeight.back()=0;
-            binStackWeight.back()*=RampFunction(dataBinSNR[i][j], 0, critSNR);
+            modelStacks.push_back(StackSignals(binModelWaveform,binWeight));
         }
+    }
 
 
-        weightSum[i]=accumulate(binStackWeight.begin(),binStackWeight.end(),0.0);
-
-        if (weightSum[i] <= 1 || binDataWaveform.size() < cntThreshold) {
-            continue;
-        }
-        stackTraceCnt[i]=binDataWaveform.size();
-
+    // 3. Output and compare (bins run as subtasks on the pool).
+    timer.Stop();
+    MakeDirs(dirPrefix+"/modelScSStack"+config.tag+"/"+modelName);
 
-        // Stack data, normalize stack and its std.
-        auto binDataStack=StackSignals(binDataWaveform,binStackWeight);
-        binDataStack.first.CheckAndCutToWindow(-29,29);
-        binDataStack.second.CheckAndCutToWindow(-29,29);
+    pool.ParallelFor(0, stackedBins.size(), [&](size_t b){
 
+        const size_t i = stackedBins[b];
+        const string binN=to_string(i+1);
+        StageTimer timer("output", modelName, i+1);
 
-        // Stack model, normalize stack and its std.
-        auto binModelStack=StackSignals(binModelWaveform,binStackWeight);
+        auto &binModelStack=modelStacks[b];
         binModelStack.first.CheckAndCutToWindow(-29,29);
         binModelStack.second.CheckAndCutToWindow(-29,29);
 
-
         // Output to files.
-        ShellExec("mkdir -p "+dirPrefix+"/dataScSStack/"+modelName+" "
-                             +dirPrefix+"/modelScSStack/"+modelName);
+        dataScSStackFilename[i]=dataSide[i]->stackFilename;
+        dataScSStackStdFilename[i]=dataSide[i]->stackStdFilename;
+        modelScSStackFilename[i]="modelScSStack"+config.tag+"/"+modelName+"/"+binN+".signal";
+        modelScSStackStdFilename[i]="modelScSStack"+config.tag+"/"+modelName+"/"+binN+".std";
 
-
-        dataScSStackFilename[i]="dataScSStack/"+modelName+"/"+binN+".signal";
-        dataScSStackStdFilename[i]="dataScSStack/"+modelName+"/"+binN+".std";
-        modelScSStackFilename[i]="modelScSStack/"+modelName+"/"+binN+".signal";
-        modelScSStackStdFilename[i]="modelScSStack/"+modelName+"/"+binN+".std";
-
-        binDataStack.first.OutputToFile(dirPrefix+"/"+dataScSStackFilename[i]);
-        binDataStack.second.OutputToFile(dirPrefix+"/"+dataScSStackStdFilename[i]);
         binModelStack.first.OutputToFile(dirPrefix+"/"+modelScSStackFilename[i]);
         binModelStack.second.OutputToFile(dirPrefix+"/"+modelScSStackStdFilename[i]);
 
         // Compare.
-        auto compareResult = CalculateCQ(binDataStack.first, binModelStack.first, compareLen);
+        timer.Next("CQ");
+        auto compareResult = CalculateCQ(dataSide[i]->stack.first, binModelStack.first, config.compareLen);
         cqResult[i] = compareResult[0] * compareResult[1];
         cqResult2[i] = compareResult[0] * compareResult[2];
-    }
-
-    // update database.
+    });
 
-    lck.lock();
+    // update database (queued; the writer thread batches the loads).
 
-    vector<string> columnNames{"pairname", "bin", "modelName", "CQ", "CQ2", "dataScSStack", "modelScSStack","stackTraceCnt", "weightSum", "dataScSStackStd", "modelScSStackStd", "dirPrefix"};
-    vector<vector<string>> sqlData(columnNames.size());
+    vector<vector<ResultsCell>> sqlData(12);
 
     for (size_t i=0; i<binRadius.size(); ++i) {
         sqlData[0].push_back(to_string(i+1)+"_"+modelName);
-        sqlData[1].push_back(to_string(i+1));
+        sqlData[1].push_back(i+1);
         sqlData[2].push_back(modelName);
-        sqlData[3].push_back(isnan(cqResult[i])?"NULL":to_string(cqResult[i]));
-        sqlData[4].push_back(isnan(cqResult2[i])?"NULL":to_string(cqResult2[i]));
-        sqlData[7].push_back(to_string(stackTraceCnt[i]));
-        sqlData[8].push_back(to_string(weightSum[i]));
+        sqlData[3].push_back(cqResult[i]);
+        sqlData[4].push_back(cqResult2[i]);
+        sqlData[5].push_back(dataScSStackFilename[i]);
+        sqlData[6].push_back(modelScSStackFilename[i]);
+        sqlData[7].push_back(stackTraceCnt[i]);
+        sqlData[8].push_back(weightSum[i]);
+        sqlData[9].push_back(dataScSStackStdFilename[i]);
+        sqlData[10].push_back(modelScSStackStdFilename[i]);
         sqlData[11].push_back(dirPrefix);
     }
-    swap(sqlData[5], dataScSStackFilename);
-    swap(sqlData[6], modelScSStackFilename);
-    swap(sqlData[9], dataScSStackStdFilename);
-    swap(sqlData[10], modelScSStackStdFilename);
 
-    MariaDB::LoadData(outputDB, outputTable, columnNames, sqlData);
-
-    emptySlot.push(mySlot);
-    cv.notify_one();
+    // replace whatever an earlier (stale or interrupted) run left for this model,
+    // then, once its rows are in, update the summary and mark the model done.
+    const string inputKey = model.inputKey[c];
+    vector<int> binN;
+    for (size_t i=0; i<binRadius.size(); ++i) {
+        binN.push_back(i+1);
+    }
+    run.writer->Push(move(sqlData), [&run, configDone, modelName, inputKey, binN, cqResult](){
+        if (!workQueue) {
+            run.topK->Update(modelName, binN, cqResult);
+            run.topK->Save(run.topKFile);
+        }
+        run.journal->Commit(modelName, inputKey);
+        configDone();
+    },
+                     "delete from " + outputDB + "." + run.table + " where modelName='" + modelName + "'");
 
     return;
 }
+
+shared_ptr<const DataBinStack> getDataBinStack(size_t i, double critDist, const Config &config,
+                                               const SignalMatrix &dataWaveform, const map<string,size_t> &dataPairNameToIndex,
+                                               const map<double,string> &gcarcSTNM,
+                                               const vector<vector<string>> &binPairnames,
+                                               const vector<vector<double>> &dataBinCenterDists, const vector<vector<double>> &dataBinGcarc,
+                                               const vector<vector<double>> &dataBinSNR,
+                                               const vector<double> &binRadius){
+
+    // Cache: (bin, cutoff, edge weight, SNR quantile) -> data stack. The first model to ask computes it; others wait for it.
+    static mutex cacheMtx;
+    static map<tuple<size_t,double,double,double>, shared_future<shared_ptr<const DataBinStack>>> cache;
+
+    const auto key = make_tuple(i, critDist, config.binEdgeWeight, config.snrQuantile);
+    unique_lock<mutex> lck(cacheMtx);
+    auto it = cache.find(key);
+    if (it != cache.end()) {
+        auto ans = it->second;
+        lck.unlock();
+        return ans.get();
+    }
+    promise<shared_ptr<const DataBinStack>> result;
+    cache[key] = result.get_future().share();
+    lck.unlock();
+
+    // (waiting models get the exception too, if this fails.)
+    try {
+        auto ans = makeDataBinStack(i, critDist, config, dataWaveform, dataPairNameToIndex, gcarcSTNM, binPairnames, dataBinCenterDists, dataBinGcarc, dataBinSNR, binRadius);
+        result.set_value(ans);
+        return ans;
+    }
+    catch (...) {
+        result.set_exception(current_exception());
+        throw;
+    }
+}
+
+shared_ptr<const DataBinStack> makeDataBinStack(size_t i, double critDist, const Config &config,
+                                                const SignalMatrix &dataWaveform, const map<string,size_t> &dataPairNameToIndex,
+                                                const map<double,string> &gcarcSTNM,
+                                                const vector<vector<string>> &binPairnames,
+                                                const vector<vector<double>> &dataBinCenterDists, const vector<vector<double>> &dataBinGcarc,
+                                                const vector<vector<double>> &dataBinSNR,
+                                                const vector<double> &binRadius){
+
+    const double weightSigma = config.WeightSigma();
+    auto ans = make_shared<DataBinStack>();
+    const string binN=to_string(i+1);
+
+    // Get the SNR threshold using the quantile.
+    vector<double> tmpArray;
+    for (size_t j=0; j<binPairnames[i].size(); ++j) {
+        if (dataBinGcarc[i][j]>=critDist) continue;
+        tmpArray.push_back(dataBinSNR[i][j]);
+    }
+    sort(tmpArray.begin(),tmpArray.end());
+    ans->critSNR=(tmpArray.empty()? -1 : tmpArray[(size_t)(tmpArray.size()*config.snrQuantile)]);
+
+    // select the data waveform (rows of the data matrix, no copies).
+    // get the stack weight.
+    vector<size_t> binDataRows;
+
+    for (size_t j=0; j<binPairnames[i].size(); ++j) {
+
+        if (dataBinGcarc[i][j]>=critDist) {
+            continue;
+        }
+        binDataRows.push_back(dataPairNameToIndex.at(binPairnames[i][j]));
+        ans->member.push_back(j);
+
+        // Get weights.
+
+        // 1. gaussian cap.
+        ans->weight.push_back(GaussianFunction(dataBinCenterDists[i][j]/binRadius[i], weightSigma, 0)*sqrt(2*M_PI)*weightSigma);
+
+        // 2. SNR? or just a cut-off at the threshold.
+        //if (dataBinSNR[i]<=critSNR) binStackWeight.back()=0;
+        ans->weight.back()*=RampFunction(dataBinSNR[i][j], 0, ans->critSNR);
+    }
+
+    ans->weightSum=accumulate(ans->weight.begin(),ans->weight.end(),0.0);
+
+    // find the correct distance synthetics for each member, fold its weight onto that station.
+    map<string,double> stationWeight;
+    for (size_t m=0; m<ans->member.size(); ++m) {
+        auto it=gcarcSTNM.lower_bound(dataBinGcarc[i][ans->member[m]]);
+        if (it==gcarcSTNM.end()) {
+            it=prev(it);
+        }
+        stationWeight[it->second]+=ans->weight[m];
+    }
+    ans->stationWeight.assign(stationWeight.begin(), stationWeight.end());
+    ans->stacked=!(ans->weightSum <= 1 || binDataRows.size() < cntThreshold);
+
+    if (ans->stacked) {
+
+        // Stack data, normalize stack and its std.
+        // (same stacking as the model side; only -29 ~ 30 sec is stacked.)
+        ans->stack=MatrixStack(vector<vector<double>> {ans->weight}, dataWaveform.Select(binDataRows).Window(-29,30))[0];
+        ans->stack.first.CheckAndCutToWindow(-29,29);
+        ans->stack.second.CheckAndCutToWindow(-29,29);
+
+        // Output to files (once per cutoff and weighting).
+        char cutoff[96];
+        snprintf(cutoff, sizeof(cutoff), "cutoff_%.4f_edge_%.4f_snrq_%.4f", critDist, config.binEdgeWeight, config.snrQuantile);
+
+        MakeDirs(dirPrefix+"/dataScSStack/"+cutoff);
+        ans->stackFilename="dataScSStack/"+string(cutoff)+"/"+binN+".signal";
+        ans->stackStdFilename="dataScSStack/"+string(cutoff)+"/"+binN+".std";
+        ans->stack.first.OutputToFile(dirPrefix+"/"+ans->stackFilename);
+        ans->stack.second.OutputToFile(dirPrefix+"/"+ans->stackStdFilename);
+    }
+
+    return ans;
+}
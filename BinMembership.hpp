@@ -0,0 +1,198 @@
+#ifndef ASU_BINMEMBERSHIP
+#define ASU_BINMEMBERSHIP
+
+#include<cstdint>
+#include<cstdio>
+#include<cstring>
+#include<stdexcept>
+#include<string>
+#include<vector>
+
+#include<sys/stat.h>
+#include<unistd.h>
+
+#include<MariaDB.hpp>
+
+/*************************************************
+ * This C++ file stores which records fall in which
+ * bin, sparsely: (bin, pairname, centerDist) for
+ * members only, in CSR order (members of bin i are
+ * [offset[i], offset[i+1])).
+ *
+ * Layout (native byte order):
+ *   header : "BINMEMB1", bin count, member count.
+ *   bins   : bin number (int32), radius (double), per bin.
+ *   offset : uint64, bin count + 1.
+ *   members: centerDist (double), pairname (char[32]).
+ *
+ * WriteBinMembership ---- write (temporary file, then rename).
+ * ReadBinMembership  ---- read the whole file back.
+ * LoadBinMembership  ---- read the file; if it's missing, make
+ *                         it from the Bins and BinMembers tables
+ *                         (as 1_Binning wrote them) first;
+ *                         members then are in pairname order.
+ *
+ * Key words: bin, CSR, sparse
+*************************************************/
+
+struct BinMembership {
+
+    std::vector<int> bin;
+    std::vector<double> radius;
+    std::vector<std::size_t> offset{0};
+    std::vector<std::string> pairname;
+    std::vector<double> centerDist;
+
+    std::size_t NBin() const {return bin.size();}
+    std::size_t NMember() const {return pairname.size();}
+
+    // Start a new bin; members added next belong to it.
+    void AddBin(const int &binN, const double &binRadius) {
+        bin.push_back(binN);
+        radius.push_back(binRadius);
+        offset.push_back(offset.back());
+    }
+
+    void AddMember(const std::string &pn, const double &dist) {
+        pairname.push_back(pn);
+        centerDist.push_back(dist);
+        ++offset.back();
+    }
+
+    std::vector<std::string> Pairnames(const std::size_t &i) const {
+        return std::vector<std::string> (pairname.begin() + offset[i], pairname.begin() + offset[i + 1]);
+    }
+
+    std::vector<double> CenterDists(const std::size_t &i) const {
+        return std::vector<double> (centerDist.begin() + offset[i], centerDist.begin() + offset[i + 1]);
+    }
+};
+
+const std::size_t BinMembershipNameLen = 32;
+
+void WriteBinMembership(const std::string &fileName, const BinMembership &m){
+
+    const std::string tmpName = fileName + ".tmp" + std::to_string(getpid());
+    FILE *fp = fopen(tmpName.c_str(), "wb");
+    if (fp == nullptr) {
+        throw std::runtime_error("WriteBinMembership: can't open " + tmpName);
+    }
+
+    uint64_t nBin = m.NBin(), nMember = m.NMember();
+    bool ok = (fwrite("BINMEMB1", 1, 8, fp) == 8);
+    ok = ok && fwrite(&nBin, sizeof(nBin), 1, fp) == 1 && fwrite(&nMember, sizeof(nMember), 1, fp) == 1;
+
+    for (std::size_t i = 0; ok && i < nBin; ++i) {
+        int32_t b = m.bin[i];
+        ok = fwrite(&b, sizeof(b), 1, fp) == 1 && fwrite(&m.radius[i], sizeof(double), 1, fp) == 1;
+    }
+    for (std::size_t i = 0; ok && i <= nBin; ++i) {
+        uint64_t o = m.offset[i];
+        ok = fwrite(&o, sizeof(o), 1, fp) == 1;
+    }
+    for (std::size_t i = 0; ok && i < nMember; ++i) {
+        if (m.pairname[i].size() >= BinMembershipNameLen) {
+            fclose(fp);
+            remove(tmpName.c_str());
+            throw std::runtime_error("WriteBinMembership: pairname too long: " + m.pairname[i]);
+        }
+        char name[BinMembershipNameLen] = {0};
+        memcpy(name, m.pairname[i].c_str(), m.pairname[i].size());
+        ok = fwrite(&m.centerDist[i], sizeof(double), 1, fp) == 1 && fwrite(name, 1, BinMembershipNameLen, fp) == BinMembershipNameLen;
+    }
+
+    ok = (fclose(fp) == 0) && ok;
+    if (!ok || rename(tmpName.c_str(), fileName.c_str()) != 0) {
+        remove(tmpName.c_str());
+        throw std::runtime_error("WriteBinMembership: can't write " + fileName);
+    }
+}
+
+BinMembership ReadBinMembership(const std::string &fileName){
+
+    FILE *fp = fopen(fileName.c_str(), "rb");
+    if (fp == nullptr) {
+        throw std::runtime_error("ReadBinMembership: can't open " + fileName);
+    }
+
+    // one read for the whole file.
+    fseek(fp, 0, SEEK_END);
+    long size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    std::vector<char> buf(size < 0 ? 0 : size);
+    bool ok = (size >= 24 && fread(buf.data(), 1, size, fp) == (std::size_t)size);
+    fclose(fp);
+
+    uint64_t nBin = 0, nMember = 0;
+    if (ok) {
+        memcpy(&nBin, buf.data() + 8, 8);
+        memcpy(&nMember, buf.data() + 16, 8);
+    }
+    const std::size_t need = 24 + nBin * 12 + (nBin + 1) * 8 + nMember * (8 + BinMembershipNameLen);
+    if (!ok || memcmp(buf.data(), "BINMEMB1", 8) != 0 || need != (std::size_t)size) {
+        throw std::runtime_error("ReadBinMembership: bad file " + fileName);
+    }
+
+    BinMembership ans;
+    const char *p = buf.data() + 24;
+    ans.bin.resize(nBin);
+    ans.radius.resize(nBin);
+    for (std::size_t i = 0; i < nBin; ++i, p += 12) {
+        int32_t b;
+        memcpy(&b, p, 4);
+        memcpy(&ans.radius[i], p + 4, 8);
+        ans.bin[i] = b;
+    }
+    ans.offset.resize(nBin + 1);
+    for (std::size_t i = 0; i <= nBin; ++i, p += 8) {
+        uint64_t o;
+        memcpy(&o, p, 8);
+        ans.offset[i] = o;
+    }
+    ans.pairname.resize(nMember);
+    ans.centerDist.resize(nMember);
+    for (std::size_t i = 0; i < nMember; ++i, p += 8 + BinMembershipNameLen) {
+        memcpy(&ans.centerDist[i], p, 8);
+        ans.pairname[i] = std::string(p + 8, strnlen(p + 8, BinMembershipNameLen));
+    }
+
+    if (ans.offset[0] != 0 || ans.offset.back() != nMember) {
+        throw std::runtime_error("ReadBinMembership: bad offsets in " + fileName);
+    }
+    return ans;
+}
+
+BinMembership LoadBinMembership(const std::string &fileName, const std::string &binTable, const std::string &memberTable){
+
+    struct stat st;
+    if (stat(fileName.c_str(), &st) == 0) {
+        return ReadBinMembership(fileName);
+    }
+
+    auto binInfo = MariaDB::Select("bin, radius from " + binTable + " order by bin");
+    auto memberInfo = MariaDB::Select("bin, pairname, centerDist from " + memberTable + " order by bin, pairname");
+
+    const auto bin = binInfo.GetInt("bin");
+    const auto radius = binInfo.GetDouble("radius");
+    const auto memberBin = memberInfo.GetInt("bin");
+    const auto pairname = memberInfo.GetString("pairname");
+    const auto centerDist = memberInfo.GetDouble("centerDist");
+
+    // both sorted by bin: members are consumed bin by bin.
+    BinMembership ans;
+    std::size_t j = 0;
+    for (std::size_t i = 0; i < binInfo.NRow(); ++i) {
+        ans.AddBin(bin[i], radius[i]);
+        for (; j < memberInfo.NRow() && memberBin[j] == bin[i]; ++j) {
+            ans.AddMember(pairname[j], centerDist[j]);
+        }
+    }
+    if (j != memberInfo.NRow()) {
+        throw std::runtime_error("LoadBinMembership: bin " + std::to_string(memberBin[j]) + " of " + memberTable + " is not in " + binTable);
+    }
+
+    WriteBinMembership(fileName, ans);
+    return ans;
+}
+
+#endif
@@ -1,7 +1,9 @@
 #ifndef ASU_CQ
 #define ASU_CQ
 
+#include<algorithm>
 #include<cmath>
+#include<cstring>
 #include<vector>
 
 #include<EvenSampledSignal.hpp>
@@ -14,11 +16,42 @@
  * Because it's very specific, it's not included
  * in the CPP library.
  *
+ * The cross-correlation metrics come from three sums
+ * over the compare window [0, compareLength], with
+ * the samples GetAmp(0, compareLength) returns (the
+ * same ones the norm-2 metrics use):
+ *
+ *   Sdd = sum d*d (whole data window), Smm = sum m*m (whole model window),
+ *   Sdm = sum d*m (where both have samples)
+ *
+ *   cc1  = Sdm / sqrt(Sdd*Smm)           (zero-lag cross-correlation)
+ *   cc2  = cc1 * min(ed,es) / max(ed,es), ed = sqrt(Sdd), es = sqrt(Smm)
+ *   cc   = (1 + cc2) / 2
+ *
+ * Sdm and Smm are taken in one sweep (four samples
+ * per step). Sdd doesn't depend on the model, so a
+ * model ending inside the window doesn't change it.
+ *
+ * The norm-2 metrics are still the library's
+ * PNormErr (x = model, y = data):
+ *
+ *   nn2  = PNormErr(model, data, 2), nn2x = PNormErr(data, model, 2)
+ *   nd   = 1 / (1 + nn2), ndx = 1 / (1 + nn2x)
+ *
+ * The batched version scores one data trace against
+ * many model traces, cutting the data window and
+ * summing Sdd once.
+ *
+ * tests/CalculateCQTest compares both versions with
+ * the original (library-call) implementation.
+ *
  * input(s):
- * const vector<T> &p  ----  Input array.
+ * const EvenSampledSignal &dataTrace   ----  Data.
+ * const EvenSampledSignal &modelTrace  ----  Model (or vector of models).
+ * const double &compareLength          ----  Compare window length (sec).
  *
  * output(s):
- * double cq  ----  comparison result.
+ * vector<double> cq  ----  {cc, nd, ndx, cc1, cc2, nn2, nn2x}.
  *
  * Shule Yu
  * Feb 12 2020
@@ -26,17 +59,61 @@
  * Key words: comparison quality
 *************************************************/
 
-std::vector<double> CalculateCQ(const EvenSampledSignal &dataTrace, const EvenSampledSignal &modelTrace, const double &compareLength){
+typedef double CQLanes __attribute__((vector_size(4 * sizeof(double))));
+
+// sum x*x.
+double CQEnergy(const std::vector<double> &x){
+
+    CQLanes v = {0, 0, 0, 0};
 
-    // Quality 1. cross-correlation.
+    std::size_t k = 0;
+    for (; k + 4 <= x.size(); k += 4) {
+        CQLanes a;
+        memcpy(&a, x.data() + k, sizeof(a));
+        v += a * a;
+    }
 
-    double cc1 = dataTrace.CrossCorrelation(0, compareLength, modelTrace, 0, compareLength, 1, std::make_pair(0,0)).second;
+    double ans = v[0] + v[1] + v[2] + v[3];
+    for (; k < x.size(); ++k) {
+        ans += x[k] * x[k];
+    }
+    return ans;
+}
+
+// Sdm over the samples both have, Smm over the whole model window, in one sweep.
+void CQSums(const std::vector<double> &d, const std::vector<double> &m, double &dm, double &mm){
+
+    CQLanes vdm = {0, 0, 0, 0}, vmm = vdm;
+
+    const std::size_t n = std::min(d.size(), m.size());
+    std::size_t k = 0;
+    for (; k + 4 <= n; k += 4) {
+        CQLanes a, b;
+        memcpy(&a, d.data() + k, sizeof(a));
+        memcpy(&b, m.data() + k, sizeof(b));
+        vdm += a * b;
+        vmm += b * b;
+    }
+
+    dm = vdm[0] + vdm[1] + vdm[2] + vdm[3];
+    mm = vmm[0] + vmm[1] + vmm[2] + vmm[3];
+
+    for (; k < n; ++k) {
+        dm += d[k] * m[k];
+        mm += m[k] * m[k];
+    }
+    for (; k < m.size(); ++k) {
+        mm += m[k] * m[k];
+    }
+}
 
-    // take amplitude into consideration.
+std::vector<double> CQFromSums(const double &dd, const double &mm, const double &dm,
+                               const std::vector<double> &dataAmp, const std::vector<double> &modelAmp){
 
-    double ed = sqrt(dataTrace.SumArea(0, compareLength, 2));
-    double es = sqrt(modelTrace.SumArea(0, compareLength, 2));
+    // Quality 1. cross-correlation, taking amplitude into consideration.
+    double cc1 = dm / sqrt(dd * mm);
 
+    double ed = sqrt(dd), es = sqrt(mm);
     double cc2 = cc1 * std::min(ed, es) / std::max(ed, es);
 
     // convert [ -1(worst) ~ 1(best) ] to [ 0(worst) ~ 1(best) ]
@@ -47,10 +124,10 @@ std::vector<double> CalculateCQ(const EvenSampledSignal &dataTrace, const EvenSa
 
     // |x-y|^2 / |y|^2
     // currently using this:
-    double nn2 = PNormErr(modelTrace.GetAmp(0, compareLength), dataTrace.GetAmp(0, compareLength), 2);
+    double nn2 = PNormErr(modelAmp, dataAmp, 2);
 
     // should be this?
-    double nn2x = PNormErr(dataTrace.GetAmp(0, compareLength), modelTrace.GetAmp(0, compareLength), 2);
+    double nn2x = PNormErr(dataAmp, modelAmp, 2);
 
 
     // [ 0(best) ~ inf(worst) ] to [ 1(best) ~ 0(worst) ].
@@ -60,4 +137,27 @@ std::vector<double> CalculateCQ(const EvenSampledSignal &dataTrace, const EvenSa
     return std::vector<double> {cc, nd, ndx, cc1, cc2, nn2, nn2x};
 }
 
+std::vector<double> CalculateCQ(const EvenSampledSignal &dataTrace, const EvenSampledSignal &modelTrace, const double &compareLength){
+
+    const auto dataAmp = dataTrace.GetAmp(0, compareLength), modelAmp = modelTrace.GetAmp(0, compareLength);
+    double mm, dm;
+    CQSums(dataAmp, modelAmp, dm, mm);
+    return CQFromSums(CQEnergy(dataAmp), mm, dm, dataAmp, modelAmp);
+}
+
+std::vector<std::vector<double>> CalculateCQ(const EvenSampledSignal &dataTrace, const std::vector<EvenSampledSignal> &modelTraces, const double &compareLength){
+
+    const auto dataAmp = dataTrace.GetAmp(0, compareLength);
+    const double dd = CQEnergy(dataAmp);
+
+    std::vector<std::vector<double>> ans;
+    for (const auto &item: modelTraces) {
+        const auto modelAmp = item.GetAmp(0, compareLength);
+        double mm, dm;
+        CQSums(dataAmp, modelAmp, dm, mm);
+        ans.push_back(CQFromSums(dd, mm, dm, dataAmp, modelAmp));
+    }
+    return ans;
+}
+
 #endif
@@ -0,0 +1,140 @@
+#ifndef ASU_CHECKPOINTJOURNAL
+#define ASU_CHECKPOINTJOURNAL
+
+#include<cstdio>
+#include<fstream>
+#include<map>
+#include<mutex>
+#include<stdexcept>
+#include<string>
+
+#include<fcntl.h>
+#include<unistd.h>
+
+/*************************************************
+ * This C++ class is a durable record of finished
+ * work units, for resuming long sweeps.
+ *
+ * Each line of the journal is "unit<TAB>key", where
+ * key identifies the inputs and parameters that
+ * produced the unit's results. A unit is current
+ * when its last journal line carries the same key.
+ * Commit() appends a line and fsyncs it, so a unit
+ * is only marked done once its results are stored;
+ * a torn last line (crash while writing) is ignored.
+ *
+ * Read() also takes the units of another journal;
+ * Absorb() appends them to this one (merging the
+ * journals of sharded workers).
+ *
+ * input(s):
+ * const string &fileName  ----  Journal file (created if needed).
+ * const bool &reset       ----  Start from an empty journal.
+ *
+ * Key words: checkpoint, resume, journal
+*************************************************/
+
+class CheckpointJournal {
+
+public:
+
+    CheckpointJournal(const std::string &fileName, const bool &reset = false) {
+
+        if (!reset) {
+            ReadLines(fileName, done);
+        }
+
+        fd = open(fileName.c_str(), O_WRONLY | O_CREAT | O_APPEND | (reset ? O_TRUNC : 0), 0644);
+        if (fd < 0) {
+            throw std::runtime_error("CheckpointJournal: can't open " + fileName);
+        }
+
+        // finish a torn last line, so the next record starts on its own line.
+        if (!reset) {
+            FILE *fp = fopen(fileName.c_str(), "rb");
+            if (fp != nullptr) {
+                if (fseek(fp, -1, SEEK_END) == 0 && fgetc(fp) != '\n') {
+                    Append("\n");
+                }
+                fclose(fp);
+            }
+        }
+    }
+
+    CheckpointJournal(const CheckpointJournal &) = delete;
+    CheckpointJournal &operator=(const CheckpointJournal &) = delete;
+
+    ~CheckpointJournal() {
+        close(fd);
+    }
+
+    std::size_t Size() const {
+        std::lock_guard<std::mutex> lck(mtx);
+        return done.size();
+    }
+
+    // Also take the units recorded in another journal (e.g. the shared one, for a worker's own journal).
+    void Read(const std::string &fileName) {
+        std::lock_guard<std::mutex> lck(mtx);
+        ReadLines(fileName, done);
+    }
+
+    // Append the units recorded in another journal (e.g. a worker's own) to this one, with one fsync.
+    void Absorb(const std::string &fileName) {
+        std::lock_guard<std::mutex> lck(mtx);
+        std::map<std::string, std::string> other;
+        ReadLines(fileName, other);
+        std::string s;
+        for (const auto &item: other) {
+            s += item.first + "\t" + item.second + "\n";
+        }
+        Append(s);
+        if (fsync(fd) != 0) {
+            throw std::runtime_error("CheckpointJournal: fsync failed.");
+        }
+        for (const auto &item: other) {
+            done[item.first] = item.second;
+        }
+    }
+
+    bool IsCurrent(const std::string &unit, const std::string &key) const {
+        std::lock_guard<std::mutex> lck(mtx);
+        auto it = done.find(unit);
+        return (it != done.end() && it->second == key);
+    }
+
+    void Commit(const std::string &unit, const std::string &key) {
+        std::lock_guard<std::mutex> lck(mtx);
+        Append(unit + "\t" + key + "\n");
+        if (fsync(fd) != 0) {
+            throw std::runtime_error("CheckpointJournal: fsync failed.");
+        }
+        done[unit] = key;
+    }
+
+private:
+
+    int fd = -1;
+    mutable std::mutex mtx;
+    std::map<std::string, std::string> done;
+
+    static void ReadLines(const std::string &fileName, std::map<std::string, std::string> &units) {
+        std::ifstream fpin(fileName);
+        std::string line;
+        while (getline(fpin, line)) {
+            auto pos = line.find('\t');
+            if (pos == std::string::npos || pos == 0 || pos + 1 == line.size()) {
+                continue;
+            }
+            units[line.substr(0, pos)] = line.substr(pos + 1);
+        }
+    }
+
+    void Append(const std::string &s) {
+        if (write(fd, s.c_str(), s.size()) != (ssize_t)s.size()) {
+            throw std::runtime_error("CheckpointJournal: write failed.");
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,318 @@
+#ifndef ASU_DECONENGINE
+#define ASU_DECONENGINE
+
+#include<algorithm>
+#include<cmath>
+#include<complex>
+#include<map>
+#include<memory>
+#include<mutex>
+#include<stdexcept>
+#include<utility>
+#include<vector>
+
+#include<fftw3.h>
+
+#include<EvenSampledSignal.hpp>
+#include<SACSignals.hpp>
+
+#include "FFTWPlanner.hpp"
+
+/*************************************************
+ * This C++ class deconvolves many traces by one
+ * source in the frequency domain, in place of the
+ * library calls
+ *
+ *   WaterLevelDecon(source, waterLevel) ->
+ *   GaussianBlur(sigma) -> Butterworth(low, 10000)
+ *
+ * The first two are fused into one filter per
+ * setting,
+ *
+ *   conj(S) / max(|S|^2, waterLevel * max|S|^2)
+ *   * exp(-2 pi^2 sigma^2 f^2),
+ *
+ * and the high-pass is the library's Butterworth,
+ * run on each result. Where this can differ from
+ * the library calls, and why that's acceptable:
+ *
+ *   - water level: taken on the power, relative to
+ *     the source's peak power;
+ *   - Gaussian: the transform of a unit-area
+ *     Gaussian (std sigma), so the amplitude scale
+ *     isn't kept;
+ *   - padding: to a 2,3,5,7-smooth length that
+ *     holds the whole linear deconvolution, so there
+ *     is no wrap-around (edges may differ);
+ *   - time axis: see below.
+ *
+ * The drivers only use the results after picking
+ * the peak near zero, flipping, normalizing to it
+ * and cutting a window, which none of the above
+ * moves. tests/DeconEngineTest compares the engine
+ * and the library calls after those steps.
+ *
+ * The source spectrum is made once per source:
+ * calling again with the same source reuses it.
+ * Traces go through in batches of DeconBatchCnt,
+ * each batch one multi-transform forward, then one
+ * back per setting: extra (waterLevel, sigma)
+ * settings cost only their inverse transforms.
+ * FFTW plans are kept per (length, batch) for the
+ * life of the engine, made under the process-wide
+ * FFTW planner lock (FFTWPlanner.hpp) and executed
+ * with the new-array interface, so one engine can be
+ * used by many threads at once.
+ *
+ * Each result keeps its trace's time axis; the
+ * source's time reference maps to zero lag.
+ *
+ * input(s):
+ * const vector<EvenSampledSignal> &traces  ----  Traces (same dt as the source).
+ * const EvenSampledSignal &source          ----  Decon source.
+ * const vector<DeconSetting> &settings     ----  {waterLevel, sigma} pairs, or:
+ * const double &waterLevel                 ----  Water level (fraction of the peak power).
+ * const double &sigma                      ----  Gaussian width (sec).
+ * const double &low                        ----  High-pass corner (Hz), for Butterworth(low, 10000).
+ *
+ * output(s):
+ * vector<vector<EvenSampledSignal>> ans  ----  Deconvolved traces, one set per setting
+ *                                              (or just the set, for one setting).
+ *
+ * Key words: deconvolution, water level, FFT, fftw
+*************************************************/
+
+const std::size_t DeconBatchCnt = 64;
+
+struct DeconSetting {
+    double waterLevel, sigma;
+};
+
+class DeconEngine {
+
+public:
+
+    DeconEngine() = default;
+    DeconEngine(const DeconEngine &) = delete;
+    DeconEngine &operator=(const DeconEngine &) = delete;
+
+    ~DeconEngine() {
+        std::lock_guard<std::mutex> lck(FFTWPlannerMutex());
+        for (auto &item: plans) {
+            fftw_destroy_plan(item.second.first);
+            fftw_destroy_plan(item.second.second);
+        }
+    }
+
+    std::vector<std::vector<EvenSampledSignal>>
+    Decon(const std::vector<EvenSampledSignal> &traces, const EvenSampledSignal &source,
+          const std::vector<DeconSetting> &settings, const double &low) {
+
+        std::vector<std::vector<EvenSampledSignal>> ans(settings.size(), std::vector<EvenSampledSignal>(traces.size()));
+        if (traces.empty() || settings.empty()) {
+            return ans;
+        }
+
+        const double dt = source.GetDelta();
+        std::size_t maxA = 0;
+        for (const auto &tr: traces) {
+            if (fabs(tr.GetDelta() - dt) > 1e-6 * dt) {
+                throw std::runtime_error("DeconEngine: trace and source sampling rates differ.");
+            }
+            maxA = std::max(maxA, tr.Size());
+        }
+        if (maxA == 0 || source.Size() == 0) {
+            throw std::runtime_error("DeconEngine: empty trace or source.");
+        }
+
+        // linear (not circular) deconvolution: room for the whole overlap.
+        const int N = GoodSize(maxA + source.Size() - 1), nc = N / 2 + 1;
+        const auto spectrum = GetSpectrum(source, N);
+        const long shift = lround(source.BeginTime() / dt);
+
+        std::vector<std::vector<std::complex<double>>> filters;
+        for (const auto &item: settings) {
+            filters.push_back(MakeFilter(*spectrum, item));
+        }
+
+        // X: forward spectra of the batch (kept); Y: one setting's product (destroyed by c2r).
+        const std::size_t nBatch = std::min(DeconBatchCnt, traces.size());
+        std::unique_ptr<double, decltype(&fftw_free)> xBuf(fftw_alloc_real(N * nBatch), &fftw_free);
+        std::unique_ptr<fftw_complex, decltype(&fftw_free)> XBuf(fftw_alloc_complex(nc * nBatch), &fftw_free),
+                                                            YBuf(fftw_alloc_complex(nc * nBatch), &fftw_free);
+        double *x = xBuf.get();
+        fftw_complex *X = XBuf.get(), *Y = YBuf.get();
+
+        for (std::size_t first = 0; first < traces.size(); first += nBatch) {
+
+            const std::size_t n = std::min(nBatch, traces.size() - first);
+            const auto &plan = GetPlan(N, n);
+
+            std::fill(x, x + N * n, 0.0);
+            for (std::size_t l = 0; l < n; ++l) {
+                const auto &amp = traces[first + l].GetAmp();
+                std::copy(amp.begin(), amp.end(), x + N * l);
+            }
+            fftw_execute_dft_r2c(plan.first, x, X);
+
+            for (std::size_t c = 0; c < settings.size(); ++c) {
+
+                const auto &H = filters[c];
+                for (std::size_t l = 0; l < n; ++l) {
+                    for (int k = 0; k < nc; ++k) {
+                        const std::complex<double> y = std::complex<double>(X[nc * l + k][0], X[nc * l + k][1]) * H[k];
+                        Y[nc * l + k][0] = y.real();
+                        Y[nc * l + k][1] = y.imag();
+                    }
+                }
+                fftw_execute_dft_c2r(plan.second, Y, x);
+
+                // output sample j is at lag j + shift (index N + m if negative).
+                for (std::size_t l = 0; l < n; ++l) {
+                    const auto &tr = traces[first + l];
+                    std::vector<double> amp(tr.Size());
+                    for (long j = 0; j < (long)amp.size(); ++j) {
+                        const long m = ((j + shift) % N + N) % N;
+                        amp[j] = x[N * l + m];
+                    }
+                    ans[c][first + l] = EvenSampledSignal(amp, dt, tr.BeginTime());
+                    ans[c][first + l].Butterworth(low, 10000);
+                }
+            }
+        }
+
+        return ans;
+    }
+
+    // One setting.
+    std::vector<EvenSampledSignal> Decon(const std::vector<EvenSampledSignal> &traces, const EvenSampledSignal &source,
+                                         const double &waterLevel, const double &sigma, const double &low) {
+        return Decon(traces, source, std::vector<DeconSetting> {{waterLevel, sigma}}, low)[0];
+    }
+
+    std::vector<SACSignals> Decon(const SACSignals &Data, const EvenSampledSignal &source,
+                                  const std::vector<DeconSetting> &settings, const double &low) {
+        std::vector<SACSignals> ans;
+        for (const auto &item: Decon(Data.GetData(), source, settings, low)) {
+            ans.push_back(SACSignals(item, Data.GetMData()));
+        }
+        return ans;
+    }
+
+    void Decon(SACSignals &Data, const EvenSampledSignal &source,
+               const double &waterLevel, const double &sigma, const double &low) {
+        Data = SACSignals(Decon(Data.GetData(), source, waterLevel, sigma, low), Data.GetMData());
+    }
+
+private:
+
+    struct Spectrum {
+        std::vector<double> source;
+        double begin, delta, maxPower;
+        int N;
+        std::vector<std::complex<double>> S;
+    };
+
+    std::mutex spectrumMtx;
+    std::map<std::pair<int, std::size_t>, std::pair<fftw_plan, fftw_plan>> plans;
+    std::shared_ptr<const Spectrum> lastSpectrum;
+
+    // Smallest 2^a*3^b*5^c*7^d >= n.
+    static int GoodSize(const std::size_t &n) {
+        for (std::size_t m = std::max((std::size_t)2, n); ; ++m) {
+            std::size_t r = m;
+            for (std::size_t p: {2, 3, 5, 7}) {
+                while (r % p == 0) {
+                    r /= p;
+                }
+            }
+            if (r == 1) {
+                return m;
+            }
+        }
+    }
+
+    // The planner isn't thread-safe (across engines too); plans are made once under the process-wide lock.
+    const std::pair<fftw_plan, fftw_plan> &GetPlan(const int &N, const std::size_t &howMany) {
+
+        std::lock_guard<std::mutex> lck(FFTWPlannerMutex());
+
+        auto it = plans.find(std::make_pair(N, howMany));
+        if (it != plans.end()) {
+            return it->second;
+        }
+
+        const int nc = N / 2 + 1, n = howMany;
+        double *x = fftw_alloc_real(N * howMany);
+        fftw_complex *X = fftw_alloc_complex(nc * howMany);
+        auto p = std::make_pair(fftw_plan_many_dft_r2c(1, &N, n, x, nullptr, 1, N, X, nullptr, 1, nc, FFTW_ESTIMATE),
+                                fftw_plan_many_dft_c2r(1, &N, n, X, nullptr, 1, nc, x, nullptr, 1, N, FFTW_ESTIMATE));
+        fftw_free(x);
+        fftw_free(X);
+
+        return plans[std::make_pair(N, howMany)] = p;
+    }
+
+    // The spectrum of the last source asked for; made again when the source or length differs.
+    std::shared_ptr<const Spectrum> GetSpectrum(const EvenSampledSignal &source, const int &N) {
+
+        {
+            std::lock_guard<std::mutex> lck(spectrumMtx);
+            const auto &p = lastSpectrum;
+            if (p && p->N == N && p->begin == source.BeginTime() && p->delta == source.GetDelta() && p->source == source.GetAmp()) {
+                return p;
+            }
+        }
+
+        auto ans = std::make_shared<Spectrum>();
+        ans->source = source.GetAmp();
+        ans->begin = source.BeginTime();
+        ans->delta = source.GetDelta();
+        ans->N = N;
+
+        const int nc = N / 2 + 1;
+        const auto &plan = GetPlan(N, 1);
+
+        std::unique_ptr<double, decltype(&fftw_free)> sBuf(fftw_alloc_real(N), &fftw_free);
+        std::unique_ptr<fftw_complex, decltype(&fftw_free)> SBuf(fftw_alloc_complex(nc), &fftw_free);
+        double *s = sBuf.get();
+        fftw_complex *S = SBuf.get();
+
+        std::fill(s, s + N, 0.0);
+        std::copy(ans->source.begin(), ans->source.end(), s);
+        fftw_execute_dft_r2c(plan.first, s, S);
+
+        ans->maxPower = 0;
+        for (int k = 0; k < nc; ++k) {
+            ans->S.push_back(std::complex<double>(S[k][0], S[k][1]));
+            ans->maxPower = std::max(ans->maxPower, std::norm(ans->S.back()));
+        }
+        if (ans->maxPower == 0) {
+            throw std::runtime_error("DeconEngine: source is all zeros.");
+        }
+
+        std::lock_guard<std::mutex> lck(spectrumMtx);
+        lastSpectrum = ans;
+        return ans;
+    }
+
+    // The fused filter of one setting (water level, Gaussian), including the 1/N of the inverse transform.
+    static std::vector<std::complex<double>> MakeFilter(const Spectrum &spectrum, const DeconSetting &setting) {
+
+        const int N = spectrum.N, nc = N / 2 + 1;
+        const double dt = spectrum.delta, floorPower = setting.waterLevel * spectrum.maxPower;
+
+        std::vector<std::complex<double>> ans(nc);
+        for (int k = 0; k < nc; ++k) {
+
+            const double f = k / (N * dt);
+            const double gauss = exp(-2 * M_PI * M_PI * setting.sigma * setting.sigma * f * f);
+
+            const auto &Sk = spectrum.S[k];
+            ans[k] = std::conj(Sk) / std::max(std::norm(Sk), floorPower) * gauss / (double)N;
+        }
+        return ans;
+    }
+};
+
+#endif
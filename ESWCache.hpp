@@ -0,0 +1,153 @@
+#ifndef ASU_ESWCACHE
+#define ASU_ESWCACHE
+
+#include<cstdint>
+#include<cstdio>
+#include<cstring>
+#include<stdexcept>
+#include<string>
+#include<vector>
+
+#include<unistd.h>
+
+#include<EvenSampledSignal.hpp>
+#include<SACSignals.hpp>
+
+#include "HashKey.hpp"
+#include "FileSystem.hpp"
+
+/*************************************************
+ * This C++ file makes the PREM S ESW (sESW) used by
+ * the modeling drivers, and keeps it in a cache
+ * keyed by every input it depends on.
+ *
+ * MakeSESW   ---- the recipe: read PREM S, filter,
+ *                 stack, stretch each S to the
+ *                 stack, stack again.
+ * CachedSESW ---- return the cached sESW if the PREM
+ *                 files (name, size, mtime), dt, the
+ *                 filter corners and the cut window
+ *                 are unchanged; otherwise rebuild it
+ *                 and store it in cacheDir.
+ *
+ * input(s):
+ * const string &cacheDir    ----  Cache directory (created if needed).
+ * const string &premDataDir ----  Folder of PREM *.THT.sac.
+ * const size_t &traceCnt    ----  Expected number of traces.
+ * const double &dt, &low, &high, &cutT1, &cutT2.
+ *
+ * output(s):
+ * EvenSampledSignal sESW.
+ *
+ * Key words: ESW, cache
+*************************************************/
+
+EvenSampledSignal MakeSESW(const std::string &premDataDir, const std::size_t &traceCnt,
+                           const double &dt, const double &low, const double &high,
+                           const double &cutT1, const double &cutT2){
+
+    SACSignals sESWData(Glob(premDataDir+"/*.THT.sac"));
+
+    if (sESWData.Size() != traceCnt) {
+        throw std::runtime_error("Reading error: PREM.");
+    }
+
+    sESWData.SortByGcarc();
+    sESWData.Interpolate(dt);
+    sESWData.RemoveTrend();
+    sESWData.HannTaper(20);
+    sESWData.Butterworth(low, high);
+
+    // find S peak and shift time reference to the peak.
+    sESWData.FindPeakAround(sESWData.GetTravelTimes("S"),10);
+    sESWData.ShiftTimeReferenceToPeak();
+    sESWData.FlipPeakUp();
+    sESWData.NormalizeToPeak();
+
+    // first stack.
+    sESWData.CheckAndCutToWindow(cutT1-10, cutT2+10);
+
+    auto sESW=sESWData.XCorrStack(0,-15,15,2).second.first;
+    sESW.FindPeakAround(0,10);
+    sESW.ShiftTimeReferenceToPeak();
+    sESW.CheckAndCutToWindow(cutT1, cutT2);
+    sESW.FlipPeakUp();
+    sESW.NormalizeToPeak();
+    sESW.HannTaper(20);
+
+    // stretch/shrink each S waveform to match the stack, then stack again.
+    sESWData.StretchToFit(sESW,-13,13,-0.3,0.3,0.25,true);
+
+    sESW=sESWData.XCorrStack(0,-15,15,2).second.first;
+    sESW.FindPeakAround(0,10);
+    sESW.ShiftTimeReferenceToPeak();
+    sESW.CheckAndCutToWindow(cutT1, cutT2);
+    sESW.FlipPeakUp();
+    sESW.NormalizeToPeak();
+    sESW.HannTaper(20);
+
+    return sESW;
+}
+
+EvenSampledSignal CachedSESW(const std::string &cacheDir, const std::string &premDataDir, const std::size_t &traceCnt,
+                             const double &dt, const double &low, const double &high,
+                             const double &cutT1, const double &cutT2){
+
+    // Bump the recipe tag whenever MakeSESW changes.
+    std::string key = "sESW recipe v1";
+    for (const auto &item: Glob(premDataDir+"/*.THT.sac")) {
+        key += "|" + Fingerprint(item);
+    }
+    key += "|" + std::to_string(traceCnt) + "|" + KeyValue(dt) + "|" + KeyValue(low) + "|" + KeyValue(high);
+    key += "|" + KeyValue(cutT1) + "|" + KeyValue(cutT2);
+
+    const std::string cacheFile = cacheDir + "/sESW_" + HashKey(key) + ".bin";
+
+
+    // Cache hit: magic, npts, dt, begin time, samples (double).
+    FILE *fp = fopen(cacheFile.c_str(), "rb");
+    if (fp != nullptr) {
+
+        char magic[8];
+        uint64_t npts = 0;
+        double delta = 0, beginTime = 0;
+        bool ok = (fread(magic, 1, 8, fp) == 8 && memcmp(magic, "SESWV001", 8) == 0);
+        ok = ok && fread(&npts, sizeof(npts), 1, fp) == 1 && fread(&delta, sizeof(delta), 1, fp) == 1 && fread(&beginTime, sizeof(beginTime), 1, fp) == 1;
+
+        std::vector<double> amp(ok ? npts : 0);
+        ok = ok && (npts == 0 || fread(amp.data(), sizeof(double), npts, fp) == npts);
+        fclose(fp);
+
+        if (ok) {
+            return EvenSampledSignal(amp, delta, beginTime);
+        }
+    }
+
+
+    // Cache miss: build it and store it.
+    auto sESW = MakeSESW(premDataDir, traceCnt, dt, low, high, cutT1, cutT2);
+
+    MakeDirs(cacheDir);
+    const std::string tmpFile = cacheFile + ".tmp" + std::to_string(getpid());
+    fp = fopen(tmpFile.c_str(), "wb");
+    if (fp != nullptr) {
+
+        const auto &amp = sESW.GetAmp();
+        uint64_t npts = amp.size();
+        double delta = sESW.GetDelta(), beginTime = sESW.BeginTime();
+
+        bool ok = (fwrite("SESWV001", 1, 8, fp) == 8);
+        ok = ok && fwrite(&npts, sizeof(npts), 1, fp) == 1 && fwrite(&delta, sizeof(delta), 1, fp) == 1 && fwrite(&beginTime, sizeof(beginTime), 1, fp) == 1;
+        ok = ok && (npts == 0 || fwrite(amp.data(), sizeof(double), npts, fp) == npts);
+        ok = (fclose(fp) == 0) && ok;
+
+        // a failed write only costs a rebuild next time.
+        if (!ok || rename(tmpFile.c_str(), cacheFile.c_str()) != 0) {
+            remove(tmpFile.c_str());
+        }
+    }
+
+    return sESW;
+}
+
+#endif
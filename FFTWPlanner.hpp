@@ -0,0 +1,26 @@
+#ifndef ASU_FFTWPLANNER
+#define ASU_FFTWPLANNER
+
+#include<mutex>
+
+/*************************************************
+ * This C++ file holds the one lock that every FFTW
+ * planner call of this repo's engines (XCorrEngine,
+ * DeconEngine) goes through: making and destroying
+ * plans is not thread-safe, across engines too.
+ * (Executing a plan is.)
+ *
+ * Library calls that plan internally don't take
+ * this lock: a driver that runs them on several
+ * threads calls fftw_make_planner_thread_safe()
+ * once, before its threads start.
+ *
+ * Key words: fftw, planner, mutex
+*************************************************/
+
+std::mutex &FFTWPlannerMutex(){
+    static std::mutex mtx;
+    return mtx;
+}
+
+#endif
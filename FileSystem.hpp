@@ -0,0 +1,133 @@
+#ifndef ASU_FILESYSTEM
+#define ASU_FILESYSTEM
+
+#include<cerrno>
+#include<cstdio>
+#include<mutex>
+#include<set>
+#include<stdexcept>
+#include<string>
+#include<vector>
+
+#include<glob.h>
+#include<sys/stat.h>
+#include<unistd.h>
+
+/*************************************************
+ * This C++ file does the file operations the
+ * drivers used to shell out for, in-process (no
+ * fork/exec per call).
+ *
+ * MakeDirs    ---- mkdir -p. Directories made (or found) once
+ *                  are remembered, so asking again for the same
+ *                  directory costs one set lookup (a directory
+ *                  removed by someone else later is not noticed).
+ * Glob        ---- ls pattern: matching paths, sorted; empty if
+ *                  nothing matches.
+ * Concatenate ---- cat files >> outFile (or > outFile).
+ * RemoveFiles ---- rm -f pattern.
+ * CurrentDir  ---- pwd.
+ *
+ * input(s):
+ * const string &dir                ----  Directory to make.
+ * const string &pattern            ----  Shell wildcard pattern (*, ?, [...]).
+ * const vector<string> &files      ----  Files to concatenate, in order.
+ * const string &outFile            ----  Output file.
+ * const bool &append               ----  Append to outFile (default), or overwrite.
+ *
+ * Key words: filesystem, mkdir, glob, cat
+*************************************************/
+
+void MakeDirs(const std::string &dir){
+
+    static std::mutex mtx;
+    static std::set<std::string> made;
+
+    std::lock_guard<std::mutex> lck(mtx);
+    if (dir.empty() || made.find(dir) != made.end()) {
+        return;
+    }
+
+    for (std::size_t pos = 0; pos != std::string::npos; ) {
+        pos = dir.find('/', pos + 1);
+        const std::string sub = dir.substr(0, pos);
+        if (made.find(sub) != made.end()) {
+            continue;
+        }
+        struct stat st;
+        if (mkdir(sub.c_str(), 0755) != 0 && (errno != EEXIST || stat(sub.c_str(), &st) != 0 || !S_ISDIR(st.st_mode))) {
+            throw std::runtime_error("MakeDirs: can't create " + sub);
+        }
+        made.insert(sub);
+    }
+}
+
+void MakeDirs(const std::vector<std::string> &dirs){
+    for (const auto &item: dirs) {
+        MakeDirs(item);
+    }
+}
+
+std::vector<std::string> Glob(const std::string &pattern){
+
+    std::vector<std::string> ans;
+    glob_t g;
+    const int ret = glob(pattern.c_str(), 0, nullptr, &g);
+    if (ret == 0) {
+        for (std::size_t i = 0; i < g.gl_pathc; ++i) {
+            ans.push_back(g.gl_pathv[i]);
+        }
+    }
+    globfree(&g);
+    if (ret != 0 && ret != GLOB_NOMATCH) {
+        throw std::runtime_error("Glob: can't list " + pattern);
+    }
+    return ans;
+}
+
+void Concatenate(const std::vector<std::string> &files, const std::string &outFile, const bool &append = true){
+
+    FILE *fpout = fopen(outFile.c_str(), append ? "ab" : "wb");
+    if (fpout == nullptr) {
+        throw std::runtime_error("Concatenate: can't open " + outFile);
+    }
+
+    std::vector<char> buffer(1 << 20);
+    bool ok = true;
+    for (std::size_t i = 0; ok && i < files.size(); ++i) {
+        FILE *fpin = fopen(files[i].c_str(), "rb");
+        if (fpin == nullptr) {
+            fclose(fpout);
+            throw std::runtime_error("Concatenate: can't read " + files[i]);
+        }
+        std::size_t n;
+        while (ok && (n = fread(buffer.data(), 1, buffer.size(), fpin)) > 0) {
+            ok = (fwrite(buffer.data(), 1, n, fpout) == n);
+        }
+        ok = ok && !ferror(fpin);
+        fclose(fpin);
+    }
+    ok = (fclose(fpout) == 0) && ok;
+    if (!ok) {
+        throw std::runtime_error("Concatenate: can't write " + outFile);
+    }
+}
+
+void RemoveFiles(const std::string &pattern){
+    for (const auto &item: Glob(pattern)) {
+        remove(item.c_str());
+    }
+}
+
+std::string CurrentDir(){
+    std::vector<char> buffer(4096);
+    while (getcwd(buffer.data(), buffer.size()) == nullptr) {
+        if (errno != ERANGE) {
+            throw std::runtime_error("CurrentDir: can't get the working directory.");
+        }
+        buffer.resize(buffer.size() * 2);
+    }
+    return std::string(buffer.data());
+}
+
+#endif
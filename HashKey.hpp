@@ -0,0 +1,50 @@
+#ifndef ASU_HASHKEY
+#define ASU_HASHKEY
+
+#include<cstdint>
+#include<cstdio>
+#include<string>
+
+#include<sys/stat.h>
+
+/*************************************************
+ * This C++ file turns a description of inputs and
+ * parameters into a short, stable key, for naming
+ * caches and checkpoints.
+ *
+ * HashKey      ---- 64-bit FNV-1a hash as 16 hex digits.
+ * Fingerprint  ---- "name:size:mtime" of a file ("name:missing" if absent).
+ * KeyValue     ---- fixed-precision text of a parameter, so equal values hash equally.
+ *
+ * Key words: hash, cache key
+*************************************************/
+
+std::string HashKey(const std::string &s){
+
+    uint64_t h = 14695981039346656037ULL;
+    for (unsigned char c: s) {
+        h ^= c;
+        h *= 1099511628211ULL;
+    }
+
+    char buf[17];
+    snprintf(buf, sizeof(buf), "%016llx", (unsigned long long)h);
+    return std::string(buf);
+}
+
+std::string Fingerprint(const std::string &fileName){
+
+    struct stat st;
+    if (stat(fileName.c_str(), &st) != 0) {
+        return fileName + ":missing";
+    }
+    return fileName + ":" + std::to_string((long long)st.st_size) + ":" + std::to_string((long long)st.st_mtime);
+}
+
+std::string KeyValue(const double &x){
+    char buf[64];
+    snprintf(buf, sizeof(buf), "%.17g", x);
+    return std::string(buf);
+}
+
+#endif
@@ -0,0 +1,153 @@
+#ifndef ASU_MATRIXSTACK
+#define ASU_MATRIXSTACK
+
+#include<algorithm>
+#include<cmath>
+#include<stdexcept>
+#include<utility>
+#include<vector>
+
+#include<EvenSampledSignal.hpp>
+
+#include "SignalMatrix.hpp"
+
+/*************************************************
+ * This C++ file makes many weighted stacks of the
+ * same set of traces at once, as a matrix product.
+ *
+ * With W (stacks x traces) the weights and X
+ * (traces x samples) the traces on a common time
+ * grid:
+ *
+ *   S1 = W * X,  S2 = W * (X .* X)
+ *   stack = S1 / sum(w)
+ *   std   = sqrt(S2 / sum(w) - stack^2)
+ *
+ * i.e. the weighted mean and the weighted standard
+ * deviation of each stack. The product is blocked
+ * over samples and traces so a block of X stays in
+ * cache while every stack row uses it; zero weights
+ * are skipped.
+ *
+ * The library's StackSignals (and CalculateCQ) are
+ * not changed to take a SignalMatrix: the matrix
+ * rows are stacked only here, and the stacks come
+ * back as EvenSampledSignals for everything else.
+ *
+ * SameGrid   ---- true if all traces share dt, begin time and npts.
+ * MatrixStack ---- {stack, std} for each row of weights. The traces
+ *                  are EvenSampledSignals on one grid, or the rows of
+ *                  a SignalMatrixView (float32; summed in double).
+ *
+ * input(s):
+ * const vector<vector<double>> &weights          ----  One row per stack, one column per trace.
+ * const vector<const EvenSampledSignal *> &traces ----  Traces (same grid).
+ * const SignalMatrixView &traces                  ----  Or: selected rows of a SignalMatrix.
+ *
+ * output(s):
+ * vector<pair<EvenSampledSignal,EvenSampledSignal>> ans  ----  {stack, std}, one per row.
+ *
+ * Key words: stack, matrix product, GEMM
+*************************************************/
+
+bool SameGrid(const std::vector<const EvenSampledSignal *> &traces){
+
+    for (const auto &item: traces) {
+        if (item->GetDelta() != traces[0]->GetDelta() || item->Size() != traces[0]->Size() ||
+            fabs(item->BeginTime() - traces[0]->BeginTime()) > 1e-6 * item->GetDelta()) {
+            return false;
+        }
+    }
+    return true;
+}
+
+template<class T>
+std::vector<std::pair<EvenSampledSignal, EvenSampledSignal>>
+MatrixStackRows(const std::vector<std::vector<double>> &weights, const std::vector<const T *> &x,
+                const std::size_t &n, const double &delta, const double &beginTime){
+
+    const std::size_t m = weights.size(), k = x.size();
+    for (const auto &item: weights) {
+        if (item.size() != k) {
+            throw std::runtime_error("MatrixStack: weight row size doesn't match trace count.");
+        }
+    }
+
+    const std::size_t NB = 512, KB = 64; // sample block, trace block.
+
+    std::vector<double> S1(m * n, 0), S2(m * n, 0);
+    for (std::size_t n0 = 0; n0 < n; n0 += NB) {
+        const std::size_t n1 = std::min(n, n0 + NB);
+
+        for (std::size_t k0 = 0; k0 < k; k0 += KB) {
+            const std::size_t k1 = std::min(k, k0 + KB);
+
+            for (std::size_t i = 0; i < m; ++i) {
+                double *s1 = &S1[i * n], *s2 = &S2[i * n];
+
+                for (std::size_t p = k0; p < k1; ++p) {
+                    const double w = weights[i][p];
+                    if (w == 0) {
+                        continue;
+                    }
+                    const T *xp = x[p];
+                    for (std::size_t j = n0; j < n1; ++j) {
+                        const double wx = w * xp[j];
+                        s1[j] += wx;
+                        s2[j] += wx * xp[j];
+                    }
+                }
+            }
+        }
+    }
+
+    std::vector<std::pair<EvenSampledSignal, EvenSampledSignal>> ans;
+    for (std::size_t i = 0; i < m; ++i) {
+
+        double sumW = 0;
+        for (const auto &w: weights[i]) {
+            sumW += w;
+        }
+
+        std::vector<double> stack(n, 0), std(n, 0);
+        if (sumW != 0) {
+            for (std::size_t j = 0; j < n; ++j) {
+                stack[j] = S1[i * n + j] / sumW;
+                std[j] = sqrt(std::max(0.0, S2[i * n + j] / sumW - stack[j] * stack[j]));
+            }
+        }
+        ans.push_back(std::make_pair(EvenSampledSignal(stack, delta, beginTime), EvenSampledSignal(std, delta, beginTime)));
+    }
+
+    return ans;
+}
+
+std::vector<std::pair<EvenSampledSignal, EvenSampledSignal>>
+MatrixStack(const std::vector<std::vector<double>> &weights, const std::vector<const EvenSampledSignal *> &traces){
+
+    if (traces.empty() || !SameGrid(traces)) {
+        throw std::runtime_error("MatrixStack: traces are not on one time grid.");
+    }
+
+    std::vector<const double *> x;
+    for (const auto &item: traces) {
+        x.push_back(item->GetAmp().data());
+    }
+    return MatrixStackRows(weights, x, traces[0]->Size(), traces[0]->GetDelta(), traces[0]->BeginTime());
+}
+
+std::vector<std::pair<EvenSampledSignal, EvenSampledSignal>>
+MatrixStack(const std::vector<std::vector<double>> &weights, const SignalMatrixView &traces){
+
+    if (traces.NRow() == 0) {
+        throw std::runtime_error("MatrixStack: no traces.");
+    }
+
+    std::vector<const float *> x;
+    for (std::size_t p = 0; p < traces.NRow(); ++p) {
+        x.push_back(traces.Row(p));
+    }
+    return MatrixStackRows(weights, x, traces.Size(), traces.GetDelta(), traces.BeginTime());
+}
+
+#endif
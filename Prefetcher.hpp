@@ -0,0 +1,194 @@
+#ifndef ASU_PREFETCHER
+#define ASU_PREFETCHER
+
+#include<condition_variable>
+#include<exception>
+#include<functional>
+#include<iostream>
+#include<mutex>
+#include<stdexcept>
+#include<thread>
+#include<utility>
+#include<vector>
+
+/*************************************************
+ * This C++ class is an asynchronous reader stage
+ * that loads item 0, 1, 2 ... in the background
+ * and hands the loaded items to compute workers.
+ *
+ * At most "depth" loaded items wait for pickup,
+ * so disk reading runs a bounded number of models
+ * ahead of the compute workers.
+ *
+ * Next() hands out items in claim order: the first
+ * loaded item waiting for pickup; if none is, the
+ * first item nobody has started (the worker loads it
+ * itself instead of waiting); if every remaining
+ * item is being loaded, it waits for the first to
+ * finish. So loaded items never sit behind items a
+ * worker loads itself. Each item is handed out once.
+ *
+ * Exceptions thrown by the loader are re-thrown by
+ * Next() for that item.
+ *
+ * input(s):
+ * const size_t &n                        ----  Number of items.
+ * const function<T(const size_t &)> &f  ----  Loader, called once per item.
+ * const size_t &depth                    ----  Max loaded items waiting for pickup.
+ * const size_t &nReader                  ----  Number of reader threads.
+ *
+ * Key words: prefetch, asynchronous I/O
+*************************************************/
+
+template<class T>
+class Prefetcher {
+
+public:
+
+    Prefetcher(const std::size_t &n, const std::function<T(const std::size_t &)> &f,
+               const std::size_t &depth = 4, const std::size_t &nReader = 1) :
+        loader(f), maxReady(depth == 0 ? 1 : depth), state(n, Idle), items(n), errors(n) {
+
+        for (std::size_t i = 0; i < nReader; ++i) {
+            readers.emplace_back(&Prefetcher::ReaderLoop, this);
+        }
+    }
+
+    Prefetcher(const Prefetcher &) = delete;
+    Prefetcher &operator=(const Prefetcher &) = delete;
+
+    ~Prefetcher() {
+        {
+            std::lock_guard<std::mutex> lck(mtx);
+            stopping = true;
+        }
+        cv.notify_all();
+        for (auto &item: readers) {
+            if (item.joinable()) {
+                item.join();
+            }
+        }
+        if (readerTaken != readerLoaded) {
+            std::cerr << "Prefetcher: " << readerLoaded - readerTaken << " item(s) loaded ahead were never taken." << std::endl;
+        }
+    }
+
+    // Take the next item: {index, item}. Call at most n times.
+    std::pair<std::size_t, T> Next() {
+
+        std::unique_lock<std::mutex> lck(mtx);
+
+        while (true) {
+
+            // past "next" (the readers' cursor) items are Idle or Taken.
+            while (firstOpen < state.size() && state[firstOpen] == Taken) {
+                ++firstOpen;
+            }
+            if (firstOpen == state.size()) {
+                throw std::runtime_error("Prefetcher: every item was already taken.");
+            }
+
+            bool loading = false;
+            std::size_t idle = state.size();
+            for (std::size_t i = firstOpen; i < state.size() && (i < next || idle == state.size()); ++i) {
+                if (state[i] == Ready) {
+                    return Take(i);
+                }
+                if (state[i] == Loading) {
+                    loading = true;
+                }
+                if (state[i] == Idle && idle == state.size()) {
+                    idle = i;
+                }
+            }
+
+            if (idle != state.size()) {
+                state[idle] = Taken;
+                lck.unlock();
+                return std::make_pair(idle, loader(idle));
+            }
+            if (!loading) {
+                throw std::runtime_error("Prefetcher: every item was already taken.");
+            }
+            cv.wait(lck);
+        }
+    }
+
+    // Items loaded by the reader threads, and how many of them were handed out.
+    std::pair<std::size_t, std::size_t> ReaderStats() {
+        std::lock_guard<std::mutex> lck(mtx);
+        return std::make_pair(readerLoaded, readerTaken);
+    }
+
+private:
+
+    enum State {Idle, Loading, Ready, Taken};
+
+    std::function<T(const std::size_t &)> loader;
+    std::size_t maxReady, nReady = 0, next = 0, firstOpen = 0;
+    std::size_t readerLoaded = 0, readerTaken = 0;
+    std::vector<State> state;
+    std::vector<T> items;
+    std::vector<std::exception_ptr> errors;
+
+    std::mutex mtx;
+    std::condition_variable cv;
+    std::vector<std::thread> readers;
+    bool stopping = false;
+
+    std::pair<std::size_t, T> Take(const std::size_t &i) {
+
+        state[i] = Taken;
+        --nReady;
+        ++readerTaken;
+        cv.notify_all();
+
+        if (errors[i]) {
+            std::rethrow_exception(errors[i]);
+        }
+        std::pair<std::size_t, T> ans(i, std::move(items[i]));
+        items[i] = T();
+        return ans;
+    }
+
+    void ReaderLoop() {
+
+        std::unique_lock<std::mutex> lck(mtx);
+
+        while (true) {
+
+            // wait for a free slot.
+            cv.wait(lck, [this](){return stopping || nReady < maxReady;});
+
+            while (next < state.size() && state[next] != Idle) {
+                ++next;
+            }
+            if (stopping || next == state.size()) {
+                return;
+            }
+
+            std::size_t i = next++;
+            state[i] = Loading;
+            ++nReady; // reserve the slot.
+            lck.unlock();
+
+            T x = T();
+            std::exception_ptr e;
+            try {
+                x = loader(i);
+            }
+            catch (...) {
+                e = std::current_exception();
+            }
+
+            lck.lock();
+            items[i] = std::move(x);
+            errors[i] = e;
+            state[i] = Ready;
+            ++readerLoaded;
+            cv.notify_all();
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,551 @@
+#ifndef ASU_RESULTSSTORE
+#define ASU_RESULTSSTORE
+
+#include<algorithm>
+#include<atomic>
+#include<cerrno>
+#include<cmath>
+#include<cstdint>
+#include<cstdio>
+#include<cstdlib>
+#include<cstring>
+#include<map>
+#include<mutex>
+#include<stdexcept>
+#include<string>
+#include<type_traits>
+#include<unordered_map>
+#include<vector>
+
+#include<dirent.h>
+#include<sys/stat.h>
+#include<unistd.h>
+
+#include "FileSystem.hpp"
+
+/*************************************************
+ * This C++ file is a file-backed, columnar store
+ * for result tables, so results can be written and
+ * queried without a database server.
+ *
+ * A table is a directory under the store root,
+ * named like the SQL table ("db.table"). Every
+ * write adds one immutable segment file; writers
+ * on different processes/nodes never share a file.
+ *
+ * Segment layout (native byte order):
+ *   header : "RSSEG001", row count, column count.
+ *   column : name (u32 length + bytes), type (u8),
+ *            then the rows: number -> double (NaN is NULL),
+ *                           text   -> u32 length + bytes.
+ *
+ * Segments are named "<seq>.seg", seq one past the
+ * largest in the table, claimed with link() (which
+ * fails if another writer got there first: take the
+ * next one). So the name order is the order the
+ * segments appeared in the directory, whatever the
+ * hosts' clocks say, and reading them in name order
+ * replays the writes; a later row replaces an earlier
+ * one with the same key column value (the SQL primary
+ * key).
+ *
+ * ResultsCell         ---- one cell: text, number or NULL.
+ * WriteResultsSegment ---- append rows (column-major) to a table.
+ * DropResultsTable    ---- remove every segment of a table.
+ * ResultsStore        ---- load a table; column lookup is case-insensitive.
+ *                          Rows(col, value, orderBy) gives the rows with
+ *                          col == value, sorted by orderBy (descending),
+ *                          from hash indexes built on first use; Cells()
+ *                          gives rows back in WriteResultsSegment form.
+ * CompactResultsTable ---- rewrite a table as one segment, rows sorted by
+ *                          key: the same rows give the same segment, no
+ *                          matter which processes wrote them, in what order.
+ *
+ * input(s):
+ * const string &root      ----  Store root directory.
+ * const string &table     ----  Table name ("db.table").
+ * const string &keyColumn ----  Rows with the same key replace each other.
+ *
+ * Key words: columnar, results, embedded store, index
+*************************************************/
+
+class ResultsCell {
+
+public:
+
+    ResultsCell() : kind(Null) {}
+    ResultsCell(const std::string &s) : kind(Text), text(s) {}
+    ResultsCell(const char *s) : kind(Text), text(s) {}
+    ResultsCell(const double &x) : kind(std::isnan(x) ? Null : Real), value(x) {}
+
+    template<class T, class = typename std::enable_if<std::is_integral<T>::value>::type>
+    ResultsCell(const T &x) : kind(Integer), value(x), text(std::to_string(x)) {}
+
+    bool IsNull() const {return kind == Null;}
+    bool IsNumber() const {return kind == Real || kind == Integer;}
+    double Value() const {return IsNumber() ? value : NAN;}
+
+    std::string Format() const {
+        if (kind == Null) {
+            return "NULL";
+        }
+        if (kind == Real) {
+            char buf[32];
+            snprintf(buf, sizeof(buf), "%.17g", value);
+            return std::string(buf);
+        }
+        return text;
+    }
+
+private:
+
+    enum Kind {Null, Text, Real, Integer} kind;
+    double value = 0;
+    std::string text;
+};
+
+std::vector<std::string> ResultsSegments(const std::string &tableDir){
+
+    std::vector<std::string> ans;
+    DIR *dp = opendir(tableDir.c_str());
+    if (dp == nullptr) {
+        return ans;
+    }
+    while (dirent *ep = readdir(dp)) {
+        const std::string name = ep->d_name;
+        if (name.size() > 4 && name.compare(name.size() - 4, 4, ".seg") == 0) {
+            ans.push_back(name);
+        }
+    }
+    closedir(dp);
+    sort(ans.begin(), ans.end());
+    return ans;
+}
+
+void WriteResultsSegment(const std::string &root, const std::string &table,
+                         const std::vector<std::string> &columns, const std::vector<std::vector<ResultsCell>> &rows){
+
+    if (rows.size() != columns.size()) {
+        throw std::runtime_error("WriteResultsSegment: column count mismatch for " + table);
+    }
+    const uint64_t nRow = rows.empty() ? 0 : rows[0].size(), nCol = columns.size();
+    if (nRow == 0) {
+        return;
+    }
+
+    const std::string tableDir = root + "/" + table;
+    MakeDirs(tableDir);
+
+    // the temporary file is private to this writer: host, pid and a per-process count.
+    static std::atomic<unsigned> tmpSeq{0};
+    char host[64] = {0};
+    gethostname(host, sizeof(host) - 1);
+    char tmp[160];
+    snprintf(tmp, sizeof(tmp), ".%s-%d-%u.tmp", host, (int)getpid(), tmpSeq++);
+
+    const std::string tmpName = tableDir + "/" + tmp;
+    FILE *fp = fopen(tmpName.c_str(), "wb");
+    if (fp == nullptr) {
+        throw std::runtime_error("WriteResultsSegment: can't open " + tmpName);
+    }
+
+    auto put = [&](const void *p, std::size_t n){return fwrite(p, 1, n, fp) == n;};
+    auto putText = [&](const std::string &s){
+        uint32_t n = s.size();
+        return put(&n, 4) && put(s.data(), n);
+    };
+
+    bool ok = put("RSSEG001", 8) && put(&nRow, 8) && put(&nCol, 8);
+    for (std::size_t c = 0; ok && c < nCol; ++c) {
+
+        if (rows[c].size() != nRow) {
+            fclose(fp);
+            remove(tmpName.c_str());
+            throw std::runtime_error("WriteResultsSegment: ragged column " + columns[c]);
+        }
+
+        // a column is numeric unless some cell is text.
+        uint8_t isText = 0;
+        for (const auto &cell: rows[c]) {
+            if (!cell.IsNull() && !cell.IsNumber()) {
+                isText = 1;
+                break;
+            }
+        }
+
+        ok = putText(columns[c]) && put(&isText, 1);
+        for (std::size_t r = 0; ok && r < nRow; ++r) {
+            if (isText) {
+                ok = putText(rows[c][r].Format());
+            }
+            else {
+                double x = rows[c][r].Value();
+                ok = put(&x, 8);
+            }
+        }
+    }
+
+    ok = (fflush(fp) == 0) && (fsync(fileno(fp)) == 0) && ok;
+    ok = (fclose(fp) == 0) && ok;
+    if (!ok) {
+        remove(tmpName.c_str());
+        throw std::runtime_error("WriteResultsSegment: can't write " + tmpName);
+    }
+
+    // claim the next sequence number: link() doesn't replace an existing segment.
+    const auto segments = ResultsSegments(tableDir);
+    unsigned long long seq = (segments.empty() ? 0 : strtoull(segments.back().c_str(), nullptr, 10)) + 1;
+    for (; ; ++seq) {
+        char name[32];
+        snprintf(name, sizeof(name), "%020llu.seg", seq);
+        const std::string fileName = tableDir + "/" + name;
+        if (link(tmpName.c_str(), fileName.c_str()) == 0) {
+            break;
+        }
+        if (errno != EEXIST) {
+            remove(tmpName.c_str());
+            throw std::runtime_error("WriteResultsSegment: can't write " + fileName);
+        }
+    }
+    remove(tmpName.c_str());
+}
+
+void DropResultsTable(const std::string &root, const std::string &table){
+
+    const std::string tableDir = root + "/" + table;
+    for (const auto &item: ResultsSegments(tableDir)) {
+        remove((tableDir + "/" + item).c_str());
+    }
+}
+
+class ResultsStore {
+
+public:
+
+    ResultsStore(const std::string &root, const std::string &table, const std::string &keyColumn = "pairname") {
+
+        const std::string tableDir = root + "/" + table;
+        for (const auto &item: ResultsSegments(tableDir)) {
+            ReadSegment(tableDir + "/" + item);
+        }
+
+        // later rows replace earlier rows with the same key.
+        auto it = column.find(Lower(keyColumn));
+        if (it != column.end()) {
+            std::unordered_map<std::string, std::size_t> last;
+            for (std::size_t r = 0; r < nRow; ++r) {
+                last[it->second.Text(r)] = r;
+            }
+            std::vector<std::size_t> keep;
+            for (std::size_t r = 0; r < nRow; ++r) {
+                if (last[it->second.Text(r)] == r) {
+                    keep.push_back(r);
+                }
+            }
+            if (keep.size() != nRow) {
+                for (auto &item: column) {
+                    item.second.Keep(keep);
+                }
+                nRow = keep.size();
+            }
+        }
+    }
+
+    ResultsStore(const ResultsStore &) = delete;
+    ResultsStore &operator=(const ResultsStore &) = delete;
+
+    std::size_t NRow() const {return nRow;}
+
+    bool HasColumn(const std::string &name) const {
+        return column.find(Lower(name)) != column.end();
+    }
+
+    // Column names (lower case, sorted).
+    std::vector<std::string> Columns() const {
+        std::vector<std::string> ans;
+        for (const auto &item: column) {
+            ans.push_back(item.first);
+        }
+        return ans;
+    }
+
+    // The given rows of the given columns, column-major (as WriteResultsSegment and ResultsWriter take them).
+    std::vector<std::vector<ResultsCell>> Cells(const std::vector<std::string> &names, const std::vector<std::size_t> &rows) const {
+        std::vector<std::vector<ResultsCell>> ans(names.size());
+        for (std::size_t c = 0; c < names.size(); ++c) {
+            const auto &col = Get(names[c]);
+            for (const auto &r: rows) {
+                if (!col.isText) {
+                    ans[c].push_back(ResultsCell(col.number[r]));
+                }
+                else if (col.text[r] == "NULL") {
+                    ans[c].push_back(ResultsCell());
+                }
+                else {
+                    ans[c].push_back(ResultsCell(col.text[r]));
+                }
+            }
+        }
+        return ans;
+    }
+
+    const std::vector<std::string> &GetString(const std::string &name) const {
+        const auto &c = Get(name);
+        std::lock_guard<std::mutex> lck(mtx);
+        if (c.text.size() != nRow) {
+            c.text.resize(nRow);
+            for (std::size_t r = 0; r < nRow; ++r) {
+                c.text[r] = c.Text(r);
+            }
+        }
+        return c.text;
+    }
+
+    const std::vector<double> &GetDouble(const std::string &name) const {
+        const auto &c = Get(name);
+        std::lock_guard<std::mutex> lck(mtx);
+        if (c.number.size() != nRow) {
+            c.number.resize(nRow);
+            for (std::size_t r = 0; r < nRow; ++r) {
+                c.number[r] = (c.text[r] == "NULL" ? NAN : atof(c.text[r].c_str()));
+            }
+        }
+        return c.number;
+    }
+
+    std::vector<int> GetInt(const std::string &name) const {
+        const auto &x = GetDouble(name);
+        std::vector<int> ans(x.size());
+        for (std::size_t r = 0; r < x.size(); ++r) {
+            ans[r] = (std::isnan(x[r]) ? 0 : (int)llround(x[r]));
+        }
+        return ans;
+    }
+
+    // Rows where column == value, ordered by orderBy (NULLs last); in storage order if orderBy is empty.
+    const std::vector<std::size_t> &Rows(const std::string &name, const std::string &value,
+                                         const std::string &orderBy = "", const bool &descending = true) const {
+
+        const std::string col = Lower(name), ord = Lower(orderBy);
+        const std::string indexKey = col + "\t" + ord + "\t" + (descending ? "d" : "a");
+        const auto &c = Get(col);
+        const std::vector<double> *o = ord.empty() ? nullptr : &GetDouble(ord);
+
+        std::lock_guard<std::mutex> lck(mtx);
+        auto it = index.find(indexKey);
+        if (it == index.end()) {
+            auto &idx = index[indexKey];
+            for (std::size_t r = 0; r < nRow; ++r) {
+                idx[c.Text(r)].push_back(r);
+            }
+            if (o != nullptr) {
+                for (auto &item: idx) {
+                    std::stable_sort(item.second.begin(), item.second.end(), [&](const std::size_t &a, const std::size_t &b){
+                        const double x = (*o)[a], y = (*o)[b];
+                        if (std::isnan(x) || std::isnan(y)) {
+                            return !std::isnan(x) && std::isnan(y);
+                        }
+                        return descending ? x > y : x < y;
+                    });
+                }
+            }
+            it = index.find(indexKey);
+        }
+
+        auto jt = it->second.find(value);
+        return jt == it->second.end() ? empty : jt->second;
+    }
+
+    const std::vector<std::size_t> &Rows(const std::string &name, const double &value,
+                                         const std::string &orderBy = "", const bool &descending = true) const {
+        char buf[32];
+        snprintf(buf, sizeof(buf), "%.17g", value);
+        return Rows(name, std::string(buf), orderBy, descending);
+    }
+
+private:
+
+    struct Column {
+        bool isText = false;
+        mutable std::vector<std::string> text;  // text column (or its text form, made on demand).
+        mutable std::vector<double> number;     // numeric column (or its numbers, made on demand).
+
+        std::string Text(const std::size_t &r) const {
+            if (isText) {
+                return text[r];
+            }
+            if (std::isnan(number[r])) {
+                return "NULL";
+            }
+            char buf[32];
+            snprintf(buf, sizeof(buf), "%.17g", number[r]);
+            return std::string(buf);
+        }
+
+        void Keep(const std::vector<std::size_t> &keep) {
+            std::vector<std::string> t;
+            std::vector<double> n;
+            for (const auto &r: keep) {
+                if (isText) {
+                    t.push_back(text[r]);
+                }
+                else {
+                    n.push_back(number[r]);
+                }
+            }
+            text.swap(t);
+            number.swap(n);
+        }
+    };
+
+    std::size_t nRow = 0;
+    std::map<std::string, Column> column;
+    mutable std::map<std::string, std::unordered_map<std::string, std::vector<std::size_t>>> index;
+    mutable std::mutex mtx;
+    const std::vector<std::size_t> empty;
+
+    static std::string Lower(std::string s) {
+        for (auto &ch: s) {
+            ch = tolower(ch);
+        }
+        return s;
+    }
+
+    const Column &Get(const std::string &name) const {
+        auto it = column.find(Lower(name));
+        if (it == column.end()) {
+            throw std::runtime_error("ResultsStore: no column " + name);
+        }
+        return it->second;
+    }
+
+    void ReadSegment(const std::string &fileName) {
+
+        FILE *fp = fopen(fileName.c_str(), "rb");
+        if (fp == nullptr) {
+            throw std::runtime_error("ResultsStore: can't open " + fileName);
+        }
+        fseek(fp, 0, SEEK_END);
+        long size = ftell(fp);
+        fseek(fp, 0, SEEK_SET);
+        std::vector<char> buf(size < 0 ? 0 : size);
+        bool ok = (size >= 24 && fread(buf.data(), 1, size, fp) == (std::size_t)size);
+        fclose(fp);
+        if (!ok || memcmp(buf.data(), "RSSEG001", 8) != 0) {
+            throw std::runtime_error("ResultsStore: bad segment " + fileName);
+        }
+
+        std::size_t p = 8;
+        auto get = [&](void *dst, const std::size_t &n){
+            if (p + n > buf.size()) {
+                throw std::runtime_error("ResultsStore: truncated segment " + fileName);
+            }
+            memcpy(dst, buf.data() + p, n);
+            p += n;
+        };
+        auto getText = [&](){
+            uint32_t n;
+            get(&n, 4);
+            std::string s(n, ' ');
+            get(&s[0], n);
+            return s;
+        };
+
+        uint64_t nr, nc;
+        get(&nr, 8);
+        get(&nc, 8);
+
+        std::map<std::string, bool> seen;
+        for (uint64_t c = 0; c < nc; ++c) {
+
+            const std::string name = Lower(getText());
+            uint8_t isText;
+            get(&isText, 1);
+            seen[name] = true;
+
+            auto it = column.find(name);
+            if (it == column.end()) {
+                // new column: earlier rows are NULL.
+                it = column.insert(std::make_pair(name, Column())).first;
+                it->second.isText = isText;
+                if (isText) {
+                    it->second.text.assign(nRow, "NULL");
+                }
+                else {
+                    it->second.number.assign(nRow, NAN);
+                }
+            }
+            Column &col = it->second;
+            if (isText && !col.isText) {
+                // numeric so far, text from now on: keep the text form.
+                for (std::size_t r = 0; r < nRow; ++r) {
+                    col.text.push_back(col.Text(r));
+                }
+                col.number.clear();
+                col.isText = true;
+            }
+
+            for (uint64_t r = 0; r < nr; ++r) {
+                if (isText) {
+                    col.text.push_back(getText());
+                }
+                else {
+                    double x;
+                    get(&x, 8);
+                    if (col.isText) {
+                        Column one;
+                        one.number.push_back(x);
+                        col.text.push_back(one.Text(0));
+                    }
+                    else {
+                        col.number.push_back(x);
+                    }
+                }
+            }
+        }
+
+        // columns this segment doesn't have are NULL.
+        for (auto &item: column) {
+            if (seen.find(item.first) == seen.end()) {
+                if (item.second.isText) {
+                    item.second.text.resize(nRow + nr, "NULL");
+                }
+                else {
+                    item.second.number.resize(nRow + nr, NAN);
+                }
+            }
+        }
+        nRow += nr;
+    }
+};
+
+void CompactResultsTable(const std::string &root, const std::string &table, const std::string &keyColumn = "pairname"){
+
+    const std::string tableDir = root + "/" + table;
+    const auto segments = ResultsSegments(tableDir);
+    if (segments.empty()) {
+        return;
+    }
+
+    std::vector<std::size_t> rows;
+    std::vector<std::string> names;
+    std::vector<std::vector<ResultsCell>> cells;
+    {
+        const ResultsStore store(root, table, keyColumn);
+        const auto &key = store.GetString(keyColumn);
+        for (std::size_t r = 0; r < store.NRow(); ++r) {
+            rows.push_back(r);
+        }
+        std::sort(rows.begin(), rows.end(), [&](const std::size_t &a, const std::size_t &b){return key[a] < key[b];});
+        names = store.Columns();
+        cells = store.Cells(names, rows);
+    }
+
+    // the new segment sorts after the old ones, so a crash before they're removed loses nothing.
+    WriteResultsSegment(root, table, names, cells);
+    for (const auto &item: segments) {
+        remove((tableDir + "/" + item).c_str());
+    }
+}
+
+#endif
@@ -0,0 +1,252 @@
+#ifndef ASU_RESULTSWRITER
+#define ASU_RESULTSWRITER
+
+#include<atomic>
+#include<chrono>
+#include<condition_variable>
+#include<exception>
+#include<functional>
+#include<iostream>
+#include<mutex>
+#include<stdexcept>
+#include<string>
+#include<thread>
+#include<vector>
+
+#include<MariaDB.hpp>
+
+#include "ResultsStore.hpp"
+#include "StageTimer.hpp"
+
+/*************************************************
+ * This C++ class loads result rows into one table
+ * from a dedicated writer thread.
+ *
+ * Compute threads Push() rows (column-major, like
+ * MariaDB::LoadData) onto a lock-free multi-producer
+ * queue and return at once. The writer thread drains
+ * the queue, formats the cells, and loads many
+ * pushes with one LoadData once batchRows rows are
+ * waiting or the oldest row is maxDelay old.
+ *
+ * Per push, the caller may give:
+ *   preQuery  ---- run just before the batch is loaded
+ *                  (e.g. delete the rows being replaced).
+ *   onLoaded  ---- called by the writer thread after the
+ *                  batch is loaded (e.g. a checkpoint).
+ *
+ * Cells are strings (as is), integers, or doubles
+ * (%.17g; NaN is written as NULL).
+ *
+ * With a store root, each batch is also written as
+ * one segment of the file-backed ResultsStore table
+ * "db.table"; the database can then be left out.
+ *
+ * The database mutex, if given, is held only while
+ * the writer talks to the database. Flush() waits
+ * for everything pushed so far and re-throws a
+ * writer error; the destructor flushes too.
+ *
+ * input(s):
+ * const string &db, &table       ----  Output table.
+ * const vector<string> &columns  ----  Column names.
+ * mutex *dbMtx                   ----  Serializes MariaDB calls with other threads (optional).
+ * const string &storeRoot        ----  ResultsStore root ("": database only).
+ * const bool &toDatabase         ----  Load into MariaDB too.
+ * const size_t &batchRows        ----  Rows per LoadData.
+ * const double &maxDelay         ----  Max seconds a row waits.
+ *
+ * Key words: database, writer thread, MPSC queue
+*************************************************/
+
+class ResultsWriter {
+
+public:
+
+    ResultsWriter(const std::string &db, const std::string &table, const std::vector<std::string> &columns,
+                  std::mutex *dbMtx = nullptr, const std::string &storeRoot = "", const bool &toDatabase = true,
+                  const std::size_t &batchRows = 20000, const double &maxDelay = 5) :
+        db(db), table(table), columns(columns), dbMtx(dbMtx), storeRoot(storeRoot), toDatabase(toDatabase),
+        batchRows(batchRows), maxDelay(maxDelay),
+        writer(&ResultsWriter::WriterLoop, this) {}
+
+    ResultsWriter(const ResultsWriter &) = delete;
+    ResultsWriter &operator=(const ResultsWriter &) = delete;
+
+    ~ResultsWriter() {
+        try {
+            Flush();
+        }
+        catch (std::exception &e) {
+            std::cerr << "ResultsWriter: " << e.what() << std::endl;
+        }
+        stopping = true;
+        wake.notify_all();
+        writer.join();
+    }
+
+    // Never blocks: links the rows onto the queue.
+    void Push(std::vector<std::vector<ResultsCell>> rows, std::function<void()> onLoaded = nullptr,
+              const std::string &preQuery = "") {
+
+        if (rows.size() != columns.size()) {
+            throw std::runtime_error("ResultsWriter: column count mismatch for " + table);
+        }
+
+        Node *p = new Node{std::move(rows), std::move(onLoaded), preQuery, nullptr};
+        p->next = head.load(std::memory_order_relaxed);
+        while (!head.compare_exchange_weak(p->next, p, std::memory_order_release, std::memory_order_relaxed)) {}
+        ++pushed;
+        wake.notify_one();
+    }
+
+    // Wait until every push made before this call is loaded.
+    void Flush() {
+        const std::size_t target = pushed.load();
+        std::unique_lock<std::mutex> lck(doneMtx);
+        flushing = true;
+        wake.notify_one();
+        done.wait(lck, [&](){return loaded >= target || error;});
+        flushing = false;
+        if (error) {
+            auto e = error;
+            error = nullptr;
+            std::rethrow_exception(e);
+        }
+    }
+
+private:
+
+    struct Node {
+        std::vector<std::vector<ResultsCell>> rows;
+        std::function<void()> onLoaded;
+        std::string preQuery;
+        Node *next;
+    };
+
+    const std::string db, table;
+    const std::vector<std::string> columns;
+    std::mutex *dbMtx;
+    const std::string storeRoot;
+    const bool toDatabase;
+    const std::size_t batchRows;
+    const double maxDelay;
+
+    std::atomic<Node *> head{nullptr};
+    std::atomic<std::size_t> pushed{0};
+    std::atomic<bool> stopping{false};
+
+    std::mutex doneMtx;
+    std::condition_variable done;
+    std::condition_variable_any wake;
+    std::size_t loaded = 0;
+    bool flushing = false;
+    std::exception_ptr error;
+
+    std::thread writer;
+
+    void WriterLoop() {
+
+        std::vector<Node *> batch;
+        std::size_t nRow = 0;
+        auto oldest = std::chrono::steady_clock::now();
+        std::mutex sleepMtx;
+
+        while (true) {
+
+            // take everything queued, oldest first.
+            Node *p = head.exchange(nullptr, std::memory_order_acquire);
+            std::vector<Node *> taken;
+            for (; p != nullptr; p = p->next) {
+                taken.push_back(p);
+            }
+            for (auto it = taken.rbegin(); it != taken.rend(); ++it) {
+                if (batch.empty()) {
+                    oldest = std::chrono::steady_clock::now();
+                }
+                batch.push_back(*it);
+                nRow += (*it)->rows.empty() ? 0 : (*it)->rows[0].size();
+            }
+
+            bool flushNow;
+            {
+                std::lock_guard<std::mutex> lck(doneMtx);
+                flushNow = flushing;
+            }
+            const bool last = stopping && head.load() == nullptr;
+            const double age = std::chrono::duration<double>(std::chrono::steady_clock::now() - oldest).count();
+
+            if (!batch.empty() && (nRow >= batchRows || age >= maxDelay || flushNow || last)) {
+                Load(batch);
+                batch.clear();
+                nRow = 0;
+            }
+            if (last) {
+                return;
+            }
+
+            // producers don't lock, so sleep with a timeout instead of relying on the notify alone.
+            std::unique_lock<std::mutex> lck(sleepMtx);
+            wake.wait_for(lck, std::chrono::milliseconds(50));
+        }
+    }
+
+    void Load(const std::vector<Node *> &batch) {
+
+        StageTimer timer("DB write", table);
+        try {
+            if (!storeRoot.empty()) {
+                std::vector<std::vector<ResultsCell>> cells(columns.size());
+                for (const auto &node: batch) {
+                    for (std::size_t c = 0; c < columns.size(); ++c) {
+                        cells[c].insert(cells[c].end(), node->rows[c].begin(), node->rows[c].end());
+                    }
+                }
+                WriteResultsSegment(storeRoot, db + "." + table, columns, cells);
+            }
+
+            std::vector<std::vector<std::string>> sqlData(columns.size());
+            for (const auto &node: batch) {
+                for (std::size_t c = 0; c < columns.size() && toDatabase; ++c) {
+                    for (const auto &cell: node->rows[c]) {
+                        sqlData[c].push_back(cell.Format());
+                    }
+                }
+            }
+
+            if (toDatabase) {
+                std::unique_lock<std::mutex> lck;
+                if (dbMtx != nullptr) {
+                    lck = std::unique_lock<std::mutex>(*dbMtx);
+                }
+                for (const auto &node: batch) {
+                    if (!node->preQuery.empty()) {
+                        MariaDB::Query(node->preQuery);
+                    }
+                }
+                if (!sqlData.empty() && !sqlData[0].empty()) {
+                    MariaDB::LoadData(db, table, columns, sqlData);
+                }
+            }
+
+            for (const auto &node: batch) {
+                if (node->onLoaded) {
+                    node->onLoaded();
+                }
+            }
+        }
+        catch (...) {
+            std::lock_guard<std::mutex> lck(doneMtx);
+            error = std::current_exception();
+        }
+
+        std::lock_guard<std::mutex> lck(doneMtx);
+        loaded += batch.size();
+        for (auto &node: batch) {
+            delete node;
+        }
+        done.notify_all();
+    }
+};
+
+#endif
@@ -0,0 +1,205 @@
+#ifndef ASU_SIGNALMATRIX
+#define ASU_SIGNALMATRIX
+
+#include<algorithm>
+#include<cmath>
+#include<cstdlib>
+#include<cstring>
+#include<memory>
+#include<stdexcept>
+#include<vector>
+
+#include<EvenSampledSignal.hpp>
+
+/*************************************************
+ * This C++ file keeps many traces on one time grid
+ * as a float32 matrix: one row per trace, one
+ * contiguous 64-byte-aligned buffer, dt and begin
+ * time shared by all rows.
+ *
+ * Each row is padded to a multiple of 16 floats so
+ * every row starts on a 64-byte boundary. Compared
+ * with one EvenSampledSignal per trace (doubles and
+ * a heap buffer each) this is less than half the
+ * memory.
+ *
+ * The first row appended sets the grid. A later row
+ * on another grid is linearly interpolated onto it
+ * (zero outside the row's own time range); that is
+ * not what the library's StackSignals would do with
+ * it, so such rows are counted (Regridded()) and the
+ * caller should warn, or not use the matrix, when
+ * the count isn't zero.
+ *
+ * SignalMatrix      ---- owner. Row(i) is a pointer into the buffer;
+ *                        Signal(i) copies row i out as an EvenSampledSignal;
+ *                        Regridded() is the count of interpolated rows.
+ * SignalMatrixView  ---- a list of row indices and a column range of
+ *                        a matrix; selecting rows (Select) or a time
+ *                        window (Window) copies no samples.
+ *
+ * input(s):
+ * const EvenSampledSignal &s       ----  Trace to append.
+ * const vector<size_t> &rows       ----  Rows to select.
+ * const double &t1, &t2            ----  Time window (sec).
+ *
+ * Key words: float32, aligned, matrix, zero-copy
+*************************************************/
+
+class SignalMatrixView;
+
+class SignalMatrix {
+
+public:
+
+    SignalMatrix() {}
+
+    SignalMatrix(const SignalMatrix &) = delete;
+    SignalMatrix &operator=(const SignalMatrix &) = delete;
+
+    std::size_t NRow() const {return nRow;}
+    std::size_t Size() const {return nCol;}
+    std::size_t Stride() const {return stride;}
+    double GetDelta() const {return delta;}
+    double BeginTime() const {return beginTime;}
+    std::size_t Regridded() const {return regridded;}
+
+    const float *Row(const std::size_t &i) const {return buffer.get() + i * stride;}
+
+    EvenSampledSignal Signal(const std::size_t &i) const {
+        return EvenSampledSignal(std::vector<double> (Row(i), Row(i) + nCol), delta, beginTime);
+    }
+
+    // Returns the new row's index.
+    std::size_t Append(const EvenSampledSignal &s) {
+
+        if (nRow == 0) {
+            delta = s.GetDelta();
+            beginTime = s.BeginTime();
+            nCol = s.Size();
+            stride = (nCol + 15) / 16 * 16;
+        }
+        Reserve(nRow + 1);
+
+        float *p = buffer.get() + nRow * stride;
+        const auto &amp = s.GetAmp();
+
+        if (s.GetDelta() == delta && s.Size() == nCol && fabs(s.BeginTime() - beginTime) <= 1e-6 * delta) {
+            for (std::size_t j = 0; j < nCol; ++j) {
+                p[j] = amp[j];
+            }
+        }
+        else {
+            ++regridded;
+            for (std::size_t j = 0; j < nCol; ++j) {
+                const double x = (beginTime + j * delta - s.BeginTime()) / s.GetDelta();
+                const long k = (long)floor(x), last = (long)amp.size() - 1;
+                if (x < 0 || x > last) {
+                    p[j] = 0;
+                }
+                else {
+                    p[j] = (k == last ? amp[k] : amp[k] + (amp[k + 1] - amp[k]) * (x - k));
+                }
+            }
+        }
+        std::fill(p + nCol, p + stride, 0.0f);
+        return nRow++;
+    }
+
+    SignalMatrixView All() const;
+    SignalMatrixView Select(const std::vector<std::size_t> &rows) const;
+
+private:
+
+    struct AlignedFree {
+        void operator()(float *p) const {free(p);}
+    };
+
+    std::unique_ptr<float, AlignedFree> buffer;
+    std::size_t nRow = 0, capacity = 0, nCol = 0, stride = 0, regridded = 0;
+    double delta = 0, beginTime = 0;
+
+    void Reserve(const std::size_t &n) {
+
+        if (n <= capacity) {
+            return;
+        }
+        const std::size_t newCapacity = std::max(n, capacity * 2);
+        void *p = nullptr;
+        if (posix_memalign(&p, 64, std::max((std::size_t)1, newCapacity * stride) * sizeof(float)) != 0) {
+            throw std::runtime_error("SignalMatrix: out of memory.");
+        }
+        if (nRow > 0) {
+            memcpy(p, buffer.get(), nRow * stride * sizeof(float));
+        }
+        buffer.reset((float *)p);
+        capacity = newCapacity;
+    }
+};
+
+class SignalMatrixView {
+
+public:
+
+    SignalMatrixView(const SignalMatrix &m, const std::vector<std::size_t> &rows) :
+        m(&m), rows(rows), col0(0), nCol(m.Size()) {
+
+        for (const auto &item: rows) {
+            if (item >= m.NRow()) {
+                throw std::runtime_error("SignalMatrixView: row out of range.");
+            }
+        }
+    }
+
+    std::size_t NRow() const {return rows.size();}
+    std::size_t Size() const {return nCol;}
+    double GetDelta() const {return m->GetDelta();}
+    double BeginTime() const {return m->BeginTime() + col0 * m->GetDelta();}
+
+    // Samples of the i-th selected row, from BeginTime().
+    const float *Row(const std::size_t &i) const {return m->Row(rows[i]) + col0;}
+
+    EvenSampledSignal Signal(const std::size_t &i) const {
+        return EvenSampledSignal(std::vector<double> (Row(i), Row(i) + nCol), GetDelta(), BeginTime());
+    }
+
+    SignalMatrixView Select(const std::vector<std::size_t> &sub) const {
+        SignalMatrixView ans(*this);
+        ans.rows.clear();
+        for (const auto &item: sub) {
+            ans.rows.push_back(rows.at(item));
+        }
+        return ans;
+    }
+
+    // Samples within [t1, t2].
+    SignalMatrixView Window(const double &t1, const double &t2) const {
+        const double dt = GetDelta(), b = BeginTime();
+        long i1 = std::max(0L, (long)ceil((t1 - b) / dt - 1e-6));
+        long i2 = std::min((long)nCol - 1, (long)floor((t2 - b) / dt + 1e-6));
+        SignalMatrixView ans(*this);
+        ans.col0 = col0 + i1;
+        ans.nCol = (i2 < i1 ? 0 : i2 - i1 + 1);
+        return ans;
+    }
+
+private:
+
+    const SignalMatrix *m;
+    std::vector<std::size_t> rows;
+    std::size_t col0, nCol;
+};
+
+SignalMatrixView SignalMatrix::All() const {
+    std::vector<std::size_t> rows(nRow);
+    for (std::size_t i = 0; i < nRow; ++i) {
+        rows[i] = i;
+    }
+    return SignalMatrixView(*this, rows);
+}
+
+SignalMatrixView SignalMatrix::Select(const std::vector<std::size_t> &rows) const {
+    return SignalMatrixView(*this, rows);
+}
+
+#endif
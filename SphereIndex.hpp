@@ -0,0 +1,115 @@
+#ifndef ASU_SPHEREINDEX
+#define ASU_SPHEREINDEX
+
+#include<algorithm>
+#include<cmath>
+#include<cstdint>
+#include<stdexcept>
+#include<unordered_map>
+#include<vector>
+
+#include<GcpDistance.hpp>
+
+/*************************************************
+ * This C++ class indexes points on the sphere
+ * (lon, lat) for radius queries.
+ *
+ * Each point becomes a unit vector and is put in a
+ * cell of a uniform 3-D grid whose cell size is the
+ * chord of "cellRadius" degrees. A query visits only
+ * the cells within the chord of the query radius,
+ * then keeps the candidates whose GcpDistance is
+ * within the radius, so the answer is the same as a
+ * full scan with GcpDistance.
+ *
+ * input(s):
+ * const vector<double> &lon, &lat  ----  Points (deg).
+ * const double &cellRadius         ----  Typical query radius (deg).
+ *
+ * Query(lon, lat, radius):
+ *   indices of points within radius (deg), ascending.
+ *
+ * Key words: spatial index, sphere, radius query
+*************************************************/
+
+class SphereIndex {
+
+public:
+
+    SphereIndex(const std::vector<double> &lon, const std::vector<double> &lat, const double &cellRadius) :
+        lons(lon), lats(lat) {
+
+        if (lon.size() != lat.size() || cellRadius <= 0) {
+            throw std::runtime_error("SphereIndex: bad input.");
+        }
+
+        cellSize = Chord(cellRadius);
+        for (std::size_t i = 0; i < lon.size(); ++i) {
+            double x, y, z;
+            UnitVector(lon[i], lat[i], x, y, z);
+            cells[Key(Cell(x), Cell(y), Cell(z))].push_back(i);
+        }
+    }
+
+    std::size_t Size() const {return lons.size();}
+
+    std::vector<std::size_t> Query(const double &lon, const double &lat, const double &radius) const {
+
+        std::vector<std::size_t> ans;
+
+        double x, y, z;
+        UnitVector(lon, lat, x, y, z);
+        const double c = (radius >= 180 ? 2.0 : Chord(radius)) + 1e-9;
+
+        for (long i = Cell(x - c); i <= Cell(x + c); ++i) {
+            for (long j = Cell(y - c); j <= Cell(y + c); ++j) {
+                for (long k = Cell(z - c); k <= Cell(z + c); ++k) {
+
+                    auto it = cells.find(Key(i, j, k));
+                    if (it == cells.end()) {
+                        continue;
+                    }
+                    for (const auto &p: it->second) {
+                        if (GcpDistance(lons[p], lats[p], lon, lat) <= radius) {
+                            ans.push_back(p);
+                        }
+                    }
+                }
+            }
+        }
+
+        // (distinct cells may share a key when cells are very small.)
+        std::sort(ans.begin(), ans.end());
+        ans.erase(std::unique(ans.begin(), ans.end()), ans.end());
+        return ans;
+    }
+
+private:
+
+    std::vector<double> lons, lats;
+    double cellSize;
+    std::unordered_map<int64_t, std::vector<std::size_t>> cells;
+
+    static double Chord(const double &deg) {
+        return 2 * sin(std::min(deg, 180.0) * M_PI / 360);
+    }
+
+    static void UnitVector(const double &lon, const double &lat, double &x, double &y, double &z) {
+        const double lo = lon * M_PI / 180, la = lat * M_PI / 180;
+        x = cos(la) * cos(lo);
+        y = cos(la) * sin(lo);
+        z = sin(la);
+    }
+
+    long Cell(const double &v) const {
+        return (long)floor(v / cellSize);
+    }
+
+    // cell coordinates are within +-(2/cellSize), pack them into 21 bits each.
+    static int64_t Key(const long &i, const long &j, const long &k) {
+        const int64_t m = (1 << 21) - 1, o = 1 << 20;
+        return (((i + o) & m) << 42) | (((j + o) & m) << 21) | ((k + o) & m);
+    }
+};
+
+#endif
@@ -0,0 +1,225 @@
+#ifndef ASU_STAGETIMER
+#define ASU_STAGETIMER
+
+#include<algorithm>
+#include<chrono>
+#include<cstdio>
+#include<cstdlib>
+#include<map>
+#include<memory>
+#include<mutex>
+#include<string>
+#include<vector>
+
+#include<unistd.h>
+
+/*************************************************
+ * This C++ file times the stages of a run, per
+ * thread, for profiling.
+ *
+ * Tracing is off unless the environment variable
+ * ASU_TRACE names an output file; when off, a timer
+ * is one branch on a cached flag.
+ *
+ *   ASU_TRACE=run.json ./2_subtractBinStack.out
+ *
+ * StageTimer t("stage", model, bin) records one span
+ * (begin to end of scope; Next("stage") ends it and
+ * starts the next one, same tags). Spans go into a
+ * per-thread buffer, so threads don't contend.
+ *
+ * WriteStageTrace() writes:
+ *   <ASU_TRACE>          ---- Chrome trace JSON ("X" events; open in
+ *                            chrome://tracing or ui.perfetto.dev).
+ *   <ASU_TRACE>.summary  ---- per stage: count, total, mean, max,
+ *                            share of the summed stage time (also on stderr).
+ *
+ * Key words: profiling, timer, trace, Chrome trace
+*************************************************/
+
+struct StageSpan {
+    const char *stage;
+    std::string model;
+    int bin;
+    long long begin, duration; // ns.
+};
+
+struct StageBuffer {
+    std::mutex mtx;
+    int tid;
+    std::vector<StageSpan> spans;
+};
+
+class StageTrace {
+
+public:
+
+    static StageTrace &Get() {
+        static StageTrace trace;
+        return trace;
+    }
+
+    bool On() const {return on;}
+
+    long long Now() const {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - origin).count();
+    }
+
+    void Record(const char *stage, const std::string &model, const int &bin, const long long &begin, const long long &end) {
+
+        thread_local std::shared_ptr<StageBuffer> mine;
+        if (!mine) {
+            mine = std::make_shared<StageBuffer>();
+            std::lock_guard<std::mutex> lck(mtx);
+            mine->tid = buffers.size() + 1;
+            buffers.push_back(mine); // kept after the thread exits.
+        }
+        std::lock_guard<std::mutex> lck(mine->mtx);
+        mine->spans.push_back(StageSpan{stage, model, bin, begin, end - begin});
+    }
+
+    void Write() {
+
+        if (!on) {
+            return;
+        }
+
+        std::vector<std::pair<int, StageSpan>> all;
+        {
+            std::lock_guard<std::mutex> lck(mtx);
+            for (const auto &buf: buffers) {
+                std::lock_guard<std::mutex> lck2(buf->mtx);
+                for (const auto &item: buf->spans) {
+                    all.push_back(std::make_pair(buf->tid, item));
+                }
+            }
+        }
+
+        FILE *fp = fopen(fileName.c_str(), "w");
+        if (fp == nullptr) {
+            fprintf(stderr, "StageTrace: can't write %s\n", fileName.c_str());
+            return;
+        }
+        fprintf(fp, "{\"traceEvents\":[\n");
+        for (std::size_t i = 0; i < all.size(); ++i) {
+            const auto &s = all[i].second;
+            fprintf(fp, "%s{\"name\":\"%s\",\"cat\":\"stage\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%d,\"args\":{\"model\":\"%s\",\"bin\":%d}}\n",
+                    (i == 0 ? "" : ","), s.stage, s.begin / 1e3, s.duration / 1e3, (int)getpid(), all[i].first, Escape(s.model).c_str(), s.bin);
+        }
+        fprintf(fp, "],\"displayTimeUnit\":\"ms\"}\n");
+        fclose(fp);
+
+        // summary.
+        struct Row {std::size_t count = 0; double total = 0, max = 0;};
+        std::map<std::string, Row> rows;
+        double sum = 0;
+        for (const auto &item: all) {
+            auto &r = rows[item.second.stage];
+            const double t = item.second.duration / 1e9;
+            ++r.count;
+            r.total += t;
+            r.max = std::max(r.max, t);
+            sum += t;
+        }
+        std::vector<std::pair<std::string, Row>> sorted(rows.begin(), rows.end());
+        std::sort(sorted.begin(), sorted.end(), [](const std::pair<std::string, Row> &a, const std::pair<std::string, Row> &b){
+            return a.second.total > b.second.total;
+        });
+
+        std::string table;
+        char line[256];
+        snprintf(line, sizeof(line), "%-24s %10s %12s %12s %12s %7s\n", "stage", "count", "total(s)", "mean(ms)", "max(ms)", "share");
+        table += line;
+        for (const auto &item: sorted) {
+            const Row &r = item.second;
+            snprintf(line, sizeof(line), "%-24s %10zu %12.3f %12.3f %12.3f %6.1f%%\n", item.first.c_str(), r.count,
+                     r.total, 1e3 * r.total / r.count, 1e3 * r.max, (sum > 0 ? 100 * r.total / sum : 0.0));
+            table += line;
+        }
+        snprintf(line, sizeof(line), "(stage times summed over %zu threads; wall time %.3f s)\n", buffers.size(), Now() / 1e9);
+        table += line;
+
+        fprintf(stderr, "%s", table.c_str());
+        fp = fopen((fileName + ".summary").c_str(), "w");
+        if (fp != nullptr) {
+            fprintf(fp, "%s", table.c_str());
+            fclose(fp);
+        }
+    }
+
+private:
+
+    bool on = false;
+    std::string fileName;
+    std::chrono::steady_clock::time_point origin = std::chrono::steady_clock::now();
+    std::mutex mtx;
+    std::vector<std::shared_ptr<StageBuffer>> buffers;
+
+    StageTrace() {
+        const char *p = getenv("ASU_TRACE");
+        if (p != nullptr && p[0] != '\0') {
+            on = true;
+            fileName = p;
+        }
+    }
+
+    static std::string Escape(const std::string &s) {
+        std::string ans;
+        for (const auto &c: s) {
+            if (c == '"' || c == '\\') {
+                ans += '\\';
+            }
+            ans += c;
+        }
+        return ans;
+    }
+};
+
+class StageTimer {
+
+public:
+
+    StageTimer(const char *stage, const std::string &model = "", const int &bin = -1) : stage(stage) {
+        if (StageTrace::Get().On()) {
+            this->model = model;
+            this->bin = bin;
+            begin = StageTrace::Get().Now();
+        }
+    }
+
+    StageTimer(const StageTimer &) = delete;
+    StageTimer &operator=(const StageTimer &) = delete;
+
+    ~StageTimer() {
+        Stop();
+    }
+
+    // End this span, start the next stage with the same tags.
+    void Next(const char *nextStage) {
+        Stop();
+        stage = nextStage;
+        if (StageTrace::Get().On()) {
+            begin = StageTrace::Get().Now();
+        }
+    }
+
+    void Stop() {
+        if (stage != nullptr && StageTrace::Get().On()) {
+            StageTrace::Get().Record(stage, model, bin, begin, StageTrace::Get().Now());
+        }
+        stage = nullptr;
+    }
+
+private:
+
+    const char *stage;
+    std::string model;
+    int bin = -1;
+    long long begin = 0;
+};
+
+void WriteStageTrace(){
+    StageTrace::Get().Write();
+}
+
+#endif
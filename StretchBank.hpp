@@ -0,0 +1,128 @@
+#ifndef ASU_STRETCHBANK
+#define ASU_STRETCHBANK
+
+#include<algorithm>
+#include<atomic>
+#include<cmath>
+#include<stdexcept>
+#include<vector>
+
+#include<EvenSampledSignal.hpp>
+
+/*************************************************
+ * This C++ class fits a template (e.g. sESW) to
+ * the half-height width of traces, in place of
+ * temp.StretchToFitHalfWidth(trace).
+ *
+ * By default (useBank = false) that is exactly what
+ * FitHalfWidth calls. With useBank, the template is
+ * stretched/shrunk over a dense grid of factors once,
+ * and the bank is then shared read-only by all
+ * worker threads.
+ *
+ * For each factor it keeps the stretched template
+ * (on the original window, like
+ * StretchToFitHalfWidth) and its half-height width.
+ * Fitting a trace is then a lookup instead of
+ * re-stretching the template per trace.
+ *
+ * FitHalfWidth ---- temp.StretchToFitHalfWidth(trace); with
+ *                   useBank, the entry whose half-height
+ *                   width is closest to the trace's.
+ *
+ * The bank quantizes the factor: the entry's factor is
+ * within step/2 of the exact fit, i.e. its half-width is
+ * off by about step/2 * (template half-width) -- 0.025 sec
+ * for a 10 sec wide sESW at the default step, one sample
+ * at dt = 0.025. A trace whose half-width is outside the
+ * bank's range is fitted exactly instead
+ * (temp.StretchToFitHalfWidth, not clamped to the grid);
+ * Fallbacks() counts those. tests/StretchBankTest
+ * measures the difference from StretchToFitHalfWidth.
+ *
+ * input(s):
+ * const EvenSampledSignal &temp  ----  Template, time reference at its peak.
+ * const bool &useBank            ----  Look the fit up in the bank (quantized), or fit exactly (default).
+ * const double &minFactor        ----  Smallest stretch factor.
+ * const double &maxFactor        ----  Largest stretch factor.
+ * const double &step             ----  Factor increment.
+ *
+ * Key words: stretch, template bank
+*************************************************/
+
+class StretchBank {
+
+public:
+
+    StretchBank(const EvenSampledSignal &temp, const bool &useBank = false, const double &minFactor = 0.5,
+                const double &maxFactor = 2.0, const double &step = 0.005) : temp(temp), useBank(useBank) {
+
+        if (minFactor <= 0 || maxFactor < minFactor || step <= 0) {
+            throw std::runtime_error("StretchBank: bad factor grid.");
+        }
+        if (!useBank) {
+            return;
+        }
+
+        const std::size_t n = (std::size_t)floor((maxFactor - minFactor) / step + 1e-9) + 1;
+        for (std::size_t i = 0; i < n; ++i) {
+
+            const double f = minFactor + i * step;
+            auto s = temp * 0;
+            s.AddSignal(temp.Stretch(f));
+
+            auto len = s.FindAmplevel(0.5);
+
+            factors.push_back(f);
+            halfWidths.push_back(s.GetDelta() * (len.second - len.first));
+            signals.push_back(s);
+        }
+
+        minWidth = *std::min_element(halfWidths.begin(), halfWidths.end());
+        maxWidth = *std::max_element(halfWidths.begin(), halfWidths.end());
+    }
+
+    StretchBank(const StretchBank &p) : temp(p.temp), useBank(p.useBank), factors(p.factors), halfWidths(p.halfWidths), signals(p.signals),
+                                        minWidth(p.minWidth), maxWidth(p.maxWidth), fallbacks(p.fallbacks.load()) {}
+
+    bool UseBank() const {return useBank;}
+    std::size_t Size() const {return signals.size();}
+    double Factor(const std::size_t &i) const {return factors[i];}
+    double HalfWidth(const std::size_t &i) const {return halfWidths[i];}
+    const EvenSampledSignal &Signal(const std::size_t &i) const {return signals[i];}
+    std::size_t Fallbacks() const {return fallbacks;}
+
+    EvenSampledSignal FitHalfWidth(const EvenSampledSignal &trace) const {
+
+        if (!useBank) {
+            return temp.StretchToFitHalfWidth(trace);
+        }
+
+        auto len = trace.FindAmplevel(0.5);
+        const double target = trace.GetDelta() * (len.second - len.first);
+
+        if (target < minWidth || target > maxWidth) {
+            ++fallbacks;
+            return temp.StretchToFitHalfWidth(trace);
+        }
+
+        std::size_t best = 0;
+        for (std::size_t i = 1; i < Size(); ++i) {
+            if (fabs(halfWidths[i] - target) < fabs(halfWidths[best] - target)) {
+                best = i;
+            }
+        }
+        return signals[best];
+    }
+
+private:
+
+    EvenSampledSignal temp;
+    bool useBank;
+    std::vector<double> factors, halfWidths;
+    std::vector<EvenSampledSignal> signals;
+    double minWidth = 0, maxWidth = 0;
+    mutable std::atomic<std::size_t> fallbacks{0};
+};
+
+#endif
@@ -0,0 +1,165 @@
+#ifndef ASU_SYNTHETICWAVEFORMS
+#define ASU_SYNTHETICWAVEFORMS
+
+#include<algorithm>
+#include<cmath>
+#include<cstdio>
+#include<random>
+#include<stdexcept>
+#include<string>
+#include<vector>
+
+#include<EvenSampledSignal.hpp>
+
+/*************************************************
+ * This C++ file makes synthetic model sets and data
+ * sets for benchmarking, so the pipeline can run
+ * without PROJ/t039.* or a database.
+ *
+ * Pulses are the Gaussian of 3_DefineCQ.cpp: a
+ * GaussianSignal centered on its peak, normalized
+ * to the peak, time reference at the peak. A bank
+ * of stretched copies gives the width variations.
+ *
+ * SyntheticWaveforms::Trace ---- one trace on [t1, t2]: the given
+ *                                arrivals (time, amplitude, stretch)
+ *                                plus white noise.
+ * MakeSyntheticModel        ---- one model: S at 0 sec and ScS at
+ *                                ScSTime(gcarc) on every station, ScS
+ *                                amplitude/width and a precursor drawn
+ *                                per model.
+ * MakeSyntheticRecords      ---- data geometry: bounce points, gcarc
+ *                                and SNR of each record.
+ *
+ * Everything is drawn from std::mt19937 with the
+ * given seed, so a run is reproducible.
+ *
+ * input(s):
+ * const double &dt, &sigma  ----  Sampling rate, Gaussian sigma (sec).
+ * const size_t &nStation    ----  Stations per model (gcarc evenly spaced).
+ * const size_t &nRecord     ----  Data records.
+ * const unsigned &seed      ----  Random seed.
+ *
+ * Key words: synthetic, benchmark, Gaussian
+*************************************************/
+
+class SyntheticWaveforms {
+
+public:
+
+    SyntheticWaveforms(const double &dt, const double &sigma, const double &minFactor = 0.6,
+                       const double &maxFactor = 1.6, const double &step = 0.02) :
+        dt(dt), minFactor(minFactor), step(step) {
+
+        const double signalLen = 16 * sigma * maxFactor;
+        EvenSampledSignal pulse(GaussianSignal((std::size_t)floor(signalLen / dt), dt, sigma), dt, 0);
+        pulse.FindPeakAround(signalLen / 2.0);
+        pulse.NormalizeToPeak();
+        pulse.ShiftTimeReferenceToPeak();
+
+        for (double f = minFactor; f <= maxFactor + 1e-9; f += step) {
+            pulses.push_back(pulse.Stretch(f));
+        }
+    }
+
+    double GetDelta() const {return dt;}
+
+    EvenSampledSignal Trace(const double &t1, const double &t2, const std::vector<double> &times,
+                            const std::vector<double> &amps, const std::vector<double> &stretches,
+                            const double &noise, std::mt19937 &rng) const {
+
+        const std::size_t n = (std::size_t)floor((t2 - t1) / dt + 1e-6) + 1;
+        std::vector<double> amp(n, 0);
+
+        for (std::size_t a = 0; a < times.size(); ++a) {
+
+            const long k = std::max(0L, std::min((long)pulses.size() - 1, lround((stretches[a] - minFactor) / step)));
+            const auto &p = pulses[k];
+            const auto &pAmp = p.GetAmp();
+            const long shift = lround((times[a] + p.BeginTime() - t1) / dt);
+            for (long j = std::max(0L, -shift); j < (long)pAmp.size() && j + shift < (long)n; ++j) {
+                amp[j + shift] += amps[a] * pAmp[j];
+            }
+        }
+
+        if (noise > 0) {
+            std::normal_distribution<double> gauss(0, noise);
+            for (auto &item: amp) {
+                item += gauss(rng);
+            }
+        }
+        return EvenSampledSignal(amp, dt, t1);
+    }
+
+private:
+
+    const double dt, minFactor, step;
+    std::vector<EvenSampledSignal> pulses;
+};
+
+// ScS arrival relative to S (sec); roughly the PREM S-ScS moveout over 40 ~ 85 deg.
+double ScSTime(const double &gcarc){
+    return 5 + 0.9 * (85 - gcarc);
+}
+
+struct SyntheticModel {
+    std::vector<EvenSampledSignal> traces; // S at 0 sec, ScS at scsTime.
+    std::vector<std::string> stationNames;
+    std::vector<double> gcarc, scsTime;
+};
+
+SyntheticModel MakeSyntheticModel(const SyntheticWaveforms &gen, const std::size_t &nStation,
+                                  const double &distMin, const double &distMax,
+                                  const double &t1, const double &t2, const unsigned &seed){
+
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<double> scsAmp(0.2, 0.6), scsStretch(0.8, 1.4), preAmp(-0.2, 0.2), preTime(-8, -2);
+    std::uniform_real_distribution<double> jitter(0.95, 1.05);
+
+    // model properties, shared by all stations.
+    const double a = scsAmp(rng), s = scsStretch(rng), pa = preAmp(rng), pt = preTime(rng);
+
+    SyntheticModel ans;
+    char stnm[16];
+    for (std::size_t i = 0; i < nStation; ++i) {
+
+        const double gcarc = distMin + (nStation < 2 ? 0 : (distMax - distMin) * i / (nStation - 1));
+        const double tScS = ScSTime(gcarc);
+        snprintf(stnm, sizeof(stnm), "ST%04zu", i);
+
+        ans.stationNames.push_back(stnm);
+        ans.gcarc.push_back(gcarc);
+        ans.scsTime.push_back(tScS);
+        ans.traces.push_back(gen.Trace(t1, t2, {0, tScS + pt, tScS}, {1, a * pa, a}, {jitter(rng), s, s * jitter(rng)}, 0.005, rng));
+    }
+    return ans;
+}
+
+struct SyntheticRecords {
+    std::vector<std::string> pairname;
+    std::vector<double> lon, lat, gcarc, snr;
+};
+
+SyntheticRecords MakeSyntheticRecords(const std::size_t &nRecord, const double &lonMin, const double &lonMax,
+                                      const double &latMin, const double &latMax,
+                                      const double &distMin, const double &distMax, const unsigned &seed){
+
+    if (lonMax < lonMin || latMax < latMin || distMax < distMin) {
+        throw std::runtime_error("MakeSyntheticRecords: bad region.");
+    }
+
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<double> lon(lonMin, lonMax), lat(latMin, latMax), gcarc(distMin, distMax), snr(1, 10);
+
+    SyntheticRecords ans;
+    for (std::size_t i = 0; i < nRecord; ++i) {
+        ans.pairname.push_back("SYN_" + std::to_string(i));
+        ans.lon.push_back(lon(rng));
+        ans.lat.push_back(lat(rng));
+        ans.gcarc.push_back(gcarc(rng));
+        ans.snr.push_back(snr(rng));
+    }
+    return ans;
+}
+
+#endif
@@ -0,0 +1,500 @@
+#ifndef ASU_TABLESNAPSHOT
+#define ASU_TABLESNAPSHOT
+
+#include<algorithm>
+#include<cctype>
+#include<cstdint>
+#include<cstdio>
+#include<cstring>
+#include<ctime>
+#include<map>
+#include<memory>
+#include<mutex>
+#include<stdexcept>
+#include<string>
+#include<vector>
+
+#include<fcntl.h>
+#include<strings.h>
+#include<sys/mman.h>
+#include<sys/stat.h>
+#include<unistd.h>
+
+#include<MariaDB.hpp>
+
+#include "HashKey.hpp"
+#include "FileSystem.hpp"
+
+/*************************************************
+ * This C++ file keeps read-only reference tables
+ * (Master_a14, Bins, BinMembers, Properties ...)
+ * as binary snapshots, so drivers can read them
+ * without a database.
+ *
+ * SnapshotSelect(dir, query, types) returns the
+ * snapshot of MariaDB::Select(query). The first call
+ * (or refresh) runs the query and writes the file;
+ * later calls only map the file. The file name is
+ * the hash of the query and the types, so a changed
+ * query makes a new snapshot.
+ *
+ * types: one letter per selected column,
+ *   s ---- string (dictionary-encoded),
+ *   d ---- double,
+ *   i ---- int.
+ *
+ * Layout (native byte order, sections 8-byte aligned):
+ *   header : "TBLSNAP1", version, column count, row count,
+ *            creation time, query text.
+ *   columns: name, type, data offset, dictionary size/offset.
+ *   data   : d -> double[nRow]; i -> int32[nRow];
+ *            s -> uint32 id[nRow], then the dictionary
+ *                 (uint64 offset[nDict + 1], characters).
+ *
+ * Dictionaries are sorted, so string ids compare like
+ * the strings and a lookup is a binary search.
+ *
+ * TableSnapshot is a read-only mmap of the file:
+ *   Double/Int/Ids(col) ---- pointers into the mapping (zero-copy).
+ *   Id(col, s)          ---- id of a string (NId(col) if absent).
+ *   Rows(col, s)        ---- rows holding s.
+ *   Find(col, s)        ---- first row holding s (NRow() if absent).
+ *   GetString/GetDouble/GetInt(col) ---- like a MariaDB::Select
+ *                                        result (copies, made once).
+ * Column lookup is case-insensitive.
+ *
+ * input(s):
+ * const string &dir    ----  Snapshot directory.
+ * const string &query  ----  Select query (without "select").
+ * const string &types  ----  Column types, e.g. "sddd".
+ * const bool &refresh  ----  Re-run the query even if the snapshot exists.
+ *
+ * Key words: snapshot, columnar, mmap, dictionary encoding
+*************************************************/
+
+struct TableSnapshotHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t nCol;
+    uint64_t nRow;
+    int64_t created;
+    uint64_t queryLen;
+};
+
+struct TableSnapshotColumn {
+    char name[48];
+    uint32_t type;
+    uint32_t reserved;
+    uint64_t data;     // offsets from the start of the file.
+    uint64_t nDict;
+    uint64_t dict;
+};
+
+// One column to snapshot (only the vector matching the type is used).
+struct SnapshotColumnData {
+    std::string name;
+    char type;
+    std::vector<std::string> s;
+    std::vector<double> d;
+    std::vector<int> i;
+};
+
+void WriteTableSnapshot(const std::string &fileName, const std::string &query, const std::vector<SnapshotColumnData> &columns){
+
+    const std::size_t nRow = (columns.empty() ? 0 : std::max({columns[0].s.size(), columns[0].d.size(), columns[0].i.size()}));
+
+    std::string buf;
+    auto pad = [&](){buf.resize((buf.size() + 7) / 8 * 8, '\0');};
+    auto append = [&](const void *p, const std::size_t &n){buf.append((const char *)p, n);};
+
+    TableSnapshotHeader header;
+    memcpy(header.magic, "TBLSNAP1", 8);
+    header.version = 1;
+    header.nCol = columns.size();
+    header.nRow = nRow;
+    header.created = time(nullptr);
+    header.queryLen = query.size();
+    append(&header, sizeof(header));
+    buf += query;
+    pad();
+
+    const std::size_t dirPos = buf.size();
+    std::vector<TableSnapshotColumn> dir(columns.size());
+    buf.resize(buf.size() + dir.size() * sizeof(TableSnapshotColumn));
+
+    for (std::size_t c = 0; c < columns.size(); ++c) {
+
+        const auto &col = columns[c];
+        const std::size_t n = (col.type == 's' ? col.s.size() : (col.type == 'd' ? col.d.size() : col.i.size()));
+        if (col.name.size() >= sizeof(dir[c].name) || (col.type != 's' && col.type != 'd' && col.type != 'i') || n != nRow) {
+            throw std::runtime_error("WriteTableSnapshot: bad column \"" + col.name + "\" for " + fileName);
+        }
+
+        memset(&dir[c], 0, sizeof(TableSnapshotColumn));
+        memcpy(dir[c].name, col.name.c_str(), col.name.size());
+        dir[c].type = col.type;
+        dir[c].data = buf.size();
+
+        if (col.type == 'd') {
+            append(col.d.data(), n * sizeof(double));
+        }
+        else if (col.type == 'i') {
+            std::vector<int32_t> v(col.i.begin(), col.i.end());
+            append(v.data(), n * sizeof(int32_t));
+        }
+        else {
+            std::vector<std::string> dict = col.s;
+            std::sort(dict.begin(), dict.end());
+            dict.erase(std::unique(dict.begin(), dict.end()), dict.end());
+
+            std::vector<uint32_t> ids(n);
+            for (std::size_t r = 0; r < n; ++r) {
+                ids[r] = std::lower_bound(dict.begin(), dict.end(), col.s[r]) - dict.begin();
+            }
+            append(ids.data(), n * sizeof(uint32_t));
+            pad();
+
+            std::vector<uint64_t> offset(1, 0);
+            for (const auto &item: dict) {
+                offset.push_back(offset.back() + item.size());
+            }
+            dir[c].nDict = dict.size();
+            dir[c].dict = buf.size();
+            append(offset.data(), offset.size() * sizeof(uint64_t));
+            for (const auto &item: dict) {
+                buf += item;
+            }
+        }
+        pad();
+    }
+    if (!dir.empty()) {
+        memcpy(&buf[dirPos], dir.data(), dir.size() * sizeof(TableSnapshotColumn));
+    }
+
+    // write to a temporary file, then rename, so readers never see a partial snapshot.
+    const std::string tmpName = fileName + ".tmp" + std::to_string(getpid());
+    FILE *fp = fopen(tmpName.c_str(), "wb");
+    if (fp == nullptr) {
+        throw std::runtime_error("WriteTableSnapshot: can't open " + tmpName);
+    }
+    bool ok = (fwrite(buf.data(), 1, buf.size(), fp) == buf.size());
+    ok = (fclose(fp) == 0) && ok;
+    if (!ok || rename(tmpName.c_str(), fileName.c_str()) != 0) {
+        remove(tmpName.c_str());
+        throw std::runtime_error("WriteTableSnapshot: can't write " + fileName);
+    }
+}
+
+class TableSnapshot {
+
+public:
+
+    TableSnapshot(const std::string &fileName) : cache(new Cache()) {
+
+        int fd = open(fileName.c_str(), O_RDONLY);
+        if (fd < 0) {
+            throw std::runtime_error("TableSnapshot: can't open " + fileName);
+        }
+        struct stat st;
+        if (fstat(fd, &st) != 0 || (std::size_t)st.st_size < sizeof(TableSnapshotHeader)) {
+            close(fd);
+            throw std::runtime_error("TableSnapshot: bad file " + fileName);
+        }
+        const std::size_t mapSize = st.st_size;
+        void *p = mmap(nullptr, mapSize, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if (p == MAP_FAILED) {
+            throw std::runtime_error("TableSnapshot: can't map " + fileName);
+        }
+        mapping = std::shared_ptr<const char>((const char *)p, [mapSize](const char *q){munmap((void *)q, mapSize);});
+
+        header = (const TableSnapshotHeader *)p;
+        if (memcmp(header->magic, "TBLSNAP1", 8) != 0 || header->version != 1) {
+            throw std::runtime_error("TableSnapshot: not a version 1 snapshot: " + fileName);
+        }
+
+        // check every section is inside the file.
+        std::size_t pos = (sizeof(TableSnapshotHeader) + header->queryLen + 7) / 8 * 8;
+        columns = (const TableSnapshotColumn *)(mapping.get() + pos);
+        bool ok = (pos + header->nCol * sizeof(TableSnapshotColumn) <= mapSize);
+        for (std::size_t c = 0; ok && c < header->nCol; ++c) {
+            const auto &col = columns[c];
+            const std::size_t width = (col.type == 'd' ? sizeof(double) : sizeof(int32_t));
+            ok = (col.data + header->nRow * width <= mapSize);
+            if (ok && col.type == 's') {
+                const uint64_t *offset = (const uint64_t *)(mapping.get() + col.dict);
+                ok = (col.dict + (col.nDict + 1) * sizeof(uint64_t) <= mapSize) &&
+                     (col.dict + (col.nDict + 1) * sizeof(uint64_t) + offset[col.nDict] <= mapSize);
+            }
+            index[Lower(std::string(col.name, strnlen(col.name, sizeof(col.name))))] = c;
+        }
+        if (!ok) {
+            throw std::runtime_error("TableSnapshot: truncated file: " + fileName);
+        }
+    }
+
+    std::size_t NRow() const {return header->nRow;}
+    std::size_t NCol() const {return header->nCol;}
+    time_t Created() const {return header->created;}
+    std::string Query() const {return std::string(mapping.get() + sizeof(TableSnapshotHeader), header->queryLen);}
+
+    bool HasColumn(const std::string &name) const {return index.find(Lower(name)) != index.end();}
+
+    const double *Double(const std::string &name) const {return (const double *)(mapping.get() + Get(name, 'd').data);}
+    const int32_t *Int(const std::string &name) const {return (const int32_t *)(mapping.get() + Get(name, 'i').data);}
+    const uint32_t *Ids(const std::string &name) const {return (const uint32_t *)(mapping.get() + Get(name, 's').data);}
+
+    std::size_t NId(const std::string &name) const {return Get(name, 's').nDict;}
+
+    std::string Name(const std::string &name, const std::size_t &id) const {
+        const auto &col = Get(name, 's');
+        const uint64_t *offset = (const uint64_t *)(mapping.get() + col.dict);
+        const char *chars = (const char *)(offset + col.nDict + 1);
+        return std::string(chars + offset[id], offset[id + 1] - offset[id]);
+    }
+
+    std::size_t Id(const std::string &name, const std::string &value) const {
+        std::size_t lo = 0, hi = NId(name);
+        while (lo < hi) {
+            const std::size_t mid = (lo + hi) / 2;
+            if (Name(name, mid) < value) {
+                lo = mid + 1;
+            }
+            else {
+                hi = mid;
+            }
+        }
+        return (lo < NId(name) && Name(name, lo) == value ? lo : NId(name));
+    }
+
+    // Rows holding value, ascending.
+    std::vector<std::size_t> Rows(const std::string &name, const std::string &value) const {
+        const std::size_t id = Id(name, value);
+        if (id == NId(name)) {
+            return {};
+        }
+        const auto &g = Groups(name);
+        return std::vector<std::size_t> (g.second.begin() + g.first[id], g.second.begin() + g.first[id + 1]);
+    }
+
+    std::size_t Find(const std::string &name, const std::string &value) const {
+        const std::size_t id = Id(name, value);
+        if (id == NId(name)) {
+            return NRow();
+        }
+        const auto &g = Groups(name);
+        return g.second[g.first[id]];
+    }
+
+    const std::vector<std::string> &GetString(const std::string &name) const {
+
+        const auto &col = Get(name);
+        std::lock_guard<std::mutex> lck(cache->mtx);
+        auto &ans = cache->s[Lower(name)];
+        if (ans.size() != NRow()) {
+            ans.clear();
+            if (col.type == 's') {
+                std::vector<std::string> dict;
+                for (std::size_t id = 0; id < col.nDict; ++id) {
+                    dict.push_back(Name(name, id));
+                }
+                const uint32_t *ids = Ids(name);
+                for (std::size_t r = 0; r < NRow(); ++r) {
+                    ans.push_back(dict[ids[r]]);
+                }
+            }
+            else {
+                char buf[32];
+                for (std::size_t r = 0; r < NRow(); ++r) {
+                    if (col.type == 'd') {
+                        snprintf(buf, sizeof(buf), "%.17g", Double(name)[r]);
+                    }
+                    else {
+                        snprintf(buf, sizeof(buf), "%d", (int)Int(name)[r]);
+                    }
+                    ans.push_back(buf);
+                }
+            }
+        }
+        return ans;
+    }
+
+    const std::vector<double> &GetDouble(const std::string &name) const {
+
+        const auto &col = Get(name);
+        if (col.type == 's') {
+            throw std::runtime_error("TableSnapshot: column is not a number: " + name);
+        }
+        std::lock_guard<std::mutex> lck(cache->mtx);
+        auto &ans = cache->d[Lower(name)];
+        if (ans.size() != NRow()) {
+            if (col.type == 'd') {
+                ans.assign(Double(name), Double(name) + NRow());
+            }
+            else {
+                ans.assign(Int(name), Int(name) + NRow());
+            }
+        }
+        return ans;
+    }
+
+    const std::vector<int> &GetInt(const std::string &name) const {
+
+        const auto &col = Get(name);
+        if (col.type == 's') {
+            throw std::runtime_error("TableSnapshot: column is not a number: " + name);
+        }
+        std::lock_guard<std::mutex> lck(cache->mtx);
+        auto &ans = cache->i[Lower(name)];
+        if (ans.size() != NRow()) {
+            ans.clear();
+            for (std::size_t r = 0; r < NRow(); ++r) {
+                ans.push_back(col.type == 'i' ? Int(name)[r] : (int)Double(name)[r]);
+            }
+        }
+        return ans;
+    }
+
+private:
+
+    // copies made on request; shared by copies of this snapshot.
+    struct Cache {
+        std::mutex mtx;
+        std::map<std::string, std::vector<std::string>> s;
+        std::map<std::string, std::vector<double>> d;
+        std::map<std::string, std::vector<int>> i;
+        std::map<std::string, std::pair<std::vector<std::size_t>, std::vector<std::size_t>>> groups;
+    };
+
+    std::shared_ptr<const char> mapping;
+    const TableSnapshotHeader *header = nullptr;
+    const TableSnapshotColumn *columns = nullptr;
+    std::map<std::string, std::size_t> index;
+    std::shared_ptr<Cache> cache;
+
+    static std::string Lower(std::string s) {
+        for (auto &ch: s) {
+            ch = tolower(ch);
+        }
+        return s;
+    }
+
+    // Rows of a string column grouped by id (CSR: rows of id k are [offset[k], offset[k + 1])).
+    const std::pair<std::vector<std::size_t>, std::vector<std::size_t>> &Groups(const std::string &name) const {
+
+        const uint32_t *ids = Ids(name);
+        std::lock_guard<std::mutex> lck(cache->mtx);
+        auto &ans = cache->groups[Lower(name)];
+        if (ans.first.empty()) {
+            ans.first.assign(NId(name) + 1, 0);
+            for (std::size_t r = 0; r < NRow(); ++r) {
+                ++ans.first[ids[r] + 1];
+            }
+            for (std::size_t k = 0; k < NId(name); ++k) {
+                ans.first[k + 1] += ans.first[k];
+            }
+            ans.second.resize(NRow());
+            auto pos = ans.first;
+            for (std::size_t r = 0; r < NRow(); ++r) {
+                ans.second[pos[ids[r]]++] = r;
+            }
+        }
+        return ans;
+    }
+
+    const TableSnapshotColumn &Get(const std::string &name, const char &type = 0) const {
+        auto it = index.find(Lower(name));
+        if (it == index.end()) {
+            throw std::runtime_error("TableSnapshot: no column " + name);
+        }
+        const auto &col = columns[it->second];
+        if (type != 0 && col.type != (uint32_t)type) {
+            throw std::runtime_error("TableSnapshot: column " + name + " is not of type " + std::string(1, type));
+        }
+        return col;
+    }
+};
+
+// Result column names of a select list: the alias after "as", else the name after the last ".".
+std::vector<std::string> SnapshotColumnNames(const std::string &query){
+
+    std::vector<std::string> items(1);
+    int depth = 0;
+    char quote = 0;
+    for (std::size_t p = 0; p < query.size(); ++p) {
+
+        const char ch = query[p];
+        if (quote != 0) {
+            quote = (ch == quote ? 0 : quote);
+        }
+        else if (ch == '\'' || ch == '"' || ch == '`') {
+            quote = ch;
+        }
+        else if (ch == '(' || ch == ')') {
+            depth += (ch == '(' ? 1 : -1);
+        }
+        else if (depth == 0 && ch == ',') {
+            items.push_back("");
+            continue;
+        }
+        else if (depth == 0 && isspace(ch) && strncasecmp(query.c_str() + p + 1, "from", 4) == 0 &&
+                 (p + 5 == query.size() || isspace(query[p + 5]))) {
+            break;
+        }
+        items.back() += ch;
+    }
+
+    std::vector<std::string> ans;
+    for (auto item: items) {
+        while (!item.empty() && isspace(item.back())) {
+            item.pop_back();
+        }
+        std::size_t p = item.find_last_of(" \t\n");
+        if (p != std::string::npos && p >= 3 && strncasecmp(item.c_str() + p - 3, " as", 3) == 0) {
+            item = item.substr(p + 1);
+        }
+        else {
+            p = item.find_last_of(". \t\n");
+            item = (p == std::string::npos ? item : item.substr(p + 1));
+        }
+        item.erase(std::remove(item.begin(), item.end(), '`'), item.end());
+        ans.push_back(item);
+    }
+    return ans;
+}
+
+TableSnapshot SnapshotSelect(const std::string &dir, const std::string &query, const std::string &types, const bool &refresh = false){
+
+    const std::string fileName = dir + "/" + HashKey(query + "|" + types) + ".snap";
+    if (!refresh && access(fileName.c_str(), R_OK) == 0) {
+        return TableSnapshot(fileName);
+    }
+
+    const auto names = SnapshotColumnNames(query);
+    if (names.size() != types.size()) {
+        throw std::runtime_error("SnapshotSelect: " + std::to_string(names.size()) + " columns but " +
+                                 std::to_string(types.size()) + " types in: " + query);
+    }
+
+    auto res = MariaDB::Select(query);
+    std::vector<SnapshotColumnData> columns(names.size());
+    for (std::size_t c = 0; c < names.size(); ++c) {
+        columns[c].name = names[c];
+        columns[c].type = types[c];
+        if (types[c] == 's') {
+            columns[c].s = res.GetString(names[c]);
+        }
+        else if (types[c] == 'd') {
+            columns[c].d = res.GetDouble(names[c]);
+        }
+        else {
+            columns[c].i = res.GetInt(names[c]);
+        }
+    }
+
+    MakeDirs(dir);
+    WriteTableSnapshot(fileName, query, columns);
+    return TableSnapshot(fileName);
+}
+
+#endif
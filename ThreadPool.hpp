@@ -0,0 +1,249 @@
+#ifndef ASU_THREADPOOL
+#define ASU_THREADPOOL
+
+#include<algorithm>
+#include<atomic>
+#include<condition_variable>
+#include<deque>
+#include<exception>
+#include<functional>
+#include<future>
+#include<memory>
+#include<mutex>
+#include<thread>
+#include<vector>
+
+/*************************************************
+ * This C++ class is a persistent work-stealing
+ * thread pool shared by the modeling drivers.
+ *
+ * Tasks submitted from outside the pool (e.g. one
+ * per model) go to a shared FIFO, so models start
+ * in submission order. A task submitted from inside
+ * a worker goes to that worker's own deque (newest
+ * first, for cache locality). Idle workers take
+ * their own newest task, then the oldest outside
+ * task, then steal the oldest task of the others.
+ *
+ * ParallelFor() splits a loop into one group: the
+ * caller and any idle workers claim the group's
+ * indices one at a time, and the caller only ever
+ * runs indices of its own group (never another
+ * model), so nesting a ParallelFor inside a model
+ * task can't deadlock or recurse into other models.
+ * Once the indices are all claimed, the caller
+ * sleeps until the last one finishes.
+ *
+ * input(s):
+ * const size_t &n  ----  Number of worker threads.
+ *
+ * Key words: thread pool, work stealing
+*************************************************/
+
+class ThreadPool {
+
+public:
+
+    explicit ThreadPool(const std::size_t &n = std::thread::hardware_concurrency()) {
+
+        std::size_t nWorker = (n == 0 ? 1 : n);
+
+        for (std::size_t i = 0; i < nWorker; ++i) {
+            queues.emplace_back(new TaskQueue());
+        }
+        for (std::size_t i = 0; i < nWorker; ++i) {
+            workers.emplace_back(&ThreadPool::WorkerLoop, this, i);
+        }
+    }
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    // Drains every queued task, then joins the workers.
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lck(sleepMtx);
+            stopping = true;
+        }
+        sleepCV.notify_all();
+        for (auto &item: workers) {
+            if (item.joinable()) {
+                item.join();
+            }
+        }
+    }
+
+    std::size_t Size() const {return workers.size();}
+
+    // Queue a task. Exceptions thrown by the task are re-thrown by future::get().
+    template<class F>
+    std::future<void> Submit(F f) {
+
+        auto task = std::make_shared<std::packaged_task<void()>>(std::move(f));
+        std::future<void> ans = task->get_future();
+        Enqueue([task](){(*task)();});
+        return ans;
+    }
+
+    // Run f(i) for i in [begin, end) on the pool; the caller helps (with this loop only) until all finish.
+    // The first exception thrown by f is re-thrown here.
+    template<class F>
+    void ParallelFor(const std::size_t &begin, const std::size_t &end, F f) {
+
+        if (begin >= end) {
+            return;
+        }
+
+        auto group = std::make_shared<Group>(begin, end);
+
+        // helpers hold a reference to f, but only call it for an index they claimed,
+        // i.e. before the loop below can return.
+        auto run = [group, &f](){
+            for (std::size_t i = group->next++; i < group->end; i = group->next++) {
+                try {
+                    f(i);
+                }
+                catch (...) {
+                    std::lock_guard<std::mutex> lck(group->mtx);
+                    if (!group->error) {
+                        group->error = std::current_exception();
+                    }
+                }
+                std::lock_guard<std::mutex> lck(group->mtx);
+                if (++group->done == group->end - group->begin) {
+                    group->cv.notify_all();
+                }
+            }
+        };
+
+        const std::size_t nHelper = std::min(end - begin, workers.size()) - 1;
+        for (std::size_t k = 0; k < nHelper; ++k) {
+            Enqueue(run);
+        }
+        run();
+
+        std::unique_lock<std::mutex> lck(group->mtx);
+        group->cv.wait(lck, [&group](){return group->done == group->end - group->begin;});
+        if (group->error) {
+            std::rethrow_exception(group->error);
+        }
+    }
+
+private:
+
+    struct TaskQueue {
+        std::mutex mtx;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    // one ParallelFor: indices are claimed from "next", "done" counts the finished ones.
+    struct Group {
+        Group(const std::size_t &begin, const std::size_t &end) : begin(begin), end(end), next(begin) {}
+        const std::size_t begin, end;
+        std::atomic<std::size_t> next;
+        std::size_t done = 0;
+        std::exception_ptr error;
+        std::mutex mtx;
+        std::condition_variable cv;
+    };
+
+    TaskQueue outside; // tasks from outside the pool, FIFO.
+    std::vector<std::unique_ptr<TaskQueue>> queues;
+    std::vector<std::thread> workers;
+
+    std::mutex sleepMtx;
+    std::condition_variable sleepCV;
+    long queued = 0;
+    bool stopping = false;
+
+
+    // Index of the calling thread in this pool, -1 for outside threads.
+    struct WorkerID {
+        const ThreadPool *pool = nullptr;
+        int index = -1;
+    };
+
+    static WorkerID &CurrentWorker() {
+        thread_local WorkerID id;
+        return id;
+    }
+
+    int Self() const {
+        const WorkerID &id = CurrentWorker();
+        return (id.pool == this ? id.index : -1);
+    }
+
+    void Enqueue(std::function<void()> task) {
+
+        const int self = Self();
+        TaskQueue &q = (self >= 0 ? *queues[self] : outside);
+        {
+            std::lock_guard<std::mutex> lck(q.mtx);
+            q.tasks.push_back(std::move(task));
+        }
+        {
+            std::lock_guard<std::mutex> lck(sleepMtx);
+            ++queued;
+        }
+        sleepCV.notify_one();
+    }
+
+    // Pop own newest task first, then the oldest outside task, then steal the oldest from the others.
+    bool RunOne(const std::size_t &self) {
+
+        std::function<void()> task;
+        const std::size_t n = queues.size();
+
+        auto take = [&task](TaskQueue &q, const bool &newest){
+            std::lock_guard<std::mutex> lck(q.mtx);
+            if (q.tasks.empty()) {
+                return;
+            }
+            if (newest) {
+                task = std::move(q.tasks.back());
+                q.tasks.pop_back();
+            }
+            else {
+                task = std::move(q.tasks.front());
+                q.tasks.pop_front();
+            }
+        };
+
+        take(*queues[self], true);
+        if (!task) {
+            take(outside, false);
+        }
+        for (std::size_t k = 1; k < n && !task; ++k) {
+            take(*queues[(self + k) % n], false);
+        }
+
+        if (!task) {
+            return false;
+        }
+        {
+            std::lock_guard<std::mutex> lck(sleepMtx);
+            --queued;
+        }
+        task();
+        return true;
+    }
+
+    void WorkerLoop(const std::size_t self) {
+
+        CurrentWorker().pool = this;
+        CurrentWorker().index = (int)self;
+
+        while (true) {
+            if (RunOne(self)) {
+                continue;
+            }
+            std::unique_lock<std::mutex> lck(sleepMtx);
+            sleepCV.wait(lck, [this](){return queued > 0 || stopping;});
+            if (queued == 0 && stopping) {
+                return;
+            }
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,223 @@
+#ifndef ASU_TOPKTRACKER
+#define ASU_TOPKTRACKER
+
+#include<algorithm>
+#include<cmath>
+#include<cstdio>
+#include<fstream>
+#include<map>
+#include<mutex>
+#include<sstream>
+#include<stdexcept>
+#include<string>
+#include<utility>
+#include<vector>
+
+#include<unistd.h>
+
+/*************************************************
+ * This C++ class keeps, while modeling runs, the
+ * best K models of each family for every bin, and
+ * the PREM baseline cq of every bin.
+ *
+ * The baseline is the one model named premModel
+ * (PREM_201500000000); other models are ranked by
+ * family, the model name before "_" (ULVZ, UHVZ,
+ * Lamella), and only count when their properties
+ * pass the filter:
+ *
+ *   dRhoMin <= drho <= dRhoMax, thickness <= maxThickness.
+ *
+ * Updating a model again replaces its old entry, so
+ * re-runs don't duplicate models (a model pushed out
+ * of a list by a stale entry is not recovered).
+ *
+ * The summary file is a few KB of text:
+ *   TOPK2 K dRhoMin dRhoMax maxThickness premModel
+ *   prem <bin> <cq>
+ *   top <bin> <family> <modelName> <cq>   (cq desc)
+ *
+ * input(s):
+ * const size_t &k                 ----  Models kept per bin per family.
+ * const double &dRhoMin, &dRhoMax ----  drho range (%).
+ * const double &maxThickness      ----  Max thickness (km).
+ * const string &premModel         ----  Baseline model name.
+ *
+ * Key words: top-K, best fit, summary
+*************************************************/
+
+class TopKTracker {
+
+public:
+
+    TopKTracker(const std::size_t &k, const double &dRhoMin, const double &dRhoMax, const double &maxThickness,
+                const std::string &premModel = "PREM_201500000000") :
+        k(k), dRhoMin(dRhoMin), dRhoMax(dRhoMax), maxThickness(maxThickness), premModel(premModel) {}
+
+    std::size_t K() const {return k;}
+
+    // K of a saved summary (0 if it's missing or unreadable), to make a tracker that can Load it.
+    static std::size_t SavedK(const std::string &fileName) {
+        std::ifstream fpin(fileName);
+        std::string tag;
+        std::size_t fk;
+        return (fpin >> tag >> fk && tag == "TOPK2") ? fk : 0;
+    }
+
+    // Properties used by the filter (models without properties are left out).
+    void SetModel(const std::string &modelName, const double &thickness, const double &drho) {
+        std::lock_guard<std::mutex> lck(mtx);
+        passes[modelName] = (dRhoMin <= drho && drho <= dRhoMax && thickness <= maxThickness);
+    }
+
+    void Update(const std::string &modelName, const int &bin, const double &cq) {
+        std::lock_guard<std::mutex> lck(mtx);
+        UpdateOne(modelName, bin, cq);
+    }
+
+    void Update(const std::string &modelName, const std::vector<int> &bins, const std::vector<double> &cqs) {
+        std::lock_guard<std::mutex> lck(mtx);
+        for (std::size_t i = 0; i < bins.size(); ++i) {
+            UpdateOne(modelName, bins[i], cqs[i]);
+        }
+    }
+
+    std::vector<int> Bins() const {
+        std::lock_guard<std::mutex> lck(mtx);
+        std::vector<int> ans;
+        for (const auto &item: premCQ) {
+            ans.push_back(item.first);
+        }
+        for (const auto &item: top) {
+            ans.push_back(item.first.first);
+        }
+        sort(ans.begin(), ans.end());
+        ans.erase(unique(ans.begin(), ans.end()), ans.end());
+        return ans;
+    }
+
+    // NaN if PREM has no result in this bin.
+    double PremCQ(const int &bin) const {
+        std::lock_guard<std::mutex> lck(mtx);
+        auto it = premCQ.find(bin);
+        return it == premCQ.end() ? NAN : it->second;
+    }
+
+    // {cq, modelName}, cq desc.
+    std::vector<std::pair<double, std::string>> Top(const int &bin, const std::string &family) const {
+        std::lock_guard<std::mutex> lck(mtx);
+        auto it = top.find(std::make_pair(bin, family));
+        return it == top.end() ? std::vector<std::pair<double, std::string>> () : it->second;
+    }
+
+    void Save(const std::string &fileName) const {
+
+        std::ostringstream os;
+        os.precision(17);
+        {
+            std::lock_guard<std::mutex> lck(mtx);
+            os << "TOPK2 " << k << " " << dRhoMin << " " << dRhoMax << " " << maxThickness << " " << premModel << '\n';
+            for (const auto &item: premCQ) {
+                os << "prem " << item.first << " " << item.second << '\n';
+            }
+            for (const auto &item: top) {
+                for (const auto &entry: item.second) {
+                    os << "top " << item.first.first << " " << item.first.second << " " << entry.second << " " << entry.first << '\n';
+                }
+            }
+        }
+
+        const std::string tmpName = fileName + ".tmp" + std::to_string(getpid());
+        std::ofstream fpout(tmpName);
+        fpout << os.str();
+        fpout.close();
+        if (!fpout || rename(tmpName.c_str(), fileName.c_str()) != 0) {
+            remove(tmpName.c_str());
+            throw std::runtime_error("TopKTracker: can't write " + fileName);
+        }
+    }
+
+    // Merge a saved summary; false if it's missing or was made with other K / filter / baseline.
+    bool Load(const std::string &fileName) {
+
+        std::ifstream fpin(fileName);
+        std::string tag, prem;
+        std::size_t fk;
+        double a, b, c;
+        if (!(fpin >> tag >> fk >> a >> b >> c >> prem) || tag != "TOPK2" ||
+            fk != k || a != dRhoMin || b != dRhoMax || c != maxThickness || prem != premModel) {
+            return false;
+        }
+
+        std::lock_guard<std::mutex> lck(mtx);
+        int bin;
+        double cq;
+        std::string family, modelName;
+        while (fpin >> tag) {
+            if (tag == "prem" && fpin >> bin >> cq) {
+                premCQ[bin] = cq;
+            }
+            else if (tag == "top" && fpin >> bin >> family >> modelName >> cq) {
+                Insert(top[std::make_pair(bin, family)], modelName, cq);
+            }
+            else {
+                return false;
+            }
+        }
+        return true;
+    }
+
+private:
+
+    const std::size_t k;
+    const double dRhoMin, dRhoMax, maxThickness;
+    const std::string premModel;
+
+    mutable std::mutex mtx;
+    std::map<std::string, bool> passes;
+    std::map<int, double> premCQ;
+    std::map<std::pair<int, std::string>, std::vector<std::pair<double, std::string>>> top;
+
+    void UpdateOne(const std::string &modelName, const int &bin, const double &cq) {
+
+        if (std::isnan(cq)) {
+            return;
+        }
+
+        if (modelName == premModel) {
+            premCQ[bin] = cq;
+            return;
+        }
+        const std::string family = modelName.substr(0, modelName.find("_"));
+
+        auto it = passes.find(modelName);
+        if (it == passes.end() || !it->second) {
+            return;
+        }
+        Insert(top[std::make_pair(bin, family)], modelName, cq);
+    }
+
+    // K is small: a sorted vector is simpler than a heap and keeps the order for saving.
+    void Insert(std::vector<std::pair<double, std::string>> &list, const std::string &modelName, const double &cq) {
+
+        for (auto it = list.begin(); it != list.end(); ++it) {
+            if (it->second == modelName) {
+                list.erase(it);
+                break;
+            }
+        }
+        if (k == 0 || (list.size() == k && !(cq > list.back().first))) {
+            return;
+        }
+
+        auto pos = std::upper_bound(list.begin(), list.end(), cq, [](const double &x, const std::pair<double, std::string> &e){
+            return x > e.first;
+        });
+        list.insert(pos, std::make_pair(cq, modelName));
+        if (list.size() > k) {
+            list.pop_back();
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,204 @@
+#ifndef ASU_WAVEFORMPACK
+#define ASU_WAVEFORMPACK
+
+#include<algorithm>
+#include<cstdint>
+#include<cstdio>
+#include<cstring>
+#include<iterator>
+#include<map>
+#include<stdexcept>
+#include<string>
+#include<vector>
+
+#include<fcntl.h>
+#include<sys/mman.h>
+#include<sys/stat.h>
+#include<unistd.h>
+
+#include<EvenSampledSignal.hpp>
+
+/*************************************************
+ * This C++ file packs all traces of one model into
+ * one binary file, and maps it back for reading.
+ *
+ * Layout (native byte order):
+ *   header : "WAVEPACK", version, trace count, dt.
+ *   index  : one entry per trace (station name,
+ *            gcarc, begin time, npts, offset).
+ *   samples: float32, contiguous, trace after trace.
+ *
+ * WaveformPack mmaps the file. Amp(i) points into
+ * the mapping (zero-copy); Signal(i) makes an
+ * EvenSampledSignal copy when one is needed.
+ *
+ * input(s):
+ * const string &fileName                 ----  Pack file.
+ * const vector<EvenSampledSignal> &traces ----  Traces (same dt).
+ * const vector<string> &names            ----  Station names.
+ * const vector<double> &gcarcs           ----  Distances.
+ *
+ * Key words: binary, mmap, waveform
+*************************************************/
+
+struct WaveformPackHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t nTrace;
+    double delta;
+};
+
+struct WaveformPackEntry {
+    char name[24];
+    double gcarc;
+    double beginTime;
+    uint64_t npts;
+    uint64_t offset; // in samples, from the start of the sample block.
+};
+
+void WriteWaveformPack(const std::string &fileName, const std::vector<EvenSampledSignal> &traces,
+                       const std::vector<std::string> &names, const std::vector<double> &gcarcs){
+
+    if (traces.size() != names.size() || traces.size() != gcarcs.size()) {
+        throw std::runtime_error("WriteWaveformPack: input size mismatch.");
+    }
+
+    WaveformPackHeader header;
+    memcpy(header.magic, "WAVEPACK", 8);
+    header.version = 1;
+    header.nTrace = traces.size();
+    header.delta = (traces.empty() ? 0 : traces[0].GetDelta());
+
+    std::vector<WaveformPackEntry> entries(traces.size());
+    uint64_t offset = 0;
+    for (std::size_t i = 0; i < traces.size(); ++i) {
+
+        if (names[i].size() >= sizeof(entries[i].name)) {
+            throw std::runtime_error("WriteWaveformPack: station name too long: " + names[i]);
+        }
+        if (traces[i].GetDelta() != header.delta) {
+            throw std::runtime_error("WriteWaveformPack: traces have different dt.");
+        }
+
+        memset(entries[i].name, 0, sizeof(entries[i].name));
+        memcpy(entries[i].name, names[i].c_str(), names[i].size());
+        entries[i].gcarc = gcarcs[i];
+        entries[i].beginTime = traces[i].BeginTime();
+        entries[i].npts = traces[i].Size();
+        entries[i].offset = offset;
+        offset += entries[i].npts;
+    }
+
+    // write to a temporary file, then rename, so readers never see a partial pack.
+    const std::string tmpName = fileName + ".tmp" + std::to_string(getpid());
+    FILE *fp = fopen(tmpName.c_str(), "wb");
+    if (fp == nullptr) {
+        throw std::runtime_error("WriteWaveformPack: can't open " + tmpName);
+    }
+
+    bool ok = (fwrite(&header, sizeof(header), 1, fp) == 1);
+    ok = ok && (entries.empty() || fwrite(entries.data(), sizeof(WaveformPackEntry), entries.size(), fp) == entries.size());
+
+    std::vector<float> buffer;
+    for (std::size_t i = 0; ok && i < traces.size(); ++i) {
+        const auto &amp = traces[i].GetAmp();
+        buffer.assign(amp.begin(), amp.end());
+        ok = (buffer.empty() || fwrite(buffer.data(), sizeof(float), buffer.size(), fp) == buffer.size());
+    }
+
+    ok = (fclose(fp) == 0) && ok;
+    if (!ok || rename(tmpName.c_str(), fileName.c_str()) != 0) {
+        remove(tmpName.c_str());
+        throw std::runtime_error("WriteWaveformPack: can't write " + fileName);
+    }
+}
+
+class WaveformPack {
+
+public:
+
+    WaveformPack(const std::string &fileName) {
+
+        int fd = open(fileName.c_str(), O_RDONLY);
+        if (fd < 0) {
+            throw std::runtime_error("WaveformPack: can't open " + fileName);
+        }
+        struct stat st;
+        if (fstat(fd, &st) != 0 || (std::size_t)st.st_size < sizeof(WaveformPackHeader)) {
+            close(fd);
+            throw std::runtime_error("WaveformPack: bad file " + fileName);
+        }
+        mapSize = st.st_size;
+        base = mmap(nullptr, mapSize, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if (base == MAP_FAILED) {
+            throw std::runtime_error("WaveformPack: can't map " + fileName);
+        }
+
+        header = (const WaveformPackHeader *)base;
+        entries = (const WaveformPackEntry *)((const char *)base + sizeof(WaveformPackHeader));
+        samples = (const float *)(entries + header->nTrace);
+
+        std::size_t need = sizeof(WaveformPackHeader) + header->nTrace * sizeof(WaveformPackEntry);
+        if (memcmp(header->magic, "WAVEPACK", 8) != 0 || header->version != 1 || need > mapSize) {
+            munmap(base, mapSize);
+            throw std::runtime_error("WaveformPack: not a version 1 pack: " + fileName);
+        }
+        for (std::size_t i = 0; i < header->nTrace; ++i) {
+            need = std::max(need, (std::size_t)((const char *)(samples + entries[i].offset + entries[i].npts) - (const char *)base));
+            nameToIndex[Name(i)] = i;
+            gcarcToIndex[entries[i].gcarc] = i;
+        }
+        if (need > mapSize) {
+            munmap(base, mapSize);
+            throw std::runtime_error("WaveformPack: truncated file: " + fileName);
+        }
+    }
+
+    WaveformPack(const WaveformPack &) = delete;
+    WaveformPack &operator=(const WaveformPack &) = delete;
+
+    ~WaveformPack() {
+        munmap(base, mapSize);
+    }
+
+    std::size_t Size() const {return header->nTrace;}
+    double GetDelta() const {return header->delta;}
+
+    std::string Name(const std::size_t &i) const {return std::string(entries[i].name, strnlen(entries[i].name, sizeof(entries[i].name)));}
+    double Gcarc(const std::size_t &i) const {return entries[i].gcarc;}
+    double BeginTime(const std::size_t &i) const {return entries[i].beginTime;}
+    std::size_t Npts(const std::size_t &i) const {return entries[i].npts;}
+    const float *Amp(const std::size_t &i) const {return samples + entries[i].offset;}
+
+    // Index of a station, or Size() if not found.
+    std::size_t Find(const std::string &name) const {
+        auto it = nameToIndex.find(name);
+        return (it == nameToIndex.end() ? Size() : it->second);
+    }
+
+    // Index of the first trace with gcarc >= given distance (the last one if none).
+    std::size_t FindByGcarc(const double &gcarc) const {
+        auto it = gcarcToIndex.lower_bound(gcarc);
+        if (it == gcarcToIndex.end()) {
+            it = std::prev(it);
+        }
+        return it->second;
+    }
+
+    EvenSampledSignal Signal(const std::size_t &i) const {
+        return EvenSampledSignal(std::vector<double> (Amp(i), Amp(i) + Npts(i)), GetDelta(), BeginTime(i));
+    }
+
+private:
+
+    void *base = nullptr;
+    std::size_t mapSize = 0;
+    const WaveformPackHeader *header = nullptr;
+    const WaveformPackEntry *entries = nullptr;
+    const float *samples = nullptr;
+    std::map<std::string, std::size_t> nameToIndex;
+    std::map<double, std::size_t> gcarcToIndex;
+};
+
+#endif
@@ -0,0 +1,286 @@
+#ifndef ASU_WORKQUEUE
+#define ASU_WORKQUEUE
+
+#include<algorithm>
+#include<cerrno>
+#include<chrono>
+#include<condition_variable>
+#include<cstdio>
+#include<functional>
+#include<mutex>
+#include<set>
+#include<stdexcept>
+#include<string>
+#include<thread>
+#include<vector>
+
+#include<fcntl.h>
+#include<sys/stat.h>
+#include<unistd.h>
+#include<utime.h>
+
+#include "FileSystem.hpp"
+
+/*************************************************
+ * This C++ class shares a list of work items (e.g.
+ * model names) among worker processes, on one node
+ * or many, through a directory on a filesystem they
+ * all see. There is no server and no lock file:
+ *
+ *   <item>.claim ---- created with O_EXCL; the one worker
+ *                     whose create succeeds owns the item.
+ *   <item>.done  ---- the item's results are stored.
+ *
+ * A heartbeat thread touches the claims a worker
+ * holds (at least) every timeout/4 sec. A claim left
+ * untouched for timeout sec belongs to a worker that
+ * died: the next worker to look renames it away and
+ * claims the item itself. (Two workers reclaiming
+ * the same item at once may both run it; results are
+ * keyed, so the second copy just replaces the first.)
+ * Ages are read off the filesystem's clock, so node
+ * clocks needn't agree.
+ *
+ * Claim()   ---- index of an item this worker now owns, or
+ *                string::npos once a pass over the items finds
+ *                none free.
+ * Done(i)   ---- item i is finished: mark it, drop the claim.
+ * Wait()    ---- after Claim() ran dry: sleep until some item is
+ *                free again (true; Claim() starts a new pass) or
+ *                every item is done (false).
+ * RunOnce   ---- run f in exactly one worker (setup, merge).
+ *                With wait, the others return once it's done;
+ *                without, they return at once. True if f ran here.
+ *
+ * A finished queue stays finished: to run the same
+ * items again, remove the queue directory.
+ *
+ * input(s):
+ * const string &dir            ----  Queue directory (created if needed).
+ * const vector<string> &items  ----  Item names (used in file names).
+ * const double &timeout        ----  Seconds without a heartbeat before a claim is stale.
+ *
+ * Key words: work queue, sharding, multi-process, heartbeat
+*************************************************/
+
+class WorkQueue {
+
+public:
+
+    WorkQueue(const std::string &dir, const std::vector<std::string> &items, const double &timeout = 600) :
+        dir(dir), items(items), timeout(timeout), worker(WorkerId()), done(items.size(), false) {
+
+        MakeDirs(dir);
+        clockFile = dir + "/.clock." + worker;
+        heartbeat = std::thread(&WorkQueue::HeartbeatLoop, this);
+    }
+
+    WorkQueue(const WorkQueue &) = delete;
+    WorkQueue &operator=(const WorkQueue &) = delete;
+
+    // claims still held (items not done) are released, so others can take them at once.
+    ~WorkQueue() {
+        {
+            std::lock_guard<std::mutex> lck(mtx);
+            stopping = true;
+        }
+        cv.notify_all();
+        heartbeat.join();
+        for (const auto &item: held) {
+            remove(ClaimFile(item).c_str());
+        }
+        remove(clockFile.c_str());
+    }
+
+    // "host-pid": names this worker's claims, journals, etc.
+    static std::string WorkerId() {
+        char host[64] = {0};
+        gethostname(host, sizeof(host) - 1);
+        return std::string(host) + "-" + std::to_string((long)getpid());
+    }
+
+    std::size_t Size() const {return items.size();}
+
+    std::size_t Claim() {
+        std::lock_guard<std::mutex> lck(mtx);
+        const double now = Now();
+        for (; cursor < items.size(); ++cursor) {
+            if (!IsDone(cursor) && TryClaim(items[cursor], now)) {
+                return cursor++;
+            }
+        }
+        return std::string::npos;
+    }
+
+    void Done(const std::size_t &i) {
+        std::lock_guard<std::mutex> lck(mtx);
+        MarkDone(items[i]);
+        done[i] = true;
+    }
+
+    bool Wait() {
+
+        while (true) {
+            {
+                std::lock_guard<std::mutex> lck(mtx);
+                const double now = Now();
+                bool finished = true;
+                for (std::size_t i = 0; i < items.size(); ++i) {
+                    if (IsDone(i)) {
+                        continue;
+                    }
+                    finished = false;
+                    struct stat st;
+                    if (held.find(items[i]) == held.end()
+                        && (stat(ClaimFile(items[i]).c_str(), &st) != 0 || now - st.st_mtime >= timeout)) {
+                        cursor = 0;
+                        return true;
+                    }
+                }
+                if (finished) {
+                    return false;
+                }
+            }
+            std::this_thread::sleep_for(Period());
+        }
+    }
+
+    bool RunOnce(const std::string &name, const std::function<void()> &f, const bool &wait = true) {
+
+        const std::string item = "@" + name;
+        while (true) {
+            {
+                std::lock_guard<std::mutex> lck(mtx);
+                struct stat st;
+                if (stat(DoneFile(item).c_str(), &st) == 0) {
+                    return false;
+                }
+                if (TryClaim(item, Now())) {
+                    break;
+                }
+            }
+            if (!wait) {
+                return false;
+            }
+            std::this_thread::sleep_for(Period());
+        }
+
+        try {
+            f();
+        }
+        catch (...) {
+            std::lock_guard<std::mutex> lck(mtx);
+            remove(ClaimFile(item).c_str());
+            held.erase(item);
+            throw;
+        }
+
+        std::lock_guard<std::mutex> lck(mtx);
+        MarkDone(item);
+        return true;
+    }
+
+private:
+
+    const std::string dir;
+    const std::vector<std::string> items;
+    const double timeout;
+    const std::string worker;
+    std::string clockFile;
+
+    std::vector<bool> done;     // known done (done stays done).
+    std::set<std::string> held; // claims this worker holds.
+    std::size_t cursor = 0;
+
+    std::mutex mtx;
+    std::condition_variable cv;
+    std::thread heartbeat;
+    bool stopping = false;
+
+    std::string ClaimFile(const std::string &item) const {return dir + "/" + item + ".claim";}
+    std::string DoneFile(const std::string &item) const {return dir + "/" + item + ".done";}
+
+    std::chrono::milliseconds Period() const {
+        return std::chrono::milliseconds((long)(1000 * std::min(30.0, std::max(0.1, timeout / 4))));
+    }
+
+    // the filesystem's time: touch our own file and read its mtime.
+    double Now() const {
+        const int fd = open(clockFile.c_str(), O_WRONLY | O_CREAT, 0644);
+        struct stat st;
+        if (fd < 0 || close(fd) != 0 || utime(clockFile.c_str(), nullptr) != 0 || stat(clockFile.c_str(), &st) != 0) {
+            throw std::runtime_error("WorkQueue: can't write in " + dir);
+        }
+        return st.st_mtime;
+    }
+
+    bool IsDone(const std::size_t &i) {
+        struct stat st;
+        if (!done[i] && stat(DoneFile(items[i]).c_str(), &st) == 0) {
+            done[i] = true;
+        }
+        return done[i];
+    }
+
+    bool TryClaim(const std::string &item, const double &now) {
+
+        const std::string claimFile = ClaimFile(item);
+        for (int attempt = 0; attempt < 2; ++attempt) {
+
+            const int fd = open(claimFile.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0644);
+            if (fd >= 0) {
+                const std::string s = worker + "\n";
+                const bool ok = (write(fd, s.c_str(), s.size()) == (ssize_t)s.size());
+                close(fd);
+                struct stat st;
+                if (!ok || stat(DoneFile(item).c_str(), &st) == 0) {
+                    // (finished by someone between our done check and the claim.)
+                    remove(claimFile.c_str());
+                    return false;
+                }
+                held.insert(item);
+                return true;
+            }
+            if (errno != EEXIST) {
+                throw std::runtime_error("WorkQueue: can't create " + claimFile);
+            }
+
+            // taken: give up unless the owner stopped heartbeating.
+            struct stat st;
+            if (stat(claimFile.c_str(), &st) == 0) {
+                if (now - st.st_mtime < timeout) {
+                    return false;
+                }
+                const std::string staleFile = claimFile + ".stale." + worker;
+                if (rename(claimFile.c_str(), staleFile.c_str()) != 0) {
+                    return false;
+                }
+                remove(staleFile.c_str());
+            }
+        }
+        return false;
+    }
+
+    // done marker first: a claim is only dropped once the item shows as done.
+    void MarkDone(const std::string &item) {
+        const int fd = open(DoneFile(item).c_str(), O_WRONLY | O_CREAT, 0644);
+        if (fd < 0) {
+            throw std::runtime_error("WorkQueue: can't mark " + item + " done.");
+        }
+        close(fd);
+        remove(ClaimFile(item).c_str());
+        held.erase(item);
+    }
+
+    void HeartbeatLoop() {
+        std::unique_lock<std::mutex> lck(mtx);
+        while (!stopping) {
+            cv.wait_for(lck, Period());
+            for (const auto &item: held) {
+                utime(ClaimFile(item).c_str(), nullptr);
+            }
+        }
+    }
+};
+
+#endif
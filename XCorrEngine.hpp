@@ -0,0 +1,250 @@
+#ifndef ASU_XCORRENGINE
+#define ASU_XCORRENGINE
+
+#include<algorithm>
+#include<cmath>
+#include<limits>
+#include<map>
+#include<memory>
+#include<mutex>
+#include<stdexcept>
+#include<utility>
+#include<vector>
+
+#include<fftw3.h>
+
+#include<EvenSampledSignal.hpp>
+
+#include "FFTWPlanner.hpp"
+
+/*************************************************
+ * This C++ class cross-correlates many traces with
+ * their templates in the frequency domain.
+ *
+ * One pair of FFTW plans (r2c, c2r) is made per
+ * transform length and kept for the life of the
+ * engine, so all traces and all models of a run
+ * share the same plans. Plans are made under the
+ * process-wide FFTW planner lock (FFTWPlanner.hpp)
+ * and executed with the new-array interface, so
+ * one engine can be used by many threads at once.
+ *
+ * tests/XCorrEngineTest checks shifts and ccc
+ * against SACSignals::CrossCorrelation.
+ *
+ * A template shared by all traces (size 1) is
+ * transformed only once per call.
+ *
+ * Shift convention: moving the template later by
+ * "shift" seconds best aligns it with the trace.
+ * The coefficient is normalized by the energy of
+ * both windows.
+ *
+ * input(s):
+ * const vector<EvenSampledSignal> &traces    ----  Traces.
+ * const double &t1, &t2                      ----  Trace window (relative to each trace's time reference).
+ * const vector<EvenSampledSignal> &templates ----  One template per trace, or one for all.
+ * const double &t3, &t4                      ----  Template window.
+ * const double &minShift, &maxShift          ----  Allowed shifts (sec). Default: all overlaps.
+ * const bool &flip                           ----  Also accept negative correlation (match |ccc|).
+ * const bool &refine                         ----  Parabolic sub-sample refinement of the peak (default: whole samples).
+ *
+ * output(s):
+ * pair<vector<double>,vector<double>> ans  ----  {shifts (sec), ccc}, one per trace.
+ *
+ * Key words: cross-correlation, FFT, fftw
+*************************************************/
+
+class XCorrEngine {
+
+public:
+
+    XCorrEngine() = default;
+    XCorrEngine(const XCorrEngine &) = delete;
+    XCorrEngine &operator=(const XCorrEngine &) = delete;
+
+    ~XCorrEngine() {
+        std::lock_guard<std::mutex> lck(FFTWPlannerMutex());
+        for (auto &item: plans) {
+            fftw_destroy_plan(item.second.first);
+            fftw_destroy_plan(item.second.second);
+        }
+    }
+
+    std::pair<std::vector<double>, std::vector<double>>
+    CrossCorrelation(const std::vector<EvenSampledSignal> &traces, const double &t1, const double &t2,
+                     const std::vector<EvenSampledSignal> &templates, const double &t3, const double &t4,
+                     const double &minShift = -std::numeric_limits<double>::infinity(),
+                     const double &maxShift = std::numeric_limits<double>::infinity(),
+                     const bool &flip = false, const bool &refine = false) {
+
+        if (templates.size() != 1 && templates.size() != traces.size()) {
+            throw std::runtime_error("XCorrEngine: template count doesn't match trace count.");
+        }
+
+        std::pair<std::vector<double>, std::vector<double>> ans;
+        if (traces.empty()) {
+            return ans;
+        }
+
+        // cut every window first, so one transform length serves the whole batch.
+        std::vector<Window> a(traces.size()), b(templates.size());
+        std::size_t maxA = 0, maxB = 0;
+        for (std::size_t i = 0; i < traces.size(); ++i) {
+            a[i] = Cut(traces[i], t1, t2);
+            maxA = std::max(maxA, a[i].amp.size());
+        }
+        for (std::size_t i = 0; i < templates.size(); ++i) {
+            b[i] = Cut(templates[i], t3, t4);
+            maxB = std::max(maxB, b[i].amp.size());
+        }
+        if (maxA == 0 || maxB == 0) {
+            throw std::runtime_error("XCorrEngine: empty window.");
+        }
+
+        const int N = GoodSize(maxA + maxB - 1), nc = N / 2 + 1;
+        const auto &plan = GetPlan(N);
+
+        // fftw_malloc'd buffers (SIMD-aligned), freed on every exit path.
+        std::unique_ptr<double, decltype(&fftw_free)> xBuf(fftw_alloc_real(N), &fftw_free), yBuf(fftw_alloc_real(N), &fftw_free);
+        std::unique_ptr<fftw_complex, decltype(&fftw_free)> XBuf(fftw_alloc_complex(nc), &fftw_free), YBuf(fftw_alloc_complex(nc), &fftw_free);
+        double *x = xBuf.get(), *y = yBuf.get();
+        fftw_complex *X = XBuf.get(), *Y = YBuf.get();
+
+        for (std::size_t i = 0; i < traces.size(); ++i) {
+
+            const auto &A = a[i], &B = b[templates.size() == 1 ? 0 : i];
+            const double delta = traces[i].GetDelta();
+
+            // template spectrum (once, if shared).
+            if (i == 0 || templates.size() != 1) {
+                std::fill(y, y + N, 0.0);
+                std::copy(B.amp.begin(), B.amp.end(), y);
+                fftw_execute_dft_r2c(plan.first, y, Y);
+            }
+
+            std::fill(x, x + N, 0.0);
+            std::copy(A.amp.begin(), A.amp.end(), x);
+            fftw_execute_dft_r2c(plan.first, x, X);
+
+            // X * conj(Y) -> c[m] = sum_j a[j+m] * b[j] (lag m at index m, or N+m if negative).
+            for (int k = 0; k < nc; ++k) {
+                double re = X[k][0] * Y[k][0] + X[k][1] * Y[k][1];
+                double im = X[k][1] * Y[k][0] - X[k][0] * Y[k][1];
+                X[k][0] = re;
+                X[k][1] = im;
+            }
+            fftw_execute_dft_c2r(plan.second, X, x);
+
+            const double norm = N * sqrt(A.energy * B.energy);
+            auto at = [&](const long &m){return (norm == 0 ? 0.0 : x[m < 0 ? m + N : m] / norm);};
+
+            // lags allowed by the overlap and the shift limits.
+            const double offset = A.begin - B.begin;
+            long lo = -(long)B.amp.size() + 1, hi = (long)A.amp.size() - 1;
+            lo = (long)std::max((double)lo, ceil((minShift - offset) / delta - 1e-9));
+            hi = (long)std::min((double)hi, floor((maxShift - offset) / delta + 1e-9));
+            if (lo > hi) {
+                throw std::runtime_error("XCorrEngine: no lag satisfies the shift limits.");
+            }
+
+            long best = lo;
+            for (long m = lo; m <= hi; ++m) {
+                if ((flip ? fabs(at(m)) : at(m)) > (flip ? fabs(at(best)) : at(best))) {
+                    best = m;
+                }
+            }
+
+            double lag = best, ccc = at(best);
+            if (refine && best > lo && best < hi) {
+                double l = at(best - 1), c = ccc, r = at(best + 1), d = l - 2 * c + r;
+                if (d != 0) {
+                    double p = 0.5 * (l - r) / d;
+                    if (fabs(p) < 1) {
+                        lag += p;
+                        ccc = c - 0.25 * (l - r) * p;
+                    }
+                }
+            }
+
+            ans.first.push_back(offset + lag * delta);
+            ans.second.push_back(ccc);
+        }
+
+        return ans;
+    }
+
+    // Same template for every trace.
+    std::pair<std::vector<double>, std::vector<double>>
+    CrossCorrelation(const std::vector<EvenSampledSignal> &traces, const double &t1, const double &t2,
+                     const EvenSampledSignal &temp, const double &t3, const double &t4,
+                     const double &minShift = -std::numeric_limits<double>::infinity(),
+                     const double &maxShift = std::numeric_limits<double>::infinity(),
+                     const bool &flip = false, const bool &refine = false) {
+        return CrossCorrelation(traces, t1, t2, std::vector<EvenSampledSignal> {temp}, t3, t4, minShift, maxShift, flip, refine);
+    }
+
+private:
+
+    struct Window {
+        std::vector<double> amp;
+        double begin = 0, energy = 0;
+    };
+
+    std::map<int, std::pair<fftw_plan, fftw_plan>> plans;
+
+    // Samples of s within [t1, t2], and the time of the first one.
+    static Window Cut(const EvenSampledSignal &s, const double &t1, const double &t2) {
+
+        Window ans;
+        const auto &amp = s.GetAmp();
+        const double delta = s.GetDelta(), begin = s.BeginTime();
+
+        long i1 = std::max(0L, (long)ceil((t1 - begin) / delta - 1e-6));
+        long i2 = std::min((long)amp.size() - 1, (long)floor((t2 - begin) / delta + 1e-6));
+
+        ans.begin = begin + i1 * delta;
+        for (long i = i1; i <= i2; ++i) {
+            ans.amp.push_back(amp[i]);
+            ans.energy += amp[i] * amp[i];
+        }
+        return ans;
+    }
+
+    // Smallest 2^a*3^b*5^c*7^d >= n.
+    static int GoodSize(const std::size_t &n) {
+        for (std::size_t m = std::max((std::size_t)2, n); ; ++m) {
+            std::size_t r = m;
+            for (std::size_t p: {2, 3, 5, 7}) {
+                while (r % p == 0) {
+                    r /= p;
+                }
+            }
+            if (r == 1) {
+                return m;
+            }
+        }
+    }
+
+    // The planner isn't thread-safe (across engines too); plans are made once under the process-wide lock.
+    const std::pair<fftw_plan, fftw_plan> &GetPlan(const int &N) {
+
+        std::lock_guard<std::mutex> lck(FFTWPlannerMutex());
+
+        auto it = plans.find(N);
+        if (it != plans.end()) {
+            return it->second;
+        }
+
+        double *x = fftw_alloc_real(N);
+        fftw_complex *X = fftw_alloc_complex(N / 2 + 1);
+        auto p = std::make_pair(fftw_plan_dft_r2c_1d(N, x, X, FFTW_ESTIMATE),
+                                fftw_plan_dft_c2r_1d(N, X, x, FFTW_ESTIMATE));
+        fftw_free(x);
+        fftw_free(X);
+
+        return plans[N] = p;
+    }
+};
+
+#endif
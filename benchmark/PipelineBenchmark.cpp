@@ -0,0 +1,460 @@
+#include<iostream>
+#include<fstream>
+#include<sstream>
+#include<vector>
+#include<map>
+#include<memory>
+#include<chrono>
+#include<functional>
+#include<thread>
+#include<algorithm>
+#include<cmath>
+#include<cstdio>
+
+#include<sys/resource.h>
+
+#include<EvenSampledSignal.hpp>
+#include<GcpDistance.hpp>
+#include<RampFunction.hpp>
+
+#include "SyntheticWaveforms.hpp"
+#include "StretchBank.hpp"
+#include "XCorrEngine.hpp"
+#include "SphereIndex.hpp"
+#include "BinMembership.hpp"
+#include "SignalMatrix.hpp"
+#include "MatrixStack.hpp"
+#include "CalculateCQ.hpp"
+#include "ThreadPool.hpp"
+#include "StageTimer.hpp"
+
+using namespace std;
+
+/*
+
+This code benchmarks the modeling pipeline on synthetic waveforms (SyntheticWaveforms.hpp),
+with no SAC files and no database.
+
+For each benchmark size,
+
+    subtraction ---- per model: make the station traces (stands in for reading the SAC files),
+                     preprocess, fit the S ESW, cross-correlate, strip S and ScS, cut
+                     (as in 0_subtractModels.cpp and readModel of 2_subtractBinStack.cpp).
+    binning     ---- bounce points into bins, radius queries (as in 1_Binning.cpp).
+    data stack  ---- per bin: weights and the weighted data stack (as in makeDataBinStack).
+    model stack ---- per model: all bin stacks as one matrix product.
+    CQ          ---- per bin-model pair.
+    end-to-end  ---- all of the above in one run, models on the thread pool.
+
+Output: throughput of each stage and the peak RSS so far (printed, and written to benchmarkFile).
+If baselineFile exists, each throughput is compared with it and a drop of more than
+regressionTolerance is reported (exit code 1). To make a baseline, copy benchmarkFile.
+
+File I/O and database writes are not included.
+
+*/
+
+// Inputs. ------------------------
+
+struct BenchmarkSize {
+    string name;
+    size_t nModel, nStation, nRecord, nBin;
+};
+
+const vector<BenchmarkSize> sizes{
+    {"small",   4, 451,  2000,  40},
+    {"medium", 16, 451, 10000, 120},
+    {"large",  64, 451, 30000, 250},
+};
+
+const size_t nThread = thread::hardware_concurrency();
+const unsigned seed = 20200212;
+
+const double rawDelta = 0.05, dt = 0.025, sigma = 1.2;   // synthetics are made at rawDelta, preprocessed to dt.
+const double filterCornerLow = 0.033, filterCornerHigh = 0.3;
+const double traceT1 = -50, traceT2 = 100;               // synthetic model traces, S at 0 sec.
+const double distMin = 40, distMax = 85;
+const double lonMin = -99, lonMax = -64, latMin = -5, latMax = 27;
+const double binRadius = 4;
+
+const double distanceCutOff = 70;
+const size_t cntThreshold = 20;
+const double binEdgeWeight = 0.3, snrQuantile = 0.1, compareLen = 10;
+const double weightSigma = sqrt(-1.0 / 2 / log(binEdgeWeight));
+
+// Outputs. ------------------------
+
+const string benchmarkFile = "PipelineBenchmark.result";
+const string baselineFile = "PipelineBenchmark.baseline";
+const double regressionTolerance = 0.15;
+
+// --------------------------------
+
+ThreadPool pool(nThread);
+XCorrEngine xcorr;
+
+struct DataBinStack {
+    vector<pair<size_t,double>> stationWeight; // (station, summed weight of the records using it).
+    bool stacked = false;
+    EvenSampledSignal stack;
+};
+
+struct StageResult {
+    string stage, unit;
+    double items = 0, seconds = 0;
+    long peakRSS = 0;                           // MB.
+};
+
+double wallTime(){
+    return chrono::duration<double>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+long peakRSS(){
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss / 1024;
+}
+
+unique_ptr<SignalMatrix> subtractModel(const size_t &m, const SyntheticWaveforms &gen, const size_t &nStation,
+                                       const EvenSampledSignal &sESW, const StretchBank &sESWBank);
+
+BinMembership makeBins(const SyntheticRecords &records, const size_t &nBin);
+
+DataBinStack makeDataBinStack(const size_t &i, const BinMembership &membership, const map<string,size_t> &recordIndex,
+                              const SyntheticRecords &records, const SignalMatrix &dataWaveform, const map<double,size_t> &gcarcStation);
+
+vector<EvenSampledSignal> stackModel(const SignalMatrix &model, const vector<DataBinStack> &dataSide);
+
+int main(){
+
+    cout << "Threads: " << nThread << endl;
+
+    // The S ESW: the synthetic S pulse (no PREM stack to build it from).
+    const SyntheticWaveforms rawGen(rawDelta, sigma), gen(dt, sigma);
+    mt19937 rng(seed);
+    auto sESW = gen.Trace(-50, 50, {0}, {1}, {1}, 0, rng);
+    sESW.FindPeakAround(0);
+    sESW.ShiftTimeReferenceToPeak();
+    sESW.NormalizeToPeak();
+    const StretchBank sESWBank(sESW);
+
+    vector<pair<string, StageResult>> results;
+
+    for (const auto &size: sizes) {
+
+        cout << "\n---- " << size.name << ": " << size.nModel << " models x " << size.nStation << " stations, "
+             << size.nRecord << " records, " << size.nBin << " bins." << endl;
+
+        vector<StageResult> stages;
+        auto run = [&](const char *stage, const string &unit, const double &items, function<void()> f){
+            StageTimer timer(stage, size.name);
+            const double t = wallTime();
+            f();
+            stages.push_back(StageResult{stage, unit, items, wallTime() - t, peakRSS()});
+        };
+
+
+        // Data set (not timed): geometry and one trace per record, -30 ~ 30 sec, as 2_subtractBinStack reads them.
+        const auto records = MakeSyntheticRecords(size.nRecord, lonMin, lonMax, latMin, latMax, distMin, distMax, seed + 1);
+        SignalMatrix dataWaveform;
+        map<string,size_t> recordIndex;
+        {
+            mt19937 rng(seed + 2);
+            uniform_real_distribution<double> scsAmp(0.2, 0.6), stretch(0.8, 1.4);
+            for (size_t i = 0; i < records.pairname.size(); ++i) {
+                auto trace = gen.Trace(-30, 30, {0}, {scsAmp(rng)}, {stretch(rng)}, 0.1 / records.snr[i], rng);
+                trace.Mask(0, 30);
+                trace.FlipReverseSum(0);
+                dataWaveform.Append(trace);
+                recordIndex[records.pairname[i]] = i;
+            }
+        }
+
+        // station by gcarc, for picking the synthetics of each record.
+        map<double,size_t> gcarcStation;
+        for (size_t s = 0; s < size.nStation; ++s) {
+            gcarcStation[distMin + (size.nStation < 2 ? 0 : (distMax - distMin) * s / (size.nStation - 1))] = s;
+        }
+
+
+        // 1. Per stage.
+        vector<unique_ptr<SignalMatrix>> models(size.nModel);
+        run("subtraction", "traces", size.nModel * size.nStation, [&](){
+            pool.ParallelFor(0, size.nModel, [&](size_t m){
+                models[m] = subtractModel(m, rawGen, size.nStation, sESW, sESWBank);
+            });
+        });
+
+        BinMembership membership;
+        run("binning", "records", size.nRecord, [&](){
+            membership = makeBins(records, size.nBin);
+        });
+
+        vector<DataBinStack> dataSide(membership.NBin());
+        run("data stack", "bins", membership.NBin(), [&](){
+            pool.ParallelFor(0, membership.NBin(), [&](size_t i){
+                dataSide[i] = makeDataBinStack(i, membership, recordIndex, records, dataWaveform, gcarcStation);
+            });
+        });
+
+        size_t nStacked = 0;
+        for (const auto &item: dataSide) {
+            nStacked += item.stacked;
+        }
+        cout << "Bins made: " << membership.NBin() << ", stacked: " << nStacked << endl;
+
+        vector<vector<EvenSampledSignal>> modelStacks(size.nModel);
+        run("model stack", "bin-model pairs", size.nModel * nStacked, [&](){
+            pool.ParallelFor(0, size.nModel, [&](size_t m){
+                modelStacks[m] = stackModel(*models[m], dataSide);
+            });
+        });
+
+        vector<vector<double>> cq(size.nModel, vector<double> (dataSide.size(), NAN));
+        run("CQ", "bin-model pairs", size.nModel * nStacked, [&](){
+            pool.ParallelFor(0, size.nModel, [&](size_t m){
+                for (size_t i = 0; i < dataSide.size(); ++i) {
+                    if (dataSide[i].stacked) {
+                        auto compareResult = CalculateCQ(dataSide[i].stack, modelStacks[m][i], compareLen);
+                        cq[m][i] = compareResult[0] * compareResult[1];
+                    }
+                }
+            });
+        });
+
+        models.clear();
+        modelStacks.clear();
+
+
+        // 2. End-to-end (models are dropped as soon as their CQ is done).
+        run("end-to-end", "bin-model pairs", size.nModel * nStacked, [&](){
+
+            const auto bins = makeBins(records, size.nBin);
+            vector<DataBinStack> binStacks(bins.NBin());
+            pool.ParallelFor(0, bins.NBin(), [&](size_t i){
+                binStacks[i] = makeDataBinStack(i, bins, recordIndex, records, dataWaveform, gcarcStation);
+            });
+
+            pool.ParallelFor(0, size.nModel, [&](size_t m){
+                const auto model = subtractModel(m, rawGen, size.nStation, sESW, sESWBank);
+                const auto stacks = stackModel(*model, binStacks);
+                for (size_t i = 0; i < binStacks.size(); ++i) {
+                    if (binStacks[i].stacked) {
+                        auto compareResult = CalculateCQ(binStacks[i].stack, stacks[i], compareLen);
+                        cq[m][i] = compareResult[0] * compareResult[1];
+                    }
+                }
+            });
+        });
+
+
+        // Report.
+        printf("%-14s %16s %14s %10s %12s\n", "stage", "unit", "items", "time(s)", "peakRSS(MB)");
+        for (const auto &item: stages) {
+            printf("%-14s %16s %14.0f %10.3f %12ld    %.1f %s/s\n", item.stage.c_str(), item.unit.c_str(),
+                   item.items, item.seconds, item.peakRSS, item.items / item.seconds, item.unit.c_str());
+            results.push_back(make_pair(size.name, item));
+        }
+    }
+
+
+    // Save, and compare with the baseline.
+    ofstream fpout(benchmarkFile);
+    for (const auto &item: results) {
+        fpout << item.first << " " << item.second.stage << " " << item.second.items / item.second.seconds << '\n';
+    }
+    fpout.close();
+
+    ifstream fpin(baselineFile);
+    map<pair<string,string>, double> baseline;
+    string line;
+    while (getline(fpin, line)) {
+        // (stage names have spaces: size first, throughput last.)
+        const size_t p = line.find(" "), q = line.find_last_of(" ");
+        if (p != string::npos && q > p) {
+            baseline[make_pair(line.substr(0, p), line.substr(p + 1, q - p - 1))] = stod(line.substr(q + 1));
+        }
+    }
+    fpin.close();
+
+    int ret = 0;
+    if (!baseline.empty()) {
+        cout << "\nCompared with " << baselineFile << ":" << endl;
+        for (const auto &item: results) {
+            auto it = baseline.find(make_pair(item.first, item.second.stage));
+            if (it == baseline.end()) {
+                continue;
+            }
+            const double ratio = item.second.items / item.second.seconds / it->second;
+            const bool slower = (ratio < 1 - regressionTolerance);
+            printf("%-8s %-14s %6.2fx%s\n", item.first.c_str(), item.second.stage.c_str(), ratio, (slower ? "   <-- REGRESSION" : ""));
+            ret |= slower;
+        }
+    }
+
+    WriteStageTrace(); // (if ASU_TRACE is set.)
+
+    return ret;
+}
+
+unique_ptr<SignalMatrix> subtractModel(const size_t &m, const SyntheticWaveforms &gen, const size_t &nStation,
+                                       const EvenSampledSignal &sESW, const StretchBank &sESWBank){
+
+    // synthetics of this model (in place of reading the SAC files).
+    auto model = MakeSyntheticModel(gen, nStation, distMin, distMax, traceT1, traceT2, seed + 100 + m);
+
+    vector<EvenSampledSignal> Data;
+    Data.swap(model.traces);
+    for (auto &trace: Data) {
+        trace.Interpolate(dt);
+        trace.RemoveTrend();
+        trace.HannTaper(20);
+        trace.Butterworth(filterCornerLow, filterCornerHigh);
+    }
+
+    // S: find the peak, fit the S ESW, align, strip.
+    vector<EvenSampledSignal> modifiedToFitS;
+    for (auto &trace: Data) {
+        trace.FindPeakAround(0, 10);
+        trace.ShiftTimeReferenceToPeak();
+        trace.FlipPeakUp();
+        trace.NormalizeToPeak();
+        modifiedToFitS.push_back(sESWBank.FitHalfWidth(trace));
+    }
+    auto SXCTimeShift = xcorr.CrossCorrelation(Data, -10, 10, modifiedToFitS, -10, 10).first;
+
+    // ScS: find the peak, fit the S ESW, strip at the peak; then cut as readModel does.
+    auto ans = unique_ptr<SignalMatrix>(new SignalMatrix());
+    for (size_t i = 0; i < Data.size(); ++i) {
+
+        auto esw = sESW;
+        esw.ShiftTime(SXCTimeShift[i]);
+        auto trace = Data[i] - esw;
+
+        trace.FindPeakAround(model.scsTime[i], 10);
+        trace.ShiftTimeReferenceToPeak();
+        trace.FlipPeakUp();
+        trace.NormalizeToPeak();
+        trace = trace - sESWBank.FitHalfWidth(trace);
+
+        trace.CheckAndCutToWindow(-30, 30);
+        trace.Mask(0, 30);
+        trace.FlipReverseSum(0);
+        ans->Append(trace);
+    }
+    return ans;
+}
+
+BinMembership makeBins(const SyntheticRecords &records, const size_t &nBin){
+
+    // bin centers: a regular grid over the region with about nBin points.
+    const double aspect = (lonMax - lonMin) / (latMax - latMin);
+    const size_t nLon = max((size_t)1, (size_t)ceil(sqrt(nBin * aspect))), nLat = (nBin + nLon - 1) / nLon;
+
+    const SphereIndex bouncePoints(records.lon, records.lat, binRadius);
+    BinMembership ans;
+    int binN = 1;
+
+    for (size_t b = 0; b < nBin; ++b) {
+
+        const double lon = lonMin + (lonMax - lonMin) * (b % nLon + 0.5) / nLon;
+        const double lat = latMin + (latMax - latMin) * (b / nLon + 0.5) / nLat;
+        auto inBin = bouncePoints.Query(lon, lat, binRadius);
+        if (inBin.size() < cntThreshold) {
+            continue;
+        }
+
+        ans.AddBin(binN++, binRadius);
+        for (auto i: inBin) {
+            ans.AddMember(records.pairname[i], GcpDistance(records.lon[i], records.lat[i], lon, lat));
+        }
+    }
+    return ans;
+}
+
+DataBinStack makeDataBinStack(const size_t &i, const BinMembership &membership, const map<string,size_t> &recordIndex,
+                              const SyntheticRecords &records, const SignalMatrix &dataWaveform, const map<double,size_t> &gcarcStation){
+
+    DataBinStack ans;
+    const auto pairnames = membership.Pairnames(i);
+    const auto centerDists = membership.CenterDists(i);
+
+    vector<size_t> rows;
+    vector<double> snr;
+    for (const auto &pn: pairnames) {
+        const size_t r = recordIndex.at(pn);
+        if (records.gcarc[r] < distanceCutOff) {
+            rows.push_back(r);
+            snr.push_back(records.snr[r]);
+        }
+    }
+    auto sorted = snr;
+    sort(sorted.begin(), sorted.end());
+    const double critSNR = (sorted.empty() ? -1 : sorted[(size_t)(sorted.size() * snrQuantile)]);
+
+    vector<double> weight;
+    map<size_t,double> stationWeight;
+    double weightSum = 0;
+    for (size_t j = 0, k = 0; j < pairnames.size(); ++j) {
+
+        const size_t r = recordIndex.at(pairnames[j]);
+        if (records.gcarc[r] >= distanceCutOff) {
+            continue;
+        }
+        weight.push_back(GaussianFunction(centerDists[j] / membership.radius[i], weightSigma, 0) * sqrt(2 * M_PI) * weightSigma);
+        weight.back() *= RampFunction(snr[k++], 0, critSNR);
+        weightSum += weight.back();
+
+        auto it = gcarcStation.lower_bound(records.gcarc[r]);
+        if (it == gcarcStation.end()) {
+            it = prev(it);
+        }
+        stationWeight[it->second] += weight.back();
+    }
+
+    ans.stationWeight.assign(stationWeight.begin(), stationWeight.end());
+    ans.stacked = !(weightSum <= 1 || rows.size() < cntThreshold);
+    if (ans.stacked) {
+        ans.stack = MatrixStack(vector<vector<double>> {weight}, dataWaveform.Select(rows).Window(-29, 30))[0].first;
+        ans.stack.CheckAndCutToWindow(-29, 29);
+    }
+    return ans;
+}
+
+vector<EvenSampledSignal> stackModel(const SignalMatrix &model, const vector<DataBinStack> &dataSide){
+
+    // rows: the stations some bin uses.
+    vector<size_t> stackedBins, rowStation;
+    map<size_t,size_t> stationRow;
+    for (size_t i = 0; i < dataSide.size(); ++i) {
+        if (!dataSide[i].stacked) {
+            continue;
+        }
+        stackedBins.push_back(i);
+        for (const auto &item: dataSide[i].stationWeight) {
+            if (stationRow.find(item.first) == stationRow.end()) {
+                stationRow[item.first] = rowStation.size();
+                rowStation.push_back(item.first);
+            }
+        }
+    }
+
+    vector<EvenSampledSignal> ans(dataSide.size());
+    if (stackedBins.empty()) {
+        return ans;
+    }
+
+    vector<vector<double>> stationWeight(stackedBins.size(), vector<double> (rowStation.size(), 0));
+    for (size_t b = 0; b < stackedBins.size(); ++b) {
+        for (const auto &item: dataSide[stackedBins[b]].stationWeight) {
+            stationWeight[b][stationRow[item.first]] += item.second;
+        }
+    }
+
+    auto stacks = MatrixStack(stationWeight, model.Select(rowStation));
+    for (size_t b = 0; b < stackedBins.size(); ++b) {
+        ans[stackedBins[b]] = stacks[b].first;
+        ans[stackedBins[b]].CheckAndCutToWindow(-29, 29);
+    }
+    return ans;
+}
@@ -3,8 +3,6 @@
 #include<algorithm>
 #include<set>
 
-#include<ShellExecVec.hpp>
-#include<ShellExec.hpp>
 #include<EvenSampledSignal.hpp>
 #include<SACSignals.hpp>
 #include<GMTPlotSignal.hpp>
@@ -12,6 +10,9 @@
 #include<Float2String.hpp>
 #include<GetHomeDir.hpp>
 
+#include "DeconEngine.hpp"
+#include "FileSystem.hpp"
+
 /*
  * Run this code on t039.Cx. - different source depth synthetics.
  *
@@ -42,6 +43,8 @@ const double waterLevel=0.1,sigma=1.27398,deconFilterCornerLow=0.03,dt=0.025;
 
 // --------------------------------------------
 
+DeconEngine decon; // FFTW plans shared by all models.
+
 int main(int argc, char **argv){
 
     auto eqNames=MariaDB::Select("eq from "+infoTable+" group by eq order by eq");
@@ -59,7 +62,7 @@ int main(int argc, char **argv){
         * 1. Read in waveform.               *
         *************************************/
 
-        SACSignals Data(ShellExecVec("ls "+modelFolder+"/*.THT.sac"));
+        SACSignals Data(Glob(modelFolder+"/*.THT.sac"));
 
         Data.SortByGcarc();
         Data.Interpolate(dt);
@@ -207,9 +210,7 @@ int main(int argc, char **argv){
 
 
         // Decon.
-        Data.WaterLevelDecon(deconSource,waterLevel);
-        Data.GaussianBlur(sigma);
-        Data.Butterworth(deconFilterCornerLow,10000);
+        decon.Decon(Data,deconSource,waterLevel,sigma,deconFilterCornerLow); // WaterLevelDecon, GaussianBlur, Butterworth.
 
         Data.FindPeakAround(0,5);
         Data.ShiftTimeReferenceToPeak();
@@ -219,7 +220,7 @@ int main(int argc, char **argv){
 
 
         // Output Deconed waveforms.
-        ShellExec("mkdir -p "+outputDIR2+"/"+eqName);
+        MakeDirs(outputDIR2+"/"+eqName);
         for (size_t i=0;i<dataInfo.NRow();++i) {
             string outfileName=outputDIR2+"/"+eqName+"/"+dataInfo.GetString("stnm")[i]+".trace";
             ofstream fpout(outfileName);
@@ -241,7 +242,7 @@ int main(int argc, char **argv){
         FRS.FindPeakAround(7.5,7.5);
 
         // Output FRS waveforms.
-        ShellExec("mkdir -p "+outputDIR);
+        MakeDirs(outputDIR);
         for (size_t i=0;i<dataInfo.NRow();++i) {
             string outfileName=outputDIR+"/"+eqName+"_"+dataInfo.GetString("stnm")[i]+".frs";
             ofstream fpout(outfileName);
@@ -3,7 +3,6 @@
 #include<algorithm>
 #include<set>
 
-#include<ShellExecVec.hpp>
 #include<ShellExec.hpp>
 #include<EvenSampledSignal.hpp>
 #include<SACSignals.hpp>
@@ -11,6 +10,9 @@
 #include<MariaDB.hpp>
 #include<Float2String.hpp>
 
+#include "DeconEngine.hpp"
+#include "FileSystem.hpp"
+
 /*
  * Run this code on t052.Cx.
  * This will generate a folder containing all cherry picked synthetic traces, deconed and frsed.
@@ -34,13 +36,25 @@ const double filterCornerLow=0.033,filterCornerHigh=0.3;
 const double cutDeconSourceT1=-60,cutDeconSourceT2=60;
 const double cutDeconSignalT1=-120,cutDeconSiganlT2=120;
 const double cutDeconResultT1=-100,cutDeconResultT2=100;
-// const double waterLevel=0.1,sigma=1.69864,deconFilterCornerLow=0.03,dt=0.025; // width=4.
-const double waterLevel=0.1,sigma=1.35891,deconFilterCornerLow=0.03,dt=0.025; // width=3.2.
-// const double waterLevel=0.1,sigma=1.31645,deconFilterCornerLow=0.03,dt=0.025; // width=3.1.
-//const double waterLevel=0.1,sigma=1.27398,deconFilterCornerLow=0.03,dt=0.025; // width=3.
+const double deconFilterCornerLow=0.03,dt=0.025;
+
+// Decon settings, all from the same forward transforms. Results of each go to outputDIR+tag, outputDIR2+tag.
+// The first one is plotted.
+struct Config {
+    string tag;
+    double waterLevel, sigma;
+};
+const vector<Config> configs{
+    {"",0.1,1.35891},          // width=3.2.
+    {"_width4",0.1,1.69864},   // width=4.
+    {"_width3.1",0.1,1.31645}, // width=3.1.
+    {"_width3",0.1,1.27398},   // width=3.
+};
 
 // --------------------------------------------
 
+DeconEngine decon; // FFTW plans and the source spectrum (fixed source) shared by all models.
+
 int main(int argc, char **argv){
 
     /*****************************************
@@ -53,7 +67,7 @@ int main(int argc, char **argv){
     *****************************************/
 
     // read in prem data.
-    SACSignals premData(ShellExecVec("ls "+sourceDataDir+"/*.THT.sac"));
+    SACSignals premData(Glob(sourceDataDir+"/*.THT.sac"));
 
     premData.SortByGcarc();
     premData.Interpolate(dt);
@@ -163,7 +177,7 @@ int main(int argc, char **argv){
         *************************************/
 
 
-        SACSignals Data(ShellExecVec("ls "+modelFolder+"/*.THT.sac"));
+        SACSignals Data(Glob(modelFolder+"/*.THT.sac"));
 
         Data.SortByGcarc();
         Data.Interpolate(dt);
@@ -234,117 +248,124 @@ int main(int argc, char **argv){
         SACSignals beforeDecon;
         if (makePlots) beforeDecon=Data;
 
-        // Decon.
-        Data.WaterLevelDecon(deconSource,waterLevel);
-        Data.GaussianBlur(sigma);
-        Data.Butterworth(deconFilterCornerLow,10000);
+        // Decon: one forward transform per trace, one inverse per setting.
+        vector<DeconSetting> deconSettings;
+        for (const auto &item: configs) {
+            deconSettings.push_back(DeconSetting{item.waterLevel,item.sigma});
+        }
+        auto deconed=decon.Decon(Data,deconSource,deconSettings,deconFilterCornerLow); // WaterLevelDecon, GaussianBlur, Butterworth.
 
-        Data.FindPeakAround(0,5);
-        Data.ShiftTimeReferenceToPeak();
-        Data.FlipPeakUp();
-        Data.NormalizeToPeak();
-        Data.CheckAndCutToWindow(cutDeconResultT1,cutDeconResultT2);
+        for (size_t c=0; c<configs.size(); ++c) {
 
+            Data=deconed[c];
 
+            Data.FindPeakAround(0,5);
+            Data.ShiftTimeReferenceToPeak();
+            Data.FlipPeakUp();
+            Data.NormalizeToPeak();
+            Data.CheckAndCutToWindow(cutDeconResultT1,cutDeconResultT2);
 
-        // Output Deconed waveforms. Cherry-pick happens here.
-        Data.SortByGcarc();
-        ShellExec("mkdir -p "+outputDIR2+"/"+eqName);
-        for (size_t i=0;i<dataInfo.NRow();++i) {
-            string outfileName=outputDIR2+"/"+eqName+"/"+dataInfo.GetString("stnm")[i]+".trace";
-            double dist=dataInfo.GetDouble("gcarc")[i];
-            size_t j=Data.FindByGcarc(dist)[0];
-
-            // Mask SHAXI sS, SS and other traffic phases. (Their side lobes have large amplitude!)
-            // Or strip sS before decon?
-            if ( fabs(Data.GetTravelTimes("ScS")[j]-Data.GetTravelTimes("sS")[j])<30 ||
-                 fabs(Data.GetTravelTimes("ScS")[j]-Data.GetTravelTimes("S")[j])<30  ||
-                 fabs(Data.GetTravelTimes("ScS")[j]-Data.GetTravelTimes("SS")[j])<30 ){
-                ++maskCnt;
-                Data.Mask(-100000,100000,j);
-            }
-                
-            ofstream fpout(outfileName);
-            fpout << Data.GetData()[j];
-            fpout.close();
-        }
 
 
-        /*********
-        * 4. FRS *
-        *********/
+            // Output Deconed waveforms. Cherry-pick happens here.
+            Data.SortByGcarc();
+            MakeDirs(outputDIR2+configs[c].tag+"/"+eqName);
+            for (size_t i=0;i<dataInfo.NRow();++i) {
+                string outfileName=outputDIR2+configs[c].tag+"/"+eqName+"/"+dataInfo.GetString("stnm")[i]+".trace";
+                double dist=dataInfo.GetDouble("gcarc")[i];
+                size_t j=Data.FindByGcarc(dist)[0];
 
-        SACSignals FRS=Data;
-
-        FRS.FlipReverseSum(0);
-        FRS.CheckAndCutToWindow(0,15-dt*0.8);
-
-        // Measure the peak time and amplitude.
-        FRS.FindPeakAround(7.5,7.5);
-        FRS.SortByGcarc();
+                // Mask SHAXI sS, SS and other traffic phases. (Their side lobes have large amplitude!)
+                // Or strip sS before decon?
+                if ( fabs(Data.GetTravelTimes("ScS")[j]-Data.GetTravelTimes("sS")[j])<30 ||
+                     fabs(Data.GetTravelTimes("ScS")[j]-Data.GetTravelTimes("S")[j])<30  ||
+                     fabs(Data.GetTravelTimes("ScS")[j]-Data.GetTravelTimes("SS")[j])<30 ){
+                    if (c==0) ++maskCnt;
+                    Data.Mask(-100000,100000,j);
+                }
+                
+                ofstream fpout(outfileName);
+                fpout << Data.GetData()[j];
+                fpout.close();
+            }
 
-        // Output FRS waveforms.
 
-        ShellExec("mkdir -p "+outputDIR);
-        for (size_t i=0;i<dataInfo.NRow();++i) {
-            string outfileName=outputDIR+"/"+eqName+"_"+dataInfo.GetString("stnm")[i]+".frs";
-            double dist=dataInfo.GetDouble("gcarc")[i];
-            ofstream fpout(outfileName);
-            fpout << FRS.GetData()[FRS.FindByGcarc(dist)[0]];
-            fpout.close();
-        }
+            /*********
+            * 4. FRS *
+            *********/
 
-        // Plot.
-        if (!makePlots) continue;
+            SACSignals FRS=Data;
 
-        string outfile;
+            FRS.FlipReverseSum(0);
+            FRS.CheckAndCutToWindow(0,15-dt*0.8);
 
-        for (size_t i=0; i<dataInfo.NRow(); ++i) {
-            string stnm=dataInfo.GetString("stnm")[i];
-            double dist=dataInfo.GetDouble("gcarc")[i];
+            // Measure the peak time and amplitude.
+            FRS.FindPeakAround(7.5,7.5);
+            FRS.SortByGcarc();
 
-            size_t j=Data.FindByGcarc(dist)[0];
-            double originalDist=Data.GetMData()[j].gcarc;
+            // Output FRS waveforms.
 
-            if (i%17==0) { // A New page.
-                outfile=GMT::BeginEasyPlot(69.5,40);
-                outfiles.push_back(outfile);
-                GMT::MoveReferencePoint(outfile,"-Xf1i -Yf37.2i");
-            }
-            else {
-                GMT::MoveReferencePoint(outfile,"-Y-2.3i");
+            MakeDirs(outputDIR+configs[c].tag);
+            for (size_t i=0;i<dataInfo.NRow();++i) {
+                string outfileName=outputDIR+configs[c].tag+"/"+eqName+"_"+dataInfo.GetString("stnm")[i]+".frs";
+                double dist=dataInfo.GetDouble("gcarc")[i];
+                ofstream fpout(outfileName);
+                fpout << FRS.GetData()[FRS.FindByGcarc(dist)[0]];
+                fpout.close();
             }
 
-            // Plot to verify sESW.
-            GMT::psbasemap(outfile,"-JX13i/2i -R-100/100/-1/1 -Bxa10 -Bya0.5 -BWSne -O -K -Xf1i");
-            GMT::psxy(outfile,vector<double> {-100,100},vector<double> {0,0},"-J -R -W1p,gray,- -O -K");
-            GMT::psxy(outfile,sESW,"-J -R -W1p,yellow -O -K");
-
-            // Plot to verify scsESW.
-            GMT::psbasemap(outfile,"-JX13i/2i -R-100/100/-1/1 -Bxa10 -Bya0.5 -BWSne -O -K -Xf14.5i");
-            GMT::psxy(outfile,vector<double> {-100,100},vector<double> {0,0},"-J -R -W1p,gray,- -O -K");
-            GMT::psxy(outfile,scsESW,"-J -R -W1p,black -O -K");
-
-            // Plot to verify the decon source.
-            GMT::psbasemap(outfile,"-JX13i/2i -R-100/100/-1/1 -Bxa10 -Bya0.5 -BWSne -O -K -Xf28i");
-            GMT::psxy(outfile,vector<double> {-100,100},vector<double> {0,0},"-J -R -W1p,gray,- -O -K");
-            GMT::psxy(outfile,scsESW,"-J -R -W1p,black -O -K");
-            GMT::psxy(outfile,sESW,"-J -R -W1p,yellow -O -K");
-            GMT::psxy(outfile,deconSource,"-J -R -W1p,red -O -K");
-
-            // Plot to verify the stripping.
-            GMT::psbasemap(outfile,"-JX13i/2i -R-100/100/-1/1 -Bxa10 -Bya0.5 -BWSne -O -K -Xf41.5i");
-            GMT::psxy(outfile,beforeStrip,j,"-J -R -W1p,black -O -K");
-            GMT::psxy(outfile,sESW,"-J -R -W1p,yellow -O -K");
-            GMT::psxy(outfile,afterStrip,j,"-J -R -W1p,green -O -K");
-            vector<GMT::Text> texts{GMT::Text(-30,0.9,Float2String(originalDist,2)+" -> "+stnm+"("+Float2String(dist,2)+")",12,"LT")};
-            GMT::pstext(outfile,texts,"-J -R -N -O -K");
-
-            // Plot to verify deconed trace.
-            GMT::psbasemap(outfile,"-JX13i/2i -R-100/100/-1/1 -Bxa10 -Bya0.5 -BWSne -O -K -Xf55i");
-            GMT::psxy(outfile,beforeDecon,j,"-J -R -W1p,black -O -K");
-            GMT::psxy(outfile,deconSource,"-J -R -W1p,red -O -K");
-            GMT::psxy(outfile,Data,j,"-J -R -W1p,purple -O -K");
+            // Plot.
+            if (!makePlots || c!=0) continue;
+
+            string outfile;
+
+            for (size_t i=0; i<dataInfo.NRow(); ++i) {
+                string stnm=dataInfo.GetString("stnm")[i];
+                double dist=dataInfo.GetDouble("gcarc")[i];
+
+                size_t j=Data.FindByGcarc(dist)[0];
+                double originalDist=Data.GetMData()[j].gcarc;
+
+                if (i%17==0) { // A New page.
+                    outfile=GMT::BeginEasyPlot(69.5,40);
+                    outfiles.push_back(outfile);
+                    GMT::MoveReferencePoint(outfile,"-Xf1i -Yf37.2i");
+                }
+                else {
+                    GMT::MoveReferencePoint(outfile,"-Y-2.3i");
+                }
+
+                // Plot to verify sESW.
+                GMT::psbasemap(outfile,"-JX13i/2i -R-100/100/-1/1 -Bxa10 -Bya0.5 -BWSne -O -K -Xf1i");
+                GMT::psxy(outfile,vector<double> {-100,100},vector<double> {0,0},"-J -R -W1p,gray,- -O -K");
+                GMT::psxy(outfile,sESW,"-J -R -W1p,yellow -O -K");
+
+                // Plot to verify scsESW.
+                GMT::psbasemap(outfile,"-JX13i/2i -R-100/100/-1/1 -Bxa10 -Bya0.5 -BWSne -O -K -Xf14.5i");
+                GMT::psxy(outfile,vector<double> {-100,100},vector<double> {0,0},"-J -R -W1p,gray,- -O -K");
+                GMT::psxy(outfile,scsESW,"-J -R -W1p,black -O -K");
+
+                // Plot to verify the decon source.
+                GMT::psbasemap(outfile,"-JX13i/2i -R-100/100/-1/1 -Bxa10 -Bya0.5 -BWSne -O -K -Xf28i");
+                GMT::psxy(outfile,vector<double> {-100,100},vector<double> {0,0},"-J -R -W1p,gray,- -O -K");
+                GMT::psxy(outfile,scsESW,"-J -R -W1p,black -O -K");
+                GMT::psxy(outfile,sESW,"-J -R -W1p,yellow -O -K");
+                GMT::psxy(outfile,deconSource,"-J -R -W1p,red -O -K");
+
+                // Plot to verify the stripping.
+                GMT::psbasemap(outfile,"-JX13i/2i -R-100/100/-1/1 -Bxa10 -Bya0.5 -BWSne -O -K -Xf41.5i");
+                GMT::psxy(outfile,beforeStrip,j,"-J -R -W1p,black -O -K");
+                GMT::psxy(outfile,sESW,"-J -R -W1p,yellow -O -K");
+                GMT::psxy(outfile,afterStrip,j,"-J -R -W1p,green -O -K");
+                vector<GMT::Text> texts{GMT::Text(-30,0.9,Float2String(originalDist,2)+" -> "+stnm+"("+Float2String(dist,2)+")",12,"LT")};
+                GMT::pstext(outfile,texts,"-J -R -N -O -K");
+
+                // Plot to verify deconed trace.
+                GMT::psbasemap(outfile,"-JX13i/2i -R-100/100/-1/1 -Bxa10 -Bya0.5 -BWSne -O -K -Xf55i");
+                GMT::psxy(outfile,beforeDecon,j,"-J -R -W1p,black -O -K");
+                GMT::psxy(outfile,deconSource,"-J -R -W1p,red -O -K");
+                GMT::psxy(outfile,Data,j,"-J -R -W1p,purple -O -K");
+            }
         }
 
     }
@@ -354,7 +375,9 @@ int main(int argc, char **argv){
 
     for (auto file: outfiles) {
         GMT::SealPlot(file);
-        ShellExec("cat "+file+" >> tmp.ps");
+    }
+    Concatenate(outfiles, "tmp.ps");
+    for (auto file: outfiles) {
         remove(file.c_str());
     }
     string pdffile=__FILE__;
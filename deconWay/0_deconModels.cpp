@@ -1,15 +1,11 @@
 #include<iostream>
 #include<vector>
-#include<queue>
 #include<thread>
-#include<atomic>
+#include<future>
 #include<algorithm>
 #include<mutex>
-#include<condition_variable>
 
 
-#include<ShellExecVec.hpp>
-#include<ShellExec.hpp>
 #include<EvenSampledSignal.hpp>
 #include<SACSignals.hpp>
 #include<GMTPlotSignal.hpp>
@@ -17,6 +13,15 @@
 #include<Float2String.hpp>
 #include<GetHomeDir.hpp>
 
+#include "ThreadPool.hpp"
+#include "ESWCache.hpp"
+#include "DeconEngine.hpp"
+#include "Prefetcher.hpp"
+#include "XCorrEngine.hpp"
+#include "StretchBank.hpp"
+#include "ResultsWriter.hpp"
+#include "FileSystem.hpp"
+
 /**********************************************************************************************************
  *
  * Run this code on t039.PREM or t039.ULVZ or t039.UHVZ
@@ -29,9 +34,8 @@
 
 using namespace std;
 
-mutex mtx;
-condition_variable cv;
-queue<size_t> emptySlot;
+mutex mtx;   // console output.
+mutex dbMtx; // MariaDB calls only (the results writers).
 
 // Inputs. ------------------------------------
 
@@ -40,7 +44,8 @@ const string homeDir=GetHomeDir();
 const string synDataDir=homeDir+"/PROJ/t039.Lamella";
 const size_t beginIndex=1279, endIndex=1279, TraceCnt=451; // [beginIndex, endIndex] inclusive.
 
-const size_t nThread=5;
+const size_t nThread=thread::hardware_concurrency();
+const size_t nPrefetch=8, nReader=2; // models read ahead of the workers, reader threads.
 const bool reCreateTable=false;
 
 const bool makePlots=true;
@@ -52,114 +57,76 @@ const double cutBeforeDeconT1=-120, cutBeforeDeconT2=120;
 const double cutDeconResultT1=-50, cutDeconResultT2=50;
 const double waterLevel=0.1, sigma=1.27398, deconFilterCornerLow=0.03, dt=0.025;
 const string premDataDir=homeDir+"/PROJ/t039.PREM/201500000000";
+const string eswCacheDir=homeDir+"/PROJ/t041.ESWCache";
+const bool useStretchBank=false; // fit sESW to half-widths from a bank of pre-stretched copies (quantized, see StretchBank.hpp).
 
 
 // Outputs. ------------------------------------
 
 const string dirPrefix=homeDir+"/PROJ/t041.REFL_Lamella";
 const string outputDB="REFL_Lamella", outputTable="Decon";
+const string resultsStore=homeDir+"/PROJ/ResultsStore"; // file-backed copy of every output table.
+const bool writeDatabase=true;                          // false: results go to resultsStore only.
 
 
 // --------------------------------------------
 
-void processThis(const size_t Index, int mySlot, const EvenSampledSignal &sESW);
+ThreadPool pool(nThread);
+XCorrEngine xcorr; // FFTW plans shared by all models.
+DeconEngine decon; // FFTW plans shared by all models.
+ResultsWriter writer(outputDB, outputTable, {"eq", "pairname", "gcarc", "FRSAmp", "FRSTime", "ScSFRSed", "ScSDeconed", "dirPrefix"}, &dbMtx, resultsStore, writeDatabase);
+
+void processThis(const size_t Index, SACSignals Data, const EvenSampledSignal &sESW, const StretchBank &sESWBank);
 
 int main(){
 
+    // Library calls on the pool may plan FFTs too (the engines' own planning is locked in FFTWPlanner.hpp).
+    fftw_make_planner_thread_safe();
+
     // Update table.
     if (reCreateTable) {
-        MariaDB::Query("drop table if exists "+outputDB+"."+outputTable);
-        MariaDB::Query("create table "+outputDB+"."+outputTable+" (PairName varchar(30) not null unique primary key, EQ varchar(20), Gcarc double, FRSAmp double, FRSTime double, ScSFRSed varchar(200), ScSDeconed varchar(200), dirPrefix varchar(200))");
-    }
-
-
-    // Make ESW one time.
-
-    /***********************************
-    * 1. Read in PREM S waveform.      *
-    ***********************************/
-
-    SACSignals sESWData;
 
-    sESWData=SACSignals (ShellExecVec("ls "+premDataDir+"/*.THT.sac"));
-
-    if (sESWData.Size() != TraceCnt) {
-        throw runtime_error("Reading error: PREM.");
+        DropResultsTable(resultsStore, outputDB+"."+outputTable);
+        if (writeDatabase) {
+            MariaDB::Query("drop table if exists "+outputDB+"."+outputTable);
+            MariaDB::Query("create table "+outputDB+"."+outputTable+" (PairName varchar(30) not null unique primary key, EQ varchar(20), Gcarc double, FRSAmp double, FRSTime double, ScSFRSed varchar(200), ScSDeconed varchar(200), dirPrefix varchar(200))");
+        }
     }
 
 
-    sESWData.SortByGcarc();
-    sESWData.Interpolate(dt);
-    sESWData.RemoveTrend();
-    sESWData.HannTaper(20);
-    sESWData.Butterworth(filterCornerLow,filterCornerHigh);
-
-
-    // find S peak and shift time reference to the peak.
-    sESWData.FindPeakAround(sESWData.GetTravelTimes("S"),10);
-    sESWData.ShiftTimeReferenceToPeak();
-    sESWData.FlipPeakUp();
-    sESWData.NormalizeToPeak();
-
-    /********************************************
-    *
-    * 2. Make S ESW stack from PREM.
-    *
-    *******************************************/
+    // Make ESW one time (or load it from the cache, if PREM and the parameters are unchanged).
 
-    sESWData.CheckAndCutToWindow(cutDeconSourceT1-10,cutDeconSourceT2+10);
+    const auto sESW = CachedSESW(eswCacheDir, premDataDir, TraceCnt, dt, filterCornerLow, filterCornerHigh, cutDeconSourceT1, cutDeconSourceT2);
+    const StretchBank sESWBank(sESW, useStretchBank); // half-width fit of sESW (with the bank: stretched once over a grid of factors), shared by all models.
 
-    auto sESW=sESWData.XCorrStack(0,-15,15,2).second.first;
-    sESW.FindPeakAround(0,10);
-    sESW.ShiftTimeReferenceToPeak();
-    sESW.CheckAndCutToWindow(cutDeconSourceT1, cutDeconSourceT2);
-    sESW.FlipPeakUp();
-    sESW.NormalizeToPeak();
-    sESW.HannTaper(20);
 
+    // Reader stage: keep the next few models loading in the background.
 
-    // Optional: make S ESW again, this time, stretch/shrink each S to match S ESW, then stack.
+    Prefetcher<SACSignals> reader(endIndex-beginIndex+1, [](const size_t &Index){
+        const string modelFolder=synDataDir+"/"+to_string(201500000000+beginIndex+Index);
+        return SACSignals (Glob(modelFolder+"/*.THT.sac"));
+    }, nPrefetch, nReader);
 
-    sESWData.StretchToFit(sESW,-13,13,-0.3,0.3,0.25,true); // stretch, then compare waveform Amp_WinDiff.
 
-    sESW=sESWData.XCorrStack(0,-15,15,2).second.first;
-    sESW.FindPeakAround(0,10);
-    sESW.ShiftTimeReferenceToPeak();
-    sESW.CheckAndCutToWindow(cutDeconSourceT1, cutDeconSourceT2);
-    sESW.FlipPeakUp();
-    sESW.NormalizeToPeak();
-    sESW.HannTaper(20);
-
-
-    // Run the threads.
-
-    vector<thread> allThreads(nThread);
-    for (size_t i=0; i<nThread; ++i) {
-        emptySlot.push(i);
-    }
+    // Run the tasks.
 
+    vector<future<void>> allTasks;
     for (size_t Index=0; Index<endIndex-beginIndex+1; ++Index) {
-        unique_lock<mutex> lck(mtx);
-        while (emptySlot.empty()) {
-            cv.wait(lck);
-        }
-        if (allThreads[emptySlot.front()].joinable()) {
-            allThreads[emptySlot.front()].join();
-        }
-        allThreads[emptySlot.front()] = thread(processThis, Index, emptySlot.front(), cref(sESW));
-        emptySlot.pop();
+        allTasks.push_back(pool.Submit([&sESW, &sESWBank, &reader](){
+            auto item=reader.Next();
+            processThis(item.first, move(item.second), sESW, sESWBank);
+        }));
     }
 
-    for (auto &item: allThreads) {
-        if (item.joinable()){
-            item.join();
-        }
+    for (auto &item: allTasks) {
+        item.get();
     }
+    writer.Flush();
 
     return 0;
 }
 
-void processThis(const size_t Index, int mySlot, const EvenSampledSignal &sESW){
+void processThis(const size_t Index, SACSignals Data, const EvenSampledSignal &sESW, const StretchBank &sESWBank){
 
 
     /*************************************************
@@ -172,24 +139,18 @@ void processThis(const size_t Index, int mySlot, const EvenSampledSignal &sESW){
     * 6. UpdateTables. (Optional)                    *
     *************************************************/
 
-    unique_lock<mutex> lck(mtx);
     const string modelName=to_string(201500000000+beginIndex+Index);
 
-    // Properly modify the S ESW to look like ScS ESW: make the decon source.
+    unique_lock<mutex> lck(mtx);
     cout << "Processing synthetics: " << modelName << " ... " << endl;
+    lck.unlock();
 
 
     /*************************************
-    * 1. Read in synthetic S waveform.   *
+    * 1. Synthetic S waveform            *
+    *    (read in by the reader stage).  *
     *************************************/
 
-    const string modelFolder=synDataDir+"/"+modelName;
-
-    SACSignals Data;
-
-    Data=SACSignals (ShellExecVec("ls "+modelFolder+"/*.THT.sac"));
-    lck.unlock();
-
     if(Data.Size() != TraceCnt) {
         throw runtime_error("Reading error: "+modelName);
     }
@@ -262,10 +223,10 @@ void processThis(const size_t Index, int mySlot, const EvenSampledSignal &sESW){
     vector<EvenSampledSignal> stripSources;
     for (size_t i=0; i<Data.Size(); ++i) {
         // stripSources.push_back(sESW);
-        stripSources.push_back(sESW.StretchToFitHalfWidth(Data.GetData()[i])); // stretch to fit the half-width.
+        stripSources.push_back(sESWBank.FitHalfWidth(Data.GetData()[i])); // stretch to fit the half-width.
     }
 
-    auto XCTimeShift=Data.CrossCorrelation(-15,15,stripSources,-15,15).first;
+    auto XCTimeShift=xcorr.CrossCorrelation(Data.GetData(),-15,15,stripSources,-15,15).first;
     Data.StripSignal(stripSources,XCTimeShift);
 
     // For plotting, need to explicitely shift it.
@@ -296,10 +257,7 @@ void processThis(const size_t Index, int mySlot, const EvenSampledSignal &sESW){
     }
 
     // Decon.
-    fftw_make_planner_thread_safe();
-    Data.WaterLevelDecon(deconSource,waterLevel);
-    Data.GaussianBlur(sigma);
-    Data.Butterworth(deconFilterCornerLow,10000);
+    decon.Decon(Data,deconSource,waterLevel,sigma,deconFilterCornerLow); // WaterLevelDecon, GaussianBlur, Butterworth.
 
     Data.FindPeakAround(0,10);
     Data.ShiftTimeReferenceToPeak();
@@ -309,7 +267,7 @@ void processThis(const size_t Index, int mySlot, const EvenSampledSignal &sESW){
 
 
     // Output Decon waveforms.
-    ShellExec("mkdir -p "+dirPrefix+"/Decon/"+modelName);
+    MakeDirs(dirPrefix+"/Decon/"+modelName);
     Data.DumpWaveforms(dirPrefix+"/Decon/"+modelName,"StationName","","","trace");
 
     if (makePlots && beginIndex+Index==plotIndex) {
@@ -329,7 +287,7 @@ void processThis(const size_t Index, int mySlot, const EvenSampledSignal &sESW){
     Data.FindPeakAround(7.5,7.5);
 
     // Output FRS waveforms.
-    ShellExec("mkdir -p "+dirPrefix+"/DeconFRS/"+modelName);
+    MakeDirs(dirPrefix+"/DeconFRS/"+modelName);
     Data.DumpWaveforms(dirPrefix+"/DeconFRS/"+modelName,"StationName","","","frs");
 
     // Make plots.
@@ -409,14 +367,12 @@ void processThis(const size_t Index, int mySlot, const EvenSampledSignal &sESW){
         GMT::ps2pdf(outfile,__FILE__);
     }
 
-    // Finished. Update database and notify the main thread to continue;
-    lck.lock();
-
+    // Finished. Update database (queued; the writer thread batches the loads).
     auto stationNames=Data.GetStationNames();
     auto gcarcs=Data.GetDistances();
     auto peakAmps=Data.PeakAmp();
     auto peakTimes=Data.PeakTime();
-    vector<vector<string>> sqlData(8,vector<string> ());
+    vector<vector<ResultsCell>> sqlData(8,vector<ResultsCell> ());
     for (size_t i=0; i<Data.Size(); ++i) {
         sqlData[0].push_back(modelName);
         sqlData[1].push_back(modelName+"_"+stationNames[i]);
@@ -427,10 +383,7 @@ void processThis(const size_t Index, int mySlot, const EvenSampledSignal &sESW){
         sqlData[6].push_back("Decon/"+modelName+"/"+stationNames[i]+".trace");
         sqlData[7].push_back(dirPrefix);
     }
-    MariaDB::LoadData(outputDB,outputTable,vector<string> {"eq", "pairname", "gcarc", "FRSAmp", "FRSTime", "ScSFRSed", "ScSDeconed", "dirPrefix"},sqlData);
-
-    emptySlot.push(mySlot);
-    cv.notify_one();
+    writer.Push(move(sqlData));
 
     return;
 }
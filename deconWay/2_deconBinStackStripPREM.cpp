@@ -1,25 +1,25 @@
 #include <iostream>
 #include <map>
-#include <queue>
 #include <thread>
-#include <atomic>
+#include <future>
 #include <mutex>
-#include <condition_variable>
 
 #include <MariaDB.hpp>
 #include <EvenSampledSignal.hpp>
-#include <ShellExec.hpp>
 #include <PNormErr.hpp>
 #include <RampFunction.hpp>
 #include <GetHomeDir.hpp>
 
 #include "CalculateCQ.hpp"
+#include "ThreadPool.hpp"
+#include "BinMembership.hpp"
+#include "ResultsWriter.hpp"
+#include "FileSystem.hpp"
 
 using namespace std;
 
-mutex mtx;
-condition_variable cv;
-queue<size_t> emptySlot;
+mutex mtx;   // console output.
+mutex dbMtx; // MariaDB calls from worker threads (results writers, model reads).
 
 /*
 
@@ -51,7 +51,7 @@ const string targetModelType="Lamella";         // "PREM" or "ULVZ" or "UHVZ" or
 const size_t beginIndex=1, endIndex=1;
 const bool reCreateTable=false;
 
-const size_t nThread=5;
+const size_t nThread=thread::hardware_concurrency();
 
 const size_t cntThreshold=20;
 const double binEdgeWeight=0.3, snrQuantile=0.1, compareLen=15;
@@ -59,8 +59,8 @@ double weightSigma=sqrt(-1.0/2/log(binEdgeWeight));
 
 const string homeDir=GetHomeDir();
 const string dataTable="gen2CA_D.Master_a14";
-const string binTable="gen2CA_D.Bins";
-const string binCenterDistTable="gen2CA_D.CenterDists";
+const string binMembershipFile=homeDir+"/PROJ/t013.ScS_NextGen/BinMembership.bin"; // written by 1_Binning,
+const string binTable="gen2CA_D.Bins", binMemberTable="gen2CA_D.BinMembers";       // or made from these if it's missing.
 const string propertyTable="gen2CA_D.Properties";
 const string premTable="REFL_PREM.Decon";
 const string ulvzTable="REFL_ULVZ.Decon";
@@ -72,13 +72,20 @@ const string lamellaTable="REFL_Lamella.Decon";
 const string outputDB="gen2CA_D";
 const string outputTable="ModelingResult_Decon";
 const string dirPrefix=homeDir+"/PROJ/t013.ScS_NextGen/Decon";
+const string resultsStore=homeDir+"/PROJ/ResultsStore"; // file-backed copy of every output table.
+const bool writeDatabase=true;                          // false: results go to resultsStore only.
 
 
 // --------------------------------
 
+ThreadPool pool(nThread);
+ResultsWriter writer(outputDB, outputTable,
+                     {"pairname", "bin", "modelName", "CQ", "CQ2","stackTraceCnt", "weightSum", "dataAlterFactor", "modelAlterFactor", "dataStack", "modelStack", "premStack", "dataStackStd", "modelStackStd", "premStackStd", "dataAlteredPremStack", "modelAlteredPremStack", "premStrippedDataStack", "premStrippedModelStack", "dataFR", "modelFR", "dirPrefix"},
+                     &dbMtx, resultsStore, writeDatabase);
+
 pair<EvenSampledSignal,double> matchHalfHeightWidth(const EvenSampledSignal &target, const EvenSampledSignal &varying);
 
-void modelThese(size_t num, size_t mySlot,
+void modelThese(size_t num,
 
                 const string &modelName, const map<string, double> &criticalDistance,
                 const vector<EvenSampledSignal> &dataWaveform, const map<string,size_t> &dataPairNameToIndex,
@@ -87,14 +94,18 @@ void modelThese(size_t num, size_t mySlot,
                 const vector<vector<double>> &dataBinCenterDists, const vector<vector<double>> &dataBinGcarc,
                 const vector<vector<double>> &dataBinSNR,
                 const vector<double> &binRadius,
-                const vector<EvenSampledSignal> &premWaveform, const map<string,size_t> premPairNameToIndex);
+                const vector<EvenSampledSignal> &premWaveform, const map<string,size_t> &premPairNameToIndex);
 
 int main(){
 
     // Update table.
     if (reCreateTable) {
-        MariaDB::Query("drop table if exists "+outputDB+"."+outputTable);
-        MariaDB::Query("create table "+outputDB+"."+outputTable+" (pairname varchar(40) not null unique primary key, bin integer, modelName varchar(30), CQ double, CQ2 double comment \"Should be this?\", stackTraceCnt integer, weightSum double, dataAlterFactor double, modelAlterFactor double, dataStack varchar(200), modelStack varchar(200), premStack varchar(200), dataStackStd varchar(200), modelStackStd varchar(200), premStackStd varchar(200), dataAlteredPremStack varchar(200), modelAlteredPremStack varchar(200), premStrippedDataStack varchar(200), premStrippedModelStack varchar(200), dataFR varchar(200), modelFR varchar(200), dirPrefix varchar(200), index (bin), index(cq))");
+
+        DropResultsTable(resultsStore, outputDB+"."+outputTable);
+        if (writeDatabase) {
+            MariaDB::Query("drop table if exists "+outputDB+"."+outputTable);
+            MariaDB::Query("create table "+outputDB+"."+outputTable+" (pairname varchar(40) not null unique primary key, bin integer, modelName varchar(30), CQ double, CQ2 double comment \"Should be this?\", stackTraceCnt integer, weightSum double, dataAlterFactor double, modelAlterFactor double, dataStack varchar(200), modelStack varchar(200), premStack varchar(200), dataStackStd varchar(200), modelStackStd varchar(200), premStackStd varchar(200), dataAlteredPremStack varchar(200), modelAlteredPremStack varchar(200), premStrippedDataStack varchar(200), premStrippedModelStack varchar(200), dataFR varchar(200), modelFR varchar(200), dirPrefix varchar(200), index (bin), index(cq))");
+        }
     }
 
 
@@ -159,19 +170,17 @@ int main(){
     // Get data distance to bin center for each bin.
     // Get bin radius for each bin.
     // Get the gcarc distances in each bin.
-    auto binInfo=MariaDB::Select("bin, radius from "+binTable);
+    // (all from the membership file written by 1_Binning, in one read; made from the tables if it's missing.)
+    const auto membership=LoadBinMembership(binMembershipFile, binTable, binMemberTable);
 
     vector<vector<string>> binPairnames;
     vector<vector<double>> dataBinCenterDists, dataBinGcarc, dataBinSNR;
-    vector<double> binRadius;
+    const vector<double> &binRadius=membership.radius;
 
-    for (size_t i=0; i<binInfo.NRow(); ++i) {
-        const string binN=to_string(binInfo.GetInt("bin")[i]);
-        auto binDataInfo=MariaDB::Select("pairname, dist_"+binN+" as centerDist from "+binCenterDistTable+" where dist_"+binN+">=0");
+    for (size_t i=0; i<membership.NBin(); ++i) {
 
-        binPairnames.push_back(binDataInfo.GetString("pairname"));
-        dataBinCenterDists.push_back(binDataInfo.GetDouble("centerDist"));
-        binRadius.push_back(binInfo.GetDouble("radius")[i]);
+        binPairnames.push_back(membership.Pairnames(i));
+        dataBinCenterDists.push_back(membership.CenterDists(i));
 
         dataBinGcarc.push_back(vector<double> ());
         dataBinSNR.push_back(vector<double> ());
@@ -199,43 +208,32 @@ int main(){
 
     // Start modeling.
     // For each model, for each bin, do modeling.
-    vector<thread> allThreads(nThread);
-    for (size_t i=0; i<nThread; ++i) {
-        emptySlot.push(i);
-    }
+    vector<future<void>> allTasks;
 
     for (size_t runThisModel=0; runThisModel<modelNames.size(); ++runThisModel){
 
-        unique_lock<mutex> lck(mtx);
-        while (emptySlot.empty()) {
-            cv.wait(lck);
-        }
-        if (allThreads[emptySlot.front()].joinable()) {
-            allThreads[emptySlot.front()].join();
-        }
-        allThreads[emptySlot.front()] = thread(modelThese, runThisModel, emptySlot.front(),
-
-                                               cref(modelNames[runThisModel]), cref(criticalDistance),
-                                               cref(dataWaveform), cref(dataPairNameToIndex),
-                                               cref(gcarcSTNM),
-                                               cref(binPairnames),
-                                               cref(dataBinCenterDists), cref(dataBinGcarc), cref(dataBinSNR),
-                                               cref(binRadius),
-                                               cref(premWaveform), cref(premPairNameToIndex));
-
-        emptySlot.pop();
+        allTasks.push_back(pool.Submit([&, runThisModel](){
+
+            modelThese(runThisModel,
+                       modelNames[runThisModel], criticalDistance,
+                       dataWaveform, dataPairNameToIndex,
+                       gcarcSTNM,
+                       binPairnames,
+                       dataBinCenterDists, dataBinGcarc, dataBinSNR,
+                       binRadius,
+                       premWaveform, premPairNameToIndex);
+        }));
     }
 
-    for (auto &item: allThreads) {
-        if (item.joinable()){
-            item.join();
-        }
+    for (auto &item: allTasks) {
+        item.get();
     }
+    writer.Flush();
 
     return 0;
 }
 
-void modelThese(size_t num, size_t mySlot,
+void modelThese(size_t num,
 
                 const string &modelName, const map<string, double> &criticalDistance,
                 const vector<EvenSampledSignal> &dataWaveform, const map<string,size_t> &dataPairNameToIndex,
@@ -244,7 +242,7 @@ void modelThese(size_t num, size_t mySlot,
                 const vector<vector<double>> &dataBinCenterDists, const vector<vector<double>> &dataBinGcarc,
                 const vector<vector<double>> &dataBinSNR,
                 const vector<double> &binRadius,
-                const vector<EvenSampledSignal> &premWaveform, const map<string,size_t> premPairNameToIndex){
+                const vector<EvenSampledSignal> &premWaveform, const map<string,size_t> &premPairNameToIndex){
 
 
     // total reflection distance for this model.
@@ -256,7 +254,9 @@ void modelThese(size_t num, size_t mySlot,
 
     unique_lock<mutex> lck(mtx);
     cout << "Modeling against " << modelName << ", Num: " << num << " ... " << endl;
+    unique_lock<mutex> dbLck(dbMtx);
     auto modelInfo=MariaDB::Select("pairname, concat(dirPrefix,'/',ScSDeconed) as fn from "+modelTable+" where eq="+modelEQ);
+    dbLck.unlock();
 
     // Read in model waveforms, cut to -30 ~ 30 sec.
     vector<EvenSampledSignal> modelWaveform;
@@ -278,7 +278,7 @@ cout << "Data corrupted: " << modelType << " " << modelEQ <<  " " << modelInfo.G
     lck.unlock();
 
 
-    // Model each bin.
+    // Model each bin (bins run as subtasks on the pool).
 
 
     vector<double> weightSum(binRadius.size(),0), stackTraceCnt = weightSum, dataAlterFactor = weightSum, modelAlterFactor = weightSum, cqResult(binRadius.size(), 0.0/0.0), cqResult2 = cqResult;
@@ -287,7 +287,7 @@ cout << "Data corrupted: " << modelType << " " << modelEQ <<  " " << modelInfo.G
     vector<string> dataAlteredPremStackFilename(binRadius.size()), modelAlteredPremStackFilename(binRadius.size());
     vector<string> premStrippedDataStackFileName(binRadius.size()), premStrippedModelStackFileName(binRadius.size()), dataFRFileName(binRadius.size()), modelFRFileName(binRadius.size());
 
-    for (size_t i=0; i<binRadius.size(); ++i) {
+    pool.ParallelFor(0, binRadius.size(), [&](size_t i){
 
         const string binN=to_string(i+1);
 
@@ -322,7 +322,7 @@ cout << "Data corrupted: " << modelType << " " << modelEQ <<  " " << modelInfo.G
             }
             string stnm=it->second;
             binPremWaveform.push_back(premWaveform[premPairNameToIndex.at("201500000000_"+stnm)]);
-            binModelWaveform.push_back(modelWaveform[modelPairNameToIndex[modelEQ+"_"+stnm]]);
+            binModelWaveform.push_back(modelWaveform[modelPairNameToIndex.at(modelEQ+"_"+stnm)]);
 
 
             // Get weights.
@@ -338,7 +338,7 @@ cout << "Data corrupted: " << modelType << " " << modelEQ <<  " " << modelInfo.G
         weightSum[i]=accumulate(binStackWeight.begin(),binStackWeight.end(),0.0);
 
         if (weightSum[i] <= 1 || binDataWaveform.size() < cntThreshold) {
-            continue;
+            return;
         }
         stackTraceCnt[i]=binDataWaveform.size();
 
@@ -392,16 +392,15 @@ cout << "Data corrupted: " << modelType << " " << modelEQ <<  " " << modelInfo.G
         alteredDataPREM.CheckAndCutToWindow(-29,29);
 
         // Output to files.
-        ShellExec("mkdir -p "+dirPrefix+"/dataStack/"+modelName+" "
-                             +dirPrefix+"/modelStack/"+modelName+" "
-                             +dirPrefix+"/premStack/"+modelName+" "
-                             +dirPrefix+"/modelAlteredPremStack/"+modelName+" "
-                             +dirPrefix+"/dataAlteredPremStack/"+modelName+" "
-                             +dirPrefix+"/premStrippedDataStack/"+modelName+" "
-                             +dirPrefix+"/premStrippedModelStack/"+modelName+" "
-                             +dirPrefix+"/dataFR/"+modelName+" "
-                             +dirPrefix+"/modelFR/"+modelName+" "
-                 );
+        MakeDirs(vector<string> {dirPrefix+"/dataStack/"+modelName,
+                                 dirPrefix+"/modelStack/"+modelName,
+                                 dirPrefix+"/premStack/"+modelName,
+                                 dirPrefix+"/modelAlteredPremStack/"+modelName,
+                                 dirPrefix+"/dataAlteredPremStack/"+modelName,
+                                 dirPrefix+"/premStrippedDataStack/"+modelName,
+                                 dirPrefix+"/premStrippedModelStack/"+modelName,
+                                 dirPrefix+"/dataFR/"+modelName,
+                                 dirPrefix+"/modelFR/"+modelName});
 
 
         dataStackFilename[i]="dataStack/"+modelName+"/"+binN+".signal";
@@ -457,44 +456,38 @@ cout << "Data corrupted: " << modelType << " " << modelEQ <<  " " << modelInfo.G
         cqResult[i] = compareResult[0] * compareResult[1];
         cqResult2[i] = compareResult[0] * compareResult[2];
 
-    }
-
-    // Update table.
+    });
 
-    lck.lock();
+    // Update table (queued; the writer thread batches the loads).
 
-    vector<string> columnNames{"pairname", "bin", "modelName", "CQ", "CQ2","stackTraceCnt", "weightSum", "dataAlterFactor", "modelAlterFactor", "dataStack", "modelStack", "premStack", "dataStackStd", "modelStackStd", "premStackStd", "dataAlteredPremStack", "modelAlteredPremStack", "premStrippedDataStack", "premStrippedModelStack", "dataFR", "modelFR", "dirPrefix"};
-    vector<vector<string>> sqlData(columnNames.size());
+    vector<vector<ResultsCell>> sqlData(22);
 
     for (size_t i=0; i<binRadius.size(); ++i) {
         sqlData[0].push_back(to_string(i+1)+"_"+modelName);
-        sqlData[1].push_back(to_string(i+1));
+        sqlData[1].push_back(i+1);
         sqlData[2].push_back(modelName);
-        sqlData[3].push_back(isnan(cqResult[i])?"NULL":to_string(cqResult[i]));
-        sqlData[4].push_back(isnan(cqResult2[i])?"NULL":to_string(cqResult2[i]));
-        sqlData[5].push_back(to_string(stackTraceCnt[i]));
-        sqlData[6].push_back(to_string(weightSum[i]));
-        sqlData[7].push_back(isnan(dataAlterFactor[i])?"NULL":to_string(dataAlterFactor[i]));
-        sqlData[8].push_back(isnan(modelAlterFactor[i])?"NULL":to_string(modelAlterFactor[i]));
+        sqlData[3].push_back(cqResult[i]);
+        sqlData[4].push_back(cqResult2[i]);
+        sqlData[5].push_back(stackTraceCnt[i]);
+        sqlData[6].push_back(weightSum[i]);
+        sqlData[7].push_back(dataAlterFactor[i]);
+        sqlData[8].push_back(modelAlterFactor[i]);
         sqlData[21].push_back(dirPrefix);
     }
-    swap(sqlData[9],  dataStackFilename);
-    swap(sqlData[10], modelStackFilename);
-    swap(sqlData[11], premStackFilename);
-    swap(sqlData[12], dataStackStdFilename);
-    swap(sqlData[13], modelStackStdFilename);
-    swap(sqlData[14], premStackStdFilename);
-    swap(sqlData[15], dataAlteredPremStackFilename);
-    swap(sqlData[16], modelAlteredPremStackFilename);
-    swap(sqlData[17], premStrippedDataStackFileName);
-    swap(sqlData[18], premStrippedModelStackFileName);
-    swap(sqlData[19], dataFRFileName);
-    swap(sqlData[20], modelFRFileName);
-
-    MariaDB::LoadData(outputDB, outputTable, columnNames, sqlData);
-
-    emptySlot.push(mySlot);
-    cv.notify_one();
+    sqlData[9].assign(dataStackFilename.begin(), dataStackFilename.end());
+    sqlData[10].assign(modelStackFilename.begin(), modelStackFilename.end());
+    sqlData[11].assign(premStackFilename.begin(), premStackFilename.end());
+    sqlData[12].assign(dataStackStdFilename.begin(), dataStackStdFilename.end());
+    sqlData[13].assign(modelStackStdFilename.begin(), modelStackStdFilename.end());
+    sqlData[14].assign(premStackStdFilename.begin(), premStackStdFilename.end());
+    sqlData[15].assign(dataAlteredPremStackFilename.begin(), dataAlteredPremStackFilename.end());
+    sqlData[16].assign(modelAlteredPremStackFilename.begin(), modelAlteredPremStackFilename.end());
+    sqlData[17].assign(premStrippedDataStackFileName.begin(), premStrippedDataStackFileName.end());
+    sqlData[18].assign(premStrippedModelStackFileName.begin(), premStrippedModelStackFileName.end());
+    sqlData[19].assign(dataFRFileName.begin(), dataFRFileName.end());
+    sqlData[20].assign(modelFRFileName.begin(), modelFRFileName.end());
+
+    writer.Push(move(sqlData));
 
     return;
 }
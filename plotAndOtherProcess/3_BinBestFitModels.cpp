@@ -12,7 +12,10 @@
 #include<EvenSampledSignal.hpp>
 #include<MariaDB.hpp>
 #include<GMTPlotSignal.hpp>
-#include<ShellExec.hpp>
+#include<GetHomeDir.hpp>
+
+#include "ResultsStore.hpp"
+#include "FileSystem.hpp"
 
 using namespace std;
 
@@ -23,6 +26,8 @@ const size_t topN= 10;
 const double dCQThreshold=0.45;
 
 const string modelingTable = "gen2CA_D.ModelingResult_Subtract";
+const string resultsStore = GetHomeDir() + "/PROJ/ResultsStore"; // modeling results, as written by 2_subtractBinStack.
+const bool importFromDB = false; // re-import modelingTable from the database into the store (done anyway if the store has fewer results).
 const string binTable = "gen2CA_D.Bins";
 const string propertyTable = "gen2CA_D.Properties";
 
@@ -51,13 +56,58 @@ int main() {
         modelNameToProperties[ modelInfo.GetString("modelname")[i] ] = {modelInfo.GetDouble("thickness")[i], modelInfo.GetDouble("dvs")[i], modelInfo.GetDouble("drho")[i]};
     }
 
+    // Modeling results (file-backed store: no database round trip per bin).
+    // Tables written before the store existed are only in the database: import the columns used here.
+    // So is a store with fewer results or models than the database (e.g. a run that stopped before writing all of them).
+    bool needImport = importFromDB;
+    const size_t dot = modelingTable.find('.');
+    auto dbTable = MariaDB::Select("count(*) as n from information_schema.tables where table_schema='" + modelingTable.substr(0, dot) + "' and table_name='" + modelingTable.substr(dot + 1) + "'");
+    if (!needImport && dbTable.GetInt("n")[0] > 0) {
+
+        auto dbCount = MariaDB::Select("count(distinct pairname) as nRow, count(distinct modelName) as nModel from " + modelingTable);
+        const size_t dbRows = dbCount.GetInt("nRow")[0], dbModels = dbCount.GetInt("nModel")[0];
+
+        const ResultsStore stored(resultsStore, modelingTable);
+        size_t storeModels = 0;
+        if (stored.NRow() > 0) {
+            const auto &names = stored.GetString("modelName");
+            storeModels = set<string> (names.begin(), names.end()).size();
+        }
+
+        if (stored.NRow() < dbRows || storeModels < dbModels) {
+            cout << "The store has " << stored.NRow() << " results (" << storeModels << " models), the database "
+                 << dbRows << " (" << dbModels << " models)." << endl;
+            needImport = true;
+        }
+        else if (stored.NRow() != dbRows || storeModels != dbModels) {
+            cout << "Note: the store has more results than the database (" << stored.NRow() << " / " << dbRows
+                 << "; models: " << storeModels << " / " << dbModels << "); plotting the store." << endl;
+        }
+    }
+    if (needImport) {
+        cout << "Importing " << modelingTable << " from the database ..." << endl;
+        auto dbResult = MariaDB::Select("pairname, bin, modelName, cq from " + modelingTable);
+        vector<vector<ResultsCell>> cells(4);
+        for (size_t i=0; i<dbResult.NRow(); ++i) {
+            cells[0].push_back(dbResult.GetString("pairname")[i]);
+            cells[1].push_back(dbResult.GetInt("bin")[i]);
+            cells[2].push_back(dbResult.GetString("modelName")[i]);
+            cells[3].push_back(dbResult.GetDouble("cq")[i]);
+        }
+        DropResultsTable(resultsStore, modelingTable);
+        WriteResultsSegment(resultsStore, modelingTable, {"pairname", "bin", "modelName", "cq"}, cells);
+    }
+    const ResultsStore modelingResult(resultsStore, modelingTable);
+    const auto &resultModelName = modelingResult.GetString("modelName");
+    const auto &resultCQ = modelingResult.GetDouble("cq");
+
     // Plot
     double YSIZE = plotHeight * binInfo.NRow() + 1;
     if (!plotTheseBins.empty()) {
         YSIZE = plotHeight * plotTheseBins.size() + 1;
     }
     double XSIZE = 1 + plotWidth;
-    string outfile = GMT::BeginEasyPlot(XSIZE, YSIZE, ShellExec("pwd",true) + "/" + string(__FILE__));
+    string outfile = GMT::BeginEasyPlot(XSIZE, YSIZE, CurrentDir() + "/" + string(__FILE__));
     GMT::MoveReferencePoint(outfile, "-Xf0.5i -Yf" + to_string(YSIZE-0.5) + "i");
 
     // Plot bin result.
@@ -76,13 +126,19 @@ int main() {
         int binN = binInfo.GetInt("bin")[i];
 
         // ModelName is in the form: "ModelType_2015xxx"
-        auto modelingResult = MariaDB::Select("modelName, cq from " + modelingTable + " where bin=" + to_string(binN) + " and modelName not like \"Lamella_%\" order by cq desc");
+        // (rows of this bin, cq desc, no Lamella models.)
+        vector<size_t> rows;
+        for (const auto &r: modelingResult.Rows("bin", binN, "cq")) {
+            if (resultModelName[r].compare(0, 8, "Lamella_") != 0) {
+                rows.push_back(r);
+            }
+        }
 
         // Find PREM cq.
         double premCQ = 0;
-        for (size_t j = 0; j < modelingResult.NRow(); ++j) {
-            if (modelingResult.GetString("modelName")[j] == "PREM_201500000000") {
-                premCQ = modelingResult.GetDouble("cq")[j];
+        for (size_t j = 0; j < rows.size(); ++j) {
+            if (resultModelName[rows[j]] == "PREM_201500000000") {
+                premCQ = resultCQ[rows[j]];
                 break;
             }
         }
@@ -90,15 +146,15 @@ int main() {
         // Find each density category data grid.
         vector<vector<vector<double>>> goodData(rhoDimensions.size()), badData = goodData;
         vector<size_t> cnt(rhoDimensions.size(), 0);
-        for (size_t j = 0; j < modelingResult.NRow(); ++j) {
+        for (size_t j = 0; j < rows.size(); ++j) {
 
-            auto properties = modelNameToProperties [ modelingResult.GetString("modelName")[j] ];
+            auto properties = modelNameToProperties [ resultModelName[rows[j]] ];
 
             size_t k = distance(rhoDimensions.begin(), lower_bound(rhoDimensions.begin(), rhoDimensions.end(), properties[2]-0.01));
             if (k == rhoDimensions.size()) {
                 continue;
             }
-            double cq =  modelingResult.GetDouble("cq")[j];
+            double cq = resultCQ[rows[j]];
 
             if (cnt[k] >= topN) {
                 continue;
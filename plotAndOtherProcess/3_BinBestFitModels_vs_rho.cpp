@@ -12,7 +12,8 @@
 #include<EvenSampledSignal.hpp>
 #include<MariaDB.hpp>
 #include<GMTPlotSignal.hpp>
-#include<ShellExec.hpp>
+
+#include "FileSystem.hpp"
 
 using namespace std;
 
@@ -68,7 +69,7 @@ int main() {
         YSIZE = plotHeight * plotTheseBins.size() + 1;
     }
     double XSIZE = 1 + plotWidth;
-    string outfile = GMT::BeginEasyPlot(XSIZE, YSIZE, ShellExec("pwd",true) + "/" + string(__FILE__));
+    string outfile = GMT::BeginEasyPlot(XSIZE, YSIZE, CurrentDir() + "/" + string(__FILE__));
     GMT::MoveReferencePoint(outfile, "-Xf0.5i -Yf" + to_string(YSIZE-0.5) + "i");
 
     // Plot bin result.
@@ -13,9 +13,10 @@
 #include<EvenSampledSignal.hpp>
 #include<MariaDB.hpp>
 #include<GMTPlotSignal.hpp>
-#include<ShellExec.hpp>
 #include<Float2String.hpp>
 
+#include "FileSystem.hpp"
+
 using namespace std;
 
 // Inputs. -----------------------------
@@ -41,7 +42,7 @@ int main(){
 
     // Plot
     double YSIZE=plotHeight * binInfo.NRow() + 1, XSIZE= 1 + plotWidth;
-    string outfile=GMT::BeginEasyPlot(XSIZE,YSIZE,ShellExec("pwd",true)+"/"+string(__FILE__));
+    string outfile=GMT::BeginEasyPlot(XSIZE,YSIZE,CurrentDir()+"/"+string(__FILE__));
     GMT::MoveReferencePoint(outfile,"-Xf0.5i -Yf"+to_string(YSIZE-0.5)+"i");
         
 
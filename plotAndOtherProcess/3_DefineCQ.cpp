@@ -13,10 +13,10 @@
 #include<EvenSampledSignal.hpp>
 #include<MariaDB.hpp>
 #include<GMTPlotSignal.hpp>
-#include<ShellExec.hpp>
 #include<Float2String.hpp>
 
 #include "CalculateCQ.hpp"
+#include "FileSystem.hpp"
 
 using namespace std;
 
@@ -89,7 +89,7 @@ int main(){
 
     // Plot
     double YSIZE = plotHeight * data.size() + 1, XSIZE = 2 + plotWidth;
-    string outfile = GMT::BeginEasyPlot(XSIZE, YSIZE, ShellExec("pwd", true) + "/" + string(__FILE__));
+    string outfile = GMT::BeginEasyPlot(XSIZE, YSIZE, CurrentDir() + "/" + string(__FILE__));
     GMT::MoveReferencePoint(outfile, "-Xf1i -Yf" + to_string(YSIZE - 0.5) + "i");
     vector<GMT::Text> texts;
     double cq;
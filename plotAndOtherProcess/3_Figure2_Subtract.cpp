@@ -15,6 +15,10 @@
 #include <GMTPlotSignal.hpp>
 #include <ShellExec.hpp>
 #include <Float2String.hpp>
+#include <GetHomeDir.hpp>
+
+#include "TableSnapshot.hpp"
+#include "FileSystem.hpp"
 
 using namespace std;
 
@@ -31,6 +35,7 @@ const double plotHeight = 0.7;
 const string modelingTable = "gen2CA_D.ModelingResult_Subtract";
 const string binTable = "gen2CA_D.Bins";
 const string propertyTable = "gen2CA_D.Properties";
+const string snapshotDir = GetHomeDir() + "/PROJ/Snapshots"; // bins and model properties, re-read every run (the tables change).
 
 // ------------------------------------
 
@@ -70,7 +75,7 @@ int main(){
 
 
     // For each bin, get the location and bin number.
-    auto binInfo=MariaDB::Select("bin,lon,lat from "+binTable);
+    auto binInfo=SnapshotSelect(snapshotDir, "bin,lon,lat from "+binTable, "idd", true);
     vector<BinResult> Data;
     for (size_t i=0;i<binInfo.NRow();++i) {
 
@@ -79,7 +84,7 @@ int main(){
 
 
     // Get model properties.
-    auto modelInfo = MariaDB::Select("modelName, thickness, dvs, drho, awayFromCMB from " + propertyTable + " order by modelName");
+    auto modelInfo = SnapshotSelect(snapshotDir, "modelName, thickness, dvs, drho, awayFromCMB from " + propertyTable + " order by modelName", "sdddd", true);
 
 
     // For each bin, get the best fit model.
@@ -120,14 +125,12 @@ int main(){
 
 
             // get model property.
-            auto it=lower_bound(modelInfo.GetString("modelName").begin(), modelInfo.GetString("modelName").end(), modelName);
-            if (it==modelInfo.GetString("modelName").end() || *it!=res.GetString("modelName")[j]) {
+            size_t index=modelInfo.Find("modelName", modelName);
+            if (index==modelInfo.NRow()) {
                 cerr << "Can't find model property for " << res.GetString("modelName")[j];
             }
             else {
 
-                size_t index=distance(modelInfo.GetString("modelName").begin(), it);
-
                 if (dRhoMin <= modelInfo.GetDouble("drho")[index] && modelInfo.GetDouble("drho")[index] <= dRhoMax && modelInfo.GetDouble("thickness")[index] <= maxThickness) {
 
 
@@ -249,7 +252,7 @@ if (modelName.find("Lamella") == string::npos && modelName.find("PREM") == strin
 
     // Plot
     double scale=0.25,XSIZE=scale*35+12,YSIZE=1+max(scale*35 + 9 , 1.5+plotHeight*max(Count_Significant_Low,Count_Significant_High));
-    string outfile=GMT::BeginEasyPlot(XSIZE,YSIZE,ShellExec("pwd",true)+"/"+string(__FILE__));
+    string outfile=GMT::BeginEasyPlot(XSIZE,YSIZE,CurrentDir()+"/"+string(__FILE__));
 
 
     // Plot low velocity Stacks.
@@ -9,12 +9,16 @@
 #include<unistd.h>
 #include<iomanip>
 #include<set>
+#include<memory>
 
 #include<MariaDB.hpp>
 #include<GMT.hpp>
 #include<AvrStd.hpp>
 #include<CreateGrid.hpp>
 #include<Interpolate.hpp>
+#include<GetHomeDir.hpp>
+
+#include "TopKTracker.hpp"
 
 using namespace std;
 
@@ -25,9 +29,11 @@ const double dRhoMin = -10, dRhoMax = 20;
 
 const double plotHeight = 6, plotWidth = 5;
 
-const string modelingTable = "gen2CA_D.ModelingResult_Subtract_cutoff70";
+const string modelingTable = "gen2CA_D.ModelingResult_Subtract"; // 2_subtractBinStack: outputTable + config tag.
 const string binTable = "gen2CA_D.Bins";
 const string propertyTable = "gen2CA_D.Properties";
+const string topKFile = GetHomeDir() + "/PROJ/t013.ScS_NextGen/Subtract/ModelingResult_Subtract.topk"; // summary of modelingTable, by the same run.
+const string premModel = "PREM_201500000000";
 
 // ------------------------------------
 
@@ -49,7 +55,7 @@ struct BinResult{
 
 int main(){
 
-    // For each bin, get the location and bin number.
+    // For each bin, get the bin number.
     auto binInfo = MariaDB::Select("bin from " + binTable);
 
     vector<BinResult> Data;
@@ -66,60 +72,67 @@ int main(){
     size_t bestFitCnt = (size_t)round(modelInfo.NRow() / 100);
 
 
-    // For each bin, get the best fit model.
-    for (size_t i = 0; i < Data.size(); ++i) {
+    // Per-bin best models and PREM cq, kept by the modeling run (no per-bin scan of modelingTable).
+    // (K is whatever the run kept: read from the summary header.)
+    // Without a usable summary (missing, other filter / baseline, or fewer than the top 1% kept),
+    // make one from modelingTable, in one query.
+    unique_ptr<TopKTracker> topK(new TopKTracker(TopKTracker::SavedK(topKFile), dRhoMin, dRhoMax, maxThickness, premModel));
+    if (topK->K() < bestFitCnt || !topK->Load(topKFile)) {
 
-        // ModelName is in the form: "ModelType_2015xxx"
-        auto res = MariaDB::Select("modelName, cq from " + modelingTable + " where bin = " + to_string(Data[i].binN) + " and (modelName like \"U%\" or modelName like \"PREM%\") order by cq desc");
+        cout << "Can't use " << topKFile << ", reading " << modelingTable << " instead ..." << endl;
 
-        // Find prem result.
-        for (size_t j = 0; j < res.NRow(); ++j) {
-            if (res.GetString("modelName")[j] == "PREM_201500000000"){
-
-                Data[i].premCQ = res.GetDouble("cq")[j];
+        topK.reset(new TopKTracker(bestFitCnt, dRhoMin, dRhoMax, maxThickness, premModel));
+        for (size_t i = 0; i < modelInfo.NRow(); ++i) {
+            topK->SetModel(modelInfo.GetString("modelName")[i], modelInfo.GetDouble("thickness")[i], modelInfo.GetDouble("drho")[i]);
+        }
 
-                break;
-            }
+        auto res = MariaDB::Select("modelName, bin, cq from " + modelingTable + " where modelName like \"U%\" or modelName = \"" + premModel + "\"");
+        const auto &modelName = res.GetString("modelName");
+        const auto &bin = res.GetInt("bin");
+        const auto &cq = res.GetDouble("cq");
+        for (size_t i = 0; i < res.NRow(); ++i) {
+            topK->Update(modelName[i], bin[i], cq[i]);
         }
+    }
 
-        // Find top 1% best fit models.
-        for (size_t j=0; j<res.NRow(); ++j) {
+    // For each bin, get the best fit model.
+    for (size_t i = 0; i < Data.size(); ++i) {
 
-            if (Data[i].h.size() >= bestFitCnt) {
+        // Find prem result (NaN if this bin has none).
+        Data[i].premCQ = topK->PremCQ(Data[i].binN);
 
-                break;
-            }
+        // Find top 1% best fit models (ULVZ and UHVZ together; the summary only has models passing the filter).
+        auto res = topK->Top(Data[i].binN, "ULVZ"), uhvz = topK->Top(Data[i].binN, "UHVZ");
+        res.insert(res.end(), uhvz.begin(), uhvz.end());
+        stable_sort(res.begin(), res.end(), [](const pair<double, string> &a, const pair<double, string> &b){
+            return a.first > b.first;
+        });
 
-            string modelName = res.GetString("modelName")[j];
+        for (size_t j=0; j<res.size(); ++j) {
 
-            if (modelName.find("PREM") != string::npos) {
+            if (Data[i].h.size() >= bestFitCnt) {
 
-                continue;
+                break;
             }
 
+            const string &modelName = res[j].second;
 
             // get model property.
             auto it = lower_bound(modelInfo.GetString("modelName").begin(), modelInfo.GetString("modelName").end(), modelName);
 
-            if (it == modelInfo.GetString("modelName").end() || *it != res.GetString("modelName")[j]) {
+            if (it == modelInfo.GetString("modelName").end() || *it != modelName) {
 
-                throw runtime_error("Can't find model property for " + res.GetString("modelName")[j] + " for bin " + to_string(Data[i].binN));
+                throw runtime_error("Can't find model property for " + modelName + " for bin " + to_string(Data[i].binN));
             }
             else {
 
                 size_t index = distance(modelInfo.GetString("modelName").begin(), it);
 
-                if ( dRhoMin <= modelInfo.GetDouble("drho")[index] &&
-                     modelInfo.GetDouble("drho")[index] <= dRhoMax && 
-                     modelInfo.GetDouble("thickness")[index] <= maxThickness ){
-
-
-                    Data[i].h.push_back(modelInfo.GetDouble("thickness")[index]);
-                    Data[i].dvs.push_back(modelInfo.GetDouble("dvs")[index]);
-                    Data[i].drho.push_back(modelInfo.GetDouble("drho")[index]);
+                Data[i].h.push_back(modelInfo.GetDouble("thickness")[index]);
+                Data[i].dvs.push_back(modelInfo.GetDouble("dvs")[index]);
+                Data[i].drho.push_back(modelInfo.GetDouble("drho")[index]);
 
-                    Data[i].dcq.push_back(res.GetDouble("cq")[j] - Data[i].premCQ);
-                }
+                Data[i].dcq.push_back(res[j].first - Data[i].premCQ);
             }
         }
     }
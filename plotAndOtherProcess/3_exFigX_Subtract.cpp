@@ -16,6 +16,8 @@
 #include<ShellExec.hpp>
 #include<Float2String.hpp>
 
+#include "FileSystem.hpp"
+
 using namespace std;
 
 // Inputs. -----------------------------
@@ -290,7 +292,7 @@ if (modelName.find("Lamella") == string::npos && modelName.find("PREM") == strin
 
     // Plot
     double scale=0.25,XSIZE=scale*35+12,YSIZE=1+max(scale*35 + 9 , 1.5+plotHeight*max(Count_Significant_Low,Count_Significant_High));
-    string outfile=GMT::BeginEasyPlot(XSIZE,YSIZE,ShellExec("pwd",true)+"/"+string(__FILE__));
+    string outfile=GMT::BeginEasyPlot(XSIZE,YSIZE,CurrentDir()+"/"+string(__FILE__));
 
 
     // Plot low velocity Stacks.
@@ -43,7 +43,7 @@ int main(){
     for (size_t i=0;i<BinInfo.NRow();++i) {
 
         // more data.
-        auto Cnt = MariaDB::Select("count(*) as cnt from gen2CA_D.CenterDists as A join gen2CA_D.Master_a14 as B on A.pairname = B.pairname where A.dist_" + to_string(BinInfo.GetInt("bin")[i]) + " > -0.5 and B.shift_gcarc <=70");
+        auto Cnt = MariaDB::Select("count(*) as cnt from gen2CA_D.BinMembers as A join gen2CA_D.Master_a14 as B on A.pairname = B.pairname where A.bin = " + to_string(BinInfo.GetInt("bin")[i]) + " and B.shift_gcarc <=70");
 
         // Plot a circle.
         vector<double> c_lon,c_lat;
@@ -16,6 +16,8 @@
 #include<ShellExec.hpp>
 #include<Float2String.hpp>
 
+#include "FileSystem.hpp"
+
 using namespace std;
 
 // INPUTs -----------------------------
@@ -176,7 +178,7 @@ int main(){
     // Plot
     double height=1.7;
     double XSIZE=12,YSIZE=2+height*max(Count_Significant_Low,Count_Significant_High);
-    string outfile=GMT::BeginEasyPlot(XSIZE,YSIZE,ShellExec("pwd",true)+"/"+string(__FILE__));
+    string outfile=GMT::BeginEasyPlot(XSIZE,YSIZE,CurrentDir()+"/"+string(__FILE__));
     GMT::set("COLOR_NAN cyan");
     GMT::makecpt("-Cgray -T0/1/0.1 -Z -I > tmp.cpt");
 
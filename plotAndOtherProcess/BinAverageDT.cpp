@@ -10,7 +10,7 @@ using namespace std;
 
 // Inputs . --------------
 
-const string infoTable1="gen2CA_D.Master_a14", infoTable2="gen2CA_D.Bins", infoTable3="gen2CA_D.CenterDists";
+const string infoTable1="gen2CA_D.Master_a14", infoTable2="gen2CA_D.Bins", infoTable3="gen2CA_D.BinMembers";
 const string phase1="ScS", phase2="sS"; // Will calcualte dT = phase2 - phase1
 
 // -----------------------
@@ -32,7 +32,7 @@ int main(){
 
     for (size_t i=0; i<binInfo.NRow(); ++i) {
         string binN=to_string(binInfo.GetInt("bin")[i]);
-        auto dataInfo=MariaDB::Select("pairname as pn from "+infoTable3+" where dist_"+binN+" >-0.5"); 
+        auto dataInfo=MariaDB::Select("pairname as pn from "+infoTable3+" where bin="+binN); 
 
         double val=0;
         for (size_t j=0; j<dataInfo.NRow(); ++j) {
@@ -0,0 +1,107 @@
+#include<iostream>
+#include<vector>
+#include<random>
+#include<cmath>
+#include<algorithm>
+
+#include<EvenSampledSignal.hpp>
+#include<PNormErr.hpp>
+
+#include "CalculateCQ.hpp"
+
+/*
+ * CalculateCQ (single and batched) vs the original implementation, which called
+ * the library for every metric (CrossCorrelation, SumArea, PNormErr). It's kept
+ * here verbatim as OldCalculateCQ.
+ *
+ * Fixed pseudo-random data and model traces: same grid, models starting before
+ * and after zero, and models ending inside the compare window; then the same
+ * models against a data trace that ends inside the window.
+ *
+ * Pass: all seven metrics within tol (absolute; they are all O(1)).
+*/
+
+using namespace std;
+
+// Inputs. ------------------------------------
+
+const size_t nModel=40, npts=1201;
+const double dt=0.025, compareLength=15;
+const unsigned seed=20150002;
+const double tol=1e-9;
+
+// --------------------------------------------
+
+vector<double> OldCalculateCQ(const EvenSampledSignal &dataTrace, const EvenSampledSignal &modelTrace, const double &compareLength){
+
+    double cc1 = dataTrace.CrossCorrelation(0, compareLength, modelTrace, 0, compareLength, 1, make_pair(0,0)).second;
+
+    double ed = sqrt(dataTrace.SumArea(0, compareLength, 2));
+    double es = sqrt(modelTrace.SumArea(0, compareLength, 2));
+
+    double cc2 = cc1 * min(ed, es) / max(ed, es);
+    double cc = (1 + cc2) / 2;
+
+    double nn2 = PNormErr(modelTrace.GetAmp(0, compareLength), dataTrace.GetAmp(0, compareLength), 2);
+    double nn2x = PNormErr(dataTrace.GetAmp(0, compareLength), modelTrace.GetAmp(0, compareLength), 2);
+
+    double nd = 1.0 / (1.0 + nn2);
+    double ndx = 1.0 / (1.0 + nn2x);
+
+    return vector<double> {cc, nd, ndx, cc1, cc2, nn2, nn2x};
+}
+
+EvenSampledSignal Wavelet(mt19937 &gen, const double &beginTime, const size_t &n, const double &t0, const double &amp){
+    normal_distribution<double> noise(0,1);
+    vector<double> ans(n);
+    for (size_t j=0; j<n; ++j) {
+        double t=beginTime+j*dt-t0;
+        ans[j]=amp*exp(-t*t/4)*cos(1.3*t)+0.05*noise(gen);
+    }
+    return EvenSampledSignal(ans,dt,beginTime);
+}
+
+int main(){
+
+    mt19937 gen(seed);
+    uniform_real_distribution<double> u(0,1);
+
+    const EvenSampledSignal data=Wavelet(gen,-10,npts,5,1), shortData=Wavelet(gen,-10,npts/2,5,1);
+
+    vector<EvenSampledSignal> models;
+    for (size_t i=0; i<nModel; ++i) {
+        double beginTime=-10+(i%3==1 ? 0.5 : 0);
+        size_t n=(i%4==3 ? npts/2 : npts); // ends at ~4.5 s, inside the window.
+        models.push_back(Wavelet(gen,beginTime,n,4+2*u(gen),0.3+2*u(gen)));
+    }
+
+    const string names[]={"cc","nd","ndx","cc1","cc2","nn2","nn2x"};
+
+    size_t bad=0;
+    double worst=0;
+    for (const auto &d: {data,shortData}) {
+        auto batch=CalculateCQ(d,models,compareLength);
+        for (size_t i=0; i<nModel; ++i) {
+            auto expected=OldCalculateCQ(d,models[i],compareLength);
+            auto single=CalculateCQ(d,models[i],compareLength);
+            for (size_t k=0; k<expected.size(); ++k) {
+                double e=max(fabs(single[k]-expected[k]),fabs(batch[i][k]-expected[k]));
+                worst=max(worst,e);
+                if (!(e<=tol)) {
+                    if (bad<10) {
+                        cout << (d.Size()==npts ? "data" : "short data") << ", model " << i << ", " << names[k] << ": expected " << expected[k]
+                             << ", single " << single[k] << ", batched " << batch[i][k] << endl;
+                    }
+                    ++bad;
+                }
+            }
+        }
+    }
+
+    if (bad!=0) {
+        cout << "FAIL: " << bad << " CQ values differ from the original implementation (worst " << worst << ")." << endl;
+        return 1;
+    }
+    cout << "PASS: 2 data traces x " << nModel << " models x 7 metrics match the original implementation (worst " << worst << ")." << endl;
+    return 0;
+}
@@ -0,0 +1,144 @@
+#include<iostream>
+#include<vector>
+#include<random>
+#include<cmath>
+#include<algorithm>
+
+#include<fftw3.h>
+#include<EvenSampledSignal.hpp>
+
+#include "DeconEngine.hpp"
+
+/*
+ * DeconEngine vs the library calls it replaces in the deconWay drivers:
+ *
+ *   WaterLevelDecon(source, waterLevel) -> GaussianBlur(sigma) -> Butterworth(low, 10000)
+ *
+ * on fixed synthetic traces: the source (a tapered wavelet, peak at 0, as the
+ * drivers cut it) convolved with a few spikes, plus noise. 70 traces, so the
+ * engine runs a full and a partial batch. Both results then go through the
+ * drivers' post-processing (peak near 0, shift, flip, normalize, cut to
+ * -50 ~ 50 sec) before they're compared.
+ *
+ * Also: several settings at once give the same traces as one at a time.
+ *
+ * Pass: same length, max |difference| <= tol (the peak is 1) for every trace
+ * and setting; multi-setting results within 1e-12 of single-setting ones.
+*/
+
+using namespace std;
+
+// Inputs. ------------------------------------
+
+const size_t nTrace=70;
+const double dt=0.025, low=0.03;
+const double sourceT1=-60, sourceT2=60, traceT1=-120, traceT2=120, cutT1=-50, cutT2=50;
+const vector<DeconSetting> settings{{0.1,1.27398},{0.05,1.0},{0.2,2.0}};
+const unsigned seed=20150003;
+const double tol=0.02;
+
+// --------------------------------------------
+
+void PostProcess(EvenSampledSignal &s){
+    s.FindPeakAround(0,10);
+    s.ShiftTimeReferenceToPeak();
+    s.FlipPeakUp();
+    s.NormalizeToPeak();
+    s.CheckAndCutToWindow(cutT1,cutT2);
+}
+
+int main(){
+
+    fftw_make_planner_thread_safe();
+
+    mt19937 gen(seed);
+    normal_distribution<double> noise(0,1);
+    uniform_real_distribution<double> u(0,1);
+
+    // Source: a Ricker-like wavelet with a slow tail, peak at 0.
+    const size_t ns=(size_t)round((sourceT2-sourceT1)/dt)+1;
+    vector<double> s(ns);
+    for (size_t j=0; j<ns; ++j) {
+        double t=sourceT1+j*dt, a=t*t/2.5;
+        s[j]=(1-a)*exp(-a/2)+0.1*exp(-fabs(t-3)/4);
+    }
+    EvenSampledSignal source(s,dt,sourceT1);
+    source.NormalizeToPeak();
+    source.HannTaper(10);
+
+    // Traces: source * spikes (the main one at 0) + noise.
+    const size_t nt=(size_t)round((traceT2-traceT1)/dt)+1;
+    const long s0=lround(-sourceT1/dt);
+    vector<EvenSampledSignal> traces;
+    for (size_t i=0; i<nTrace; ++i) {
+        vector<pair<double,double>> spikes{{0,1},{-5-5*u(gen),-0.3*u(gen)},{5+10*u(gen),0.5*u(gen)}};
+        vector<double> amp(nt);
+        for (size_t j=0; j<nt; ++j) {
+            amp[j]=0.01*noise(gen);
+        }
+        for (const auto &item: spikes) {
+            long k0=lround((item.first-traceT1)/dt);
+            for (size_t j=0; j<ns; ++j) {
+                long k=k0+(long)j-s0;
+                if (0<=k && k<(long)nt) {
+                    amp[k]+=item.second*source.GetAmp()[j];
+                }
+            }
+        }
+        traces.push_back(EvenSampledSignal(amp,dt,traceT1));
+    }
+
+    DeconEngine decon;
+    const auto all=decon.Decon(traces,source,settings,low);
+
+    size_t bad=0;
+    double worst=0, worstMulti=0;
+    for (size_t c=0; c<settings.size(); ++c) {
+
+        const auto one=decon.Decon(traces,source,settings[c].waterLevel,settings[c].sigma,low);
+
+        for (size_t i=0; i<nTrace; ++i) {
+
+            // several settings at once vs one.
+            for (size_t j=0; j<one[i].Size(); ++j) {
+                worstMulti=max(worstMulti,fabs(one[i].GetAmp()[j]-all[c][i].GetAmp()[j]));
+            }
+
+            EvenSampledSignal expected=traces[i];
+            expected.WaterLevelDecon(source,settings[c].waterLevel);
+            expected.GaussianBlur(settings[c].sigma);
+            expected.Butterworth(low,10000);
+            PostProcess(expected);
+
+            EvenSampledSignal got=all[c][i];
+            PostProcess(got);
+
+            double e=INFINITY;
+            if (got.Size()==expected.Size()) {
+                e=0;
+                for (size_t j=0; j<got.Size(); ++j) {
+                    e=max(e,fabs(got.GetAmp()[j]-expected.GetAmp()[j]));
+                }
+            }
+            worst=max(worst,e);
+            if (!(e<=tol)) {
+                if (bad<10) {
+                    cout << "setting " << c << ", trace " << i << ": max difference " << e
+                         << " (sizes " << got.Size() << ", " << expected.Size() << ")." << endl;
+                }
+                ++bad;
+            }
+        }
+    }
+    if (!(worstMulti<=1e-12)) {
+        cout << "several settings at once differ from one at a time by " << worstMulti << "." << endl;
+        ++bad;
+    }
+
+    if (bad!=0) {
+        cout << "FAIL: " << bad << " problems (worst difference from the library " << worst << ")." << endl;
+        return 1;
+    }
+    cout << "PASS: " << nTrace << " traces x " << settings.size() << " settings match the library calls (worst " << worst << ")." << endl;
+    return 0;
+}
@@ -0,0 +1,106 @@
+#include<iostream>
+#include<vector>
+#include<random>
+#include<cmath>
+#include<algorithm>
+
+#include<EvenSampledSignal.hpp>
+
+#include "SignalMatrix.hpp"
+#include "MatrixStack.hpp"
+
+/*
+ * MatrixStack vs the library's StackSignals, on fixed pseudo-random traces
+ * (one grid) and several weight rows: uniform, mixed positive weights, and rows
+ * with zero weights. StackSignals gets only the traces of nonzero weight (as
+ * 2_subtractBinStack used it before: the bin's members and their weights).
+ *
+ * Both the stack and the std (written to the *.std files) are compared, for the
+ * double traces and for the float32 SignalMatrix rows.
+ *
+ * Pass: max |difference| <= tol * max |library value| for stack and std.
+*/
+
+using namespace std;
+
+// Inputs. ------------------------------------
+
+const size_t nTrace=60, npts=2401;
+const double dt=0.025, beginTime=-30;
+const unsigned seed=20150001;
+const double tol=1e-9, tolFloat=1e-5; // float32 rows: rounding of the samples.
+
+// --------------------------------------------
+
+double MaxDiff(const EvenSampledSignal &a, const EvenSampledSignal &b, double &scale){
+    double ans=0;
+    scale=0;
+    for (size_t j=0; j<min(a.Size(),b.Size()); ++j) {
+        ans=max(ans,fabs(a.GetAmp()[j]-b.GetAmp()[j]));
+        scale=max(scale,fabs(b.GetAmp()[j]));
+    }
+    return (a.Size()==b.Size() ? ans : INFINITY);
+}
+
+int main(){
+
+    mt19937 gen(seed);
+    normal_distribution<double> noise(0,1);
+    uniform_real_distribution<double> u(0,1);
+
+    vector<EvenSampledSignal> traces;
+    for (size_t i=0; i<nTrace; ++i) {
+        vector<double> amp(npts);
+        for (size_t j=0; j<npts; ++j) {
+            double t=beginTime+j*dt;
+            amp[j]=exp(-t*t/(4+i%7))*(1+0.1*i)+0.2*noise(gen);
+        }
+        traces.push_back(EvenSampledSignal(amp,dt,beginTime));
+    }
+
+    vector<vector<double>> weights;
+    weights.push_back(vector<double> (nTrace,1));
+    vector<double> w(nTrace);
+    for (auto &item: w) item=0.1+u(gen);
+    weights.push_back(w);
+    for (size_t i=0; i<nTrace; ++i) w[i]=(i%3==0 ? 0 : 0.5+u(gen));
+    weights.push_back(w);
+    for (size_t i=0; i<nTrace; ++i) w[i]=(i<5 ? 1+i : 0);
+    weights.push_back(w);
+
+    vector<const EvenSampledSignal *> rows;
+    for (const auto &item: traces) rows.push_back(&item);
+
+    SignalMatrix matrix;
+    for (const auto &item: traces) matrix.Append(item);
+    vector<size_t> allRows(nTrace);
+    for (size_t i=0; i<nTrace; ++i) allRows[i]=i;
+
+    const auto got=MatrixStack(weights,rows);
+    const auto gotFloat=MatrixStack(weights,matrix.Select(allRows));
+
+    bool ok=true;
+    for (size_t r=0; r<weights.size(); ++r) {
+
+        vector<EvenSampledSignal> members;
+        vector<double> memberWeight;
+        for (size_t i=0; i<nTrace; ++i) {
+            if (weights[r][i]!=0) {
+                members.push_back(traces[i]);
+                memberWeight.push_back(weights[r][i]);
+            }
+        }
+        const auto expect=StackSignals(members,memberWeight);
+
+        double s1, s2, s3, s4;
+        double dStack=MaxDiff(got[r].first,expect.first,s1), dStd=MaxDiff(got[r].second,expect.second,s2);
+        double fStack=MaxDiff(gotFloat[r].first,expect.first,s3), fStd=MaxDiff(gotFloat[r].second,expect.second,s4);
+
+        bool rowOk=(dStack<=tol*s1 && dStd<=tol*s2 && fStack<=tolFloat*s3 && fStd<=tolFloat*s4);
+        cout << (rowOk ? "PASS" : "FAIL") << ": weight row " << r << " (" << members.size() << " traces): max |diff| stack "
+             << dStack << ", std " << dStd << "; float32 rows: stack " << fStack << ", std " << fStd << endl;
+        ok&=rowOk;
+    }
+
+    return (ok ? 0 : 1);
+}
@@ -0,0 +1,70 @@
+#include<iostream>
+#include<vector>
+#include<future>
+#include<mutex>
+#include<chrono>
+
+#include "ThreadPool.hpp"
+#include "Prefetcher.hpp"
+
+/*
+ * Prefetcher on the thread pool, the way the modeling drivers use it:
+ * one pool task per item, each taking reader.Next().
+ *
+ * Checks: every item is handed out exactly once, and every item the reader
+ * threads loaded ahead was taken by a worker (none held until the end).
+*/
+
+using namespace std;
+
+// Inputs. ------------------------------------
+
+const size_t nItem=300, nThread=4, nPrefetch=8, nReader=2;
+
+// --------------------------------------------
+
+int main(){
+
+    ThreadPool pool(nThread);
+    mutex mtx;
+    vector<size_t> handedOut(nItem,0);
+
+    Prefetcher<size_t> reader(nItem, [](const size_t &i){
+        this_thread::sleep_for(chrono::milliseconds(2)); // "disk".
+        return i*i;
+    }, nPrefetch, nReader);
+
+    vector<future<void>> allTasks;
+    for (size_t k=0; k<nItem; ++k) {
+        allTasks.push_back(pool.Submit([&](){
+            auto item=reader.Next();
+            if (item.second!=item.first*item.first) {
+                throw runtime_error("wrong item.");
+            }
+            this_thread::sleep_for(chrono::milliseconds(1)); // "compute".
+            lock_guard<mutex> lck(mtx);
+            ++handedOut[item.first];
+        }));
+    }
+    for (auto &item: allTasks) {
+        item.get();
+    }
+
+    bool ok=true;
+    for (size_t i=0; i<nItem; ++i) {
+        if (handedOut[i]!=1) {
+            cout << "FAIL: item " << i << " handed out " << handedOut[i] << " times." << endl;
+            ok=false;
+        }
+    }
+
+    auto stats=reader.ReaderStats();
+    cout << "Loaded by readers: " << stats.first << ", taken: " << stats.second << endl;
+    if (stats.first==0 || stats.first!=stats.second) {
+        cout << "FAIL: reader-loaded items were not all consumed." << endl;
+        ok=false;
+    }
+
+    cout << (ok ? "PASS" : "FAIL") << ": Prefetcher" << endl;
+    return (ok ? 0 : 1);
+}
@@ -0,0 +1,81 @@
+#include<iostream>
+#include<vector>
+#include<random>
+
+#include<GcpDistance.hpp>
+
+#include "SphereIndex.hpp"
+
+/*
+ * SphereIndex::Query vs a brute-force GcpDistance scan, on fixed pseudo-random
+ * points (clustered near the poles and the dateline too) and query radii from
+ * below the cell radius up to the whole sphere.
+ *
+ * Pass: the same index set for every query.
+*/
+
+using namespace std;
+
+// Inputs. ------------------------------------
+
+const size_t nPoint=5000, nQuery=150;
+const unsigned seed=20150000;
+const double cellRadius=5;
+const vector<double> radii{0.3, 1, 5, 12.5, 45, 179.5, 180};
+
+// --------------------------------------------
+
+int main(){
+
+    mt19937 gen(seed);
+    uniform_real_distribution<double> lonDist(-180,180), zDist(-1,1), polarDist(85,90), edgeDist(-1,1);
+
+    // uniform on the sphere, plus points within 5 deg of the poles and 1 deg of the dateline.
+    vector<double> lon, lat;
+    for (size_t i=0; i<nPoint; ++i) {
+        if (i%10==0) {
+            lon.push_back(lonDist(gen));
+            lat.push_back((i%20==0 ? 1 : -1)*polarDist(gen));
+        }
+        else if (i%10==1) {
+            double x=edgeDist(gen);
+            lon.push_back(x<0 ? 180+x : -180+x);
+            lat.push_back(asin(zDist(gen))*180/M_PI);
+        }
+        else {
+            lon.push_back(lonDist(gen));
+            lat.push_back(asin(zDist(gen))*180/M_PI);
+        }
+    }
+
+    const SphereIndex index(lon, lat, cellRadius);
+
+    size_t nChecked=0, nFound=0, nBad=0;
+    for (size_t q=0; q<nQuery; ++q) {
+
+        const double qlon=(q<nQuery/3 ? lon[q*37%nPoint] : lonDist(gen)), qlat=(q<nQuery/3 ? lat[q*37%nPoint] : asin(zDist(gen))*180/M_PI);
+
+        for (const auto &radius: radii) {
+
+            vector<size_t> expect;
+            for (size_t i=0; i<nPoint; ++i) {
+                if (GcpDistance(lon[i], lat[i], qlon, qlat)<=radius) {
+                    expect.push_back(i);
+                }
+            }
+
+            auto got=index.Query(qlon, qlat, radius);
+            ++nChecked;
+            nFound+=got.size();
+            if (got!=expect) {
+                ++nBad;
+                if (nBad<=5) {
+                    cout << "FAIL: query (" << qlon << ", " << qlat << ") radius " << radius << ": " << got.size() << " points, brute force " << expect.size() << endl;
+                }
+            }
+        }
+    }
+
+    cout << (nBad==0 ? "PASS" : "FAIL") << ": SphereIndex: " << nChecked << " queries, " << nFound << " points found, " << nBad << " mismatches." << endl;
+    return (nBad==0 ? 0 : 1);
+}
@@ -0,0 +1,127 @@
+#include<iostream>
+#include<vector>
+#include<random>
+#include<cmath>
+#include<algorithm>
+
+#include<EvenSampledSignal.hpp>
+
+#include "StretchBank.hpp"
+
+/*
+ * StretchBank vs the library's StretchToFitHalfWidth, on a fixed sESW-like
+ * template (peak at 0, dt = 0.025, -50 ~ 50 sec) and traces that are the
+ * template stretched by factors across the bank's range (and a few outside
+ * it), plus noise.
+ *
+ * Default (exact) mode must return what the library returns. Bank mode
+ * quantizes the stretch factor (step 0.005); its stated error bound:
+ *
+ *   half-height width within one sample of the library's fit, and
+ *   max |sample difference| <= tol (the template's peak is 1).
+ *
+ * Also checks that out-of-range traces fall back to the exact fit.
+*/
+
+using namespace std;
+
+// Inputs. ------------------------------------
+
+const size_t nTrace=200;
+const double dt=0.025, beginTime=-50, endTime=50;
+const unsigned seed=20150004;
+const double tol=0.02;
+
+// --------------------------------------------
+
+double HalfWidth(const EvenSampledSignal &s){
+    auto len=s.FindAmplevel(0.5);
+    return s.GetDelta()*(len.second-len.first);
+}
+
+double MaxDiff(const EvenSampledSignal &a, const EvenSampledSignal &b){
+    if (a.Size()!=b.Size() || fabs(a.BeginTime()-b.BeginTime())>1e-6*a.GetDelta()) {
+        return INFINITY;
+    }
+    double ans=0;
+    for (size_t j=0; j<a.Size(); ++j) {
+        ans=max(ans,fabs(a.GetAmp()[j]-b.GetAmp()[j]));
+    }
+    return ans;
+}
+
+int main(){
+
+    mt19937 gen(seed);
+    normal_distribution<double> noise(0,1);
+    uniform_real_distribution<double> u(0,1);
+
+    // template: an S-like pulse with side lobes, peak 1 at 0.
+    const size_t n=(size_t)round((endTime-beginTime)/dt)+1;
+    vector<double> amp(n);
+    for (size_t j=0; j<n; ++j) {
+        double t=beginTime+j*dt;
+        amp[j]=exp(-t*t/8)-0.3*exp(-(t-4)*(t-4)/6)-0.2*exp(-(t+5)*(t+5)/10);
+    }
+    EvenSampledSignal temp(amp,dt,beginTime);
+    temp.FindPeakAround(0);
+    temp.ShiftTimeReferenceToPeak();
+    temp.NormalizeToPeak();
+
+    const StretchBank exact(temp), bank(temp,true);
+
+    size_t bad=0, outside=0;
+    double worst=0, worstWidth=0, worstExact=0;
+    for (size_t i=0; i<nTrace; ++i) {
+
+        // every 20th trace far outside the bank's factors (0.5 ~ 2).
+        const double f=(i%20==19 ? 2.5+u(gen) : 0.55+1.4*u(gen));
+        EvenSampledSignal trace=temp.Stretch(f);
+        vector<double> x=trace.GetAmp();
+        for (auto &item: x) {
+            item+=0.005*noise(gen);
+        }
+        trace=EvenSampledSignal(x,trace.GetDelta(),trace.BeginTime());
+
+        const auto expected=temp.StretchToFitHalfWidth(trace);
+
+        worstExact=max(worstExact,MaxDiff(exact.FitHalfWidth(trace),expected));
+
+        const size_t before=bank.Fallbacks();
+        const auto got=bank.FitHalfWidth(trace);
+        if (bank.Fallbacks()!=before) {
+            ++outside;
+            if (MaxDiff(got,expected)!=0) {
+                cout << "trace " << i << " (factor " << f << "): fallback differs from the library." << endl;
+                ++bad;
+            }
+            continue;
+        }
+
+        const double e=MaxDiff(got,expected), w=fabs(HalfWidth(got)-HalfWidth(expected));
+        worst=max(worst,e);
+        worstWidth=max(worstWidth,w);
+        if (!(e<=tol) || w>dt*1.01) {
+            if (bad<10) {
+                cout << "trace " << i << " (factor " << f << "): max difference " << e << ", half-width difference " << w << " sec." << endl;
+            }
+            ++bad;
+        }
+    }
+    if (worstExact!=0) {
+        cout << "exact mode differs from the library by " << worstExact << "." << endl;
+        ++bad;
+    }
+    if (outside!=nTrace/20) {
+        cout << outside << " fallbacks, expected " << nTrace/20 << "." << endl;
+        ++bad;
+    }
+
+    if (bad!=0) {
+        cout << "FAIL: " << bad << " problems (bank: worst difference " << worst << ", worst half-width difference " << worstWidth << " sec)." << endl;
+        return 1;
+    }
+    cout << "PASS: " << nTrace << " traces; exact mode is the library's; bank within " << worst
+         << " (tol " << tol << "), half-widths within " << worstWidth << " sec; " << outside << " fallbacks." << endl;
+    return 0;
+}
@@ -0,0 +1,183 @@
+#include<iostream>
+#include<vector>
+#include<string>
+#include<map>
+#include<thread>
+#include<chrono>
+#include<cstdlib>
+#include<cstdio>
+
+#include<signal.h>
+#include<sys/wait.h>
+#include<unistd.h>
+
+#include "WorkQueue.hpp"
+#include "ResultsStore.hpp"
+#include "FileSystem.hpp"
+
+/*
+ * WorkQueue in sharded use, as 2_subtractBinStack runs it: nWorker processes
+ * share nItem items through one queue directory (short claim timeout); each
+ * item's result is one row in a ResultsStore table; the worker that gets to
+ * RunOnce("merge") first compacts the table.
+ *
+ * One more worker (the victim) starts first, claims an item and is killed
+ * (SIGKILL) before finishing it: its claim goes stale and another worker must
+ * take the item over.
+ *
+ * Pass: every worker but the victim exits cleanly; the merged table has exactly
+ * one row per item (nItem rows, one segment), every item is marked done, the
+ * merge ran, and the victim's item was finished by someone else.
+*/
+
+using namespace std;
+
+// Inputs. ------------------------------------
+
+const size_t nItem=60, nWorker=3;
+const double claimTimeout=2;       // sec.
+const int workMs=20;               // per item.
+const unsigned maxSeconds=120;     // the whole test (alarm).
+
+// --------------------------------------------
+
+const string table="test.WorkQueueTest";
+
+// One worker process: claim, "work", store, done; then help merge. Returns the exit code.
+int RunWorker(const string &queueDir, const string &storeRoot, const vector<string> &items, const int &victimPipe){
+
+    WorkQueue queue(queueDir, items, claimTimeout);
+    do {
+        for (size_t i=queue.Claim(); i!=string::npos; i=queue.Claim()) {
+
+            if (victimPipe>=0) {
+                // tell the parent what we hold, then wait to be killed.
+                const string s=items[i]+"\n";
+                if (write(victimPipe,s.c_str(),s.size())!=(ssize_t)s.size()) {
+                    return 1;
+                }
+                while (true) {
+                    pause();
+                }
+            }
+
+            this_thread::sleep_for(chrono::milliseconds(workMs));
+            WriteResultsSegment(storeRoot, table, {"pairname","worker"}, {{ResultsCell(items[i])},{ResultsCell(WorkQueue::WorkerId())}});
+            queue.Done(i);
+        }
+    } while (queue.Wait());
+
+    queue.RunOnce("merge", [&](){
+        CompactResultsTable(storeRoot, table);
+    }, false);
+    return 0;
+}
+
+void RemoveTree(const string &dir){
+    for (const auto &item: Glob(dir + "/*")) {
+        RemoveTree(item);
+    }
+    for (const auto &item: Glob(dir + "/.*")) {
+        if (item != dir + "/." && item != dir + "/..") {
+            remove(item.c_str());
+        }
+    }
+    remove(dir.c_str());
+}
+
+int main(){
+
+    alarm(maxSeconds);
+
+    char tmpl[]="/tmp/WorkQueueTest.XXXXXX";
+    if (mkdtemp(tmpl)==nullptr) {
+        cout << "FAIL: can't make a temporary directory." << endl;
+        return 1;
+    }
+    const string root=tmpl, queueDir=root+"/queue", storeRoot=root+"/store";
+
+    vector<string> items;
+    for (size_t i=0; i<nItem; ++i) {
+        char buf[32];
+        snprintf(buf,sizeof(buf),"item%03zu",i);
+        items.push_back(buf);
+    }
+
+    // The victim: started alone, so it's the first to claim.
+    int fd[2];
+    if (pipe(fd)!=0) {
+        cout << "FAIL: pipe." << endl;
+        return 1;
+    }
+    const pid_t victim=fork();
+    if (victim==0) {
+        close(fd[0]);
+        _exit(RunWorker(queueDir,storeRoot,items,fd[1]));
+    }
+    close(fd[1]);
+    string victimItem;
+    char ch;
+    while (read(fd[0],&ch,1)==1 && ch!='\n') {
+        victimItem+=ch;
+    }
+    close(fd[0]);
+    kill(victim,SIGKILL);
+    waitpid(victim,nullptr,0);
+    const string victimId=WorkQueue::WorkerId().substr(0,WorkQueue::WorkerId().rfind('-')+1)+to_string((long)victim);
+
+    vector<pid_t> workers;
+    for (size_t w=0; w<nWorker; ++w) {
+        const pid_t pid=fork();
+        if (pid==0) {
+            _exit(RunWorker(queueDir,storeRoot,items,-1));
+        }
+        workers.push_back(pid);
+    }
+
+    size_t bad=0;
+    for (const auto &pid: workers) {
+        int status=0;
+        waitpid(pid,&status,0);
+        if (!WIFEXITED(status) || WEXITSTATUS(status)!=0) {
+            cout << "worker " << pid << " failed (status " << status << ")." << endl;
+            ++bad;
+        }
+    }
+
+    // The merged results.
+    const ResultsStore store(storeRoot,table);
+    const auto &worker=store.GetString("worker");
+    map<string,size_t> rowCnt;
+    for (const auto &item: store.GetString("pairname")) {
+        ++rowCnt[item];
+    }
+    for (const auto &item: items) {
+        struct stat st;
+        if (rowCnt[item]!=1 || stat((queueDir+"/"+item+".done").c_str(),&st)!=0) {
+            cout << item << ": " << rowCnt[item] << " rows, done marker " << (stat((queueDir+"/"+item+".done").c_str(),&st)==0) << endl;
+            ++bad;
+        }
+    }
+    const size_t nSegment=ResultsSegments(storeRoot+"/"+table).size();
+    struct stat st;
+    const bool merged=(stat((queueDir+"/@merge.done").c_str(),&st)==0);
+    if (store.NRow()!=nItem || nSegment!=1 || !merged) {
+        cout << "rows: " << store.NRow() << ", segments: " << nSegment << ", merge done: " << merged << endl;
+        ++bad;
+    }
+    const auto &rows=store.Rows("pairname",victimItem);
+    if (victimItem.empty() || rows.size()!=1 || worker[rows[0]]==victimId) {
+        cout << "the victim's item (" << victimItem << ") wasn't taken over." << endl;
+        ++bad;
+    }
+
+    RemoveTree(root);
+
+    if (bad!=0) {
+        cout << "FAIL: " << bad << " problems with " << nWorker << " workers (+1 killed), " << nItem << " items." << endl;
+        return 1;
+    }
+    cout << "PASS: " << nWorker << " workers (+1 killed holding " << victimItem << "), " << nItem
+         << " items, each stored exactly once; merged into one segment." << endl;
+    return 0;
+}
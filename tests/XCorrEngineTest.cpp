@@ -0,0 +1,84 @@
+#include<iostream>
+#include<vector>
+#include<cmath>
+#include<algorithm>
+
+#include<EvenSampledSignal.hpp>
+#include<SACSignals.hpp>
+#include<GetHomeDir.hpp>
+
+#include "ESWCache.hpp"
+#include "XCorrEngine.hpp"
+
+/*
+ * XCorrEngine vs the library's SACSignals::CrossCorrelation, on real PREM traces
+ * prepared the way 0_subtractModels prepares them (S peak at 0).
+ *
+ * Both call forms the drivers use are checked:
+ *   one template for all traces, windows (-15,15)  (deconWay drivers),
+ *   one template per trace,       windows (-10,10)  (0_subtractModels, S strip).
+ *
+ * Pass: every shift is the library's, to the sample (the drivers use whole-sample
+ * lags: refinement off), and every ccc within cccTol of the library's. This pins the
+ * engine's lag convention (shift is what StripSignal takes; one sample off moves the
+ * ESW strip) and its normalization (energy of both windows) to the library's.
+*/
+
+using namespace std;
+
+// Inputs. ------------------------------------
+
+const string premDataDir=GetHomeDir()+"/PROJ/t039.PREM/201500000000";
+const size_t TraceCnt=451;
+const double dt=0.025, filterCornerLow=0.033, filterCornerHigh=0.3, cutSourceT1=-100, cutSourceT2=100;
+
+const double cccTol=1e-3;
+
+// --------------------------------------------
+
+bool Compare(const string &name, const pair<vector<double>,vector<double>> &lib, const pair<vector<double>,vector<double>> &eng){
+
+    size_t shiftMismatch=0;
+    double maxCCC=0;
+    for (size_t i=0; i<min(lib.first.size(),eng.first.size()); ++i) {
+        if (lround(lib.first[i]/dt)!=lround(eng.first[i]/dt)) {
+            if (shiftMismatch<10) {
+                cout << name << ", trace " << i << ": shift " << eng.first[i] << " sec, library " << lib.first[i] << " sec." << endl;
+            }
+            ++shiftMismatch;
+        }
+        maxCCC=max(maxCCC,fabs(lib.second[i]-eng.second[i]));
+    }
+    bool ok=(lib.first.size()==eng.first.size() && shiftMismatch==0 && maxCCC<=cccTol);
+    cout << (ok ? "PASS: " : "FAIL: ") << name << ": " << shiftMismatch << " shifts differ (in samples), max |ccc diff| = " << maxCCC << endl;
+    return ok;
+}
+
+int main(){
+
+    const auto sESW=MakeSESW(premDataDir, TraceCnt, dt, filterCornerLow, filterCornerHigh, cutSourceT1, cutSourceT2);
+
+    SACSignals Data(Glob(premDataDir+"/*.THT.sac"));
+    Data.SortByGcarc();
+    Data.Interpolate(dt);
+    Data.RemoveTrend();
+    Data.HannTaper(20);
+    Data.Butterworth(filterCornerLow,filterCornerHigh);
+    Data.FindPeakAround(Data.GetTravelTimes("S"),10);
+    Data.ShiftTimeReferenceToPeak();
+    Data.FlipPeakUp();
+    Data.NormalizeToPeak();
+    Data.CheckAndCutToWindow(cutSourceT1,cutSourceT2);
+
+    vector<EvenSampledSignal> modifiedToFitS;
+    for (size_t i=0; i<Data.Size(); ++i) {
+        modifiedToFitS.push_back(sESW.StretchToFitHalfWidth(Data.GetData()[i]));
+    }
+
+    XCorrEngine xcorr;
+    bool ok=true;
+    ok&=Compare("one template", Data.CrossCorrelation(-15,15,sESW,-15,15), xcorr.CrossCorrelation(Data.GetData(),-15,15,sESW,-15,15));
+    ok&=Compare("per-trace templates", Data.CrossCorrelation(-10,10,modifiedToFitS,-10,10), xcorr.CrossCorrelation(Data.GetData(),-10,10,modifiedToFitS,-10,10));
+
+    return (ok ? 0 : 1);
+}